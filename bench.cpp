@@ -0,0 +1,341 @@
+// Microbenchmarks for the lexer, symbol table and code generator, an end to end
+// compile and the two checks, all over programs from ProgramGenerator, and the
+// run time compile of a small embedded program. Each benchmark runs in its own
+// child process so its peak RSS is its own. With --counters each line also has
+// the PerfCounters of its best run, which is how the lexer, lookups and code
+// generation get counters of their own: in a compile they all run inside Parse.
+#include "classes/AllocationCounter.h"
+#include "classes/CodeGen.h"
+#include "classes/Driver.h"
+#include "classes/Lexer.h"
+#include "classes/OutputWriter.h"
+#include "classes/PerfCounters.h"
+#include "classes/Profiler.h"
+#include "classes/ProgramGenerator.h"
+#include "classes/StaticCompiler.h"
+#include "classes/SymbolTable.h"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+struct BenchOptions {
+    GeneratorOptions program;
+    // Names declared and instructions emitted by the table and emit benchmarks
+    size_t items = 1 << 20;
+    int repeat = 3;
+    // Most heap allocations one compile may make while parsing, checked when
+    // allocations are counted
+    uint64_t parseAllocations = UINT64_MAX;
+    bool counters = false;
+};
+
+// What one run did, the best run of a benchmark is reported
+struct Measurement {
+    double seconds = 0;
+    double bytes = 0;
+    double items = 0;
+    const char* unit = "items";
+    // Heap allocations in the phase that matters, when they are counted
+    uint64_t allocations = 0;
+    // Read around the run with --counters
+    PerfCounters::Reading counters{};
+};
+
+template <typename Run>
+static Measurement best(const BenchOptions& options, Run run) {
+    Measurement result;
+    for (int i = 0; i < options.repeat; ++i) {
+        PerfCounters::Reading countersStart;
+        if (options.counters) countersStart = PerfCounters::forThread().read();
+        auto start = std::chrono::steady_clock::now();
+        Measurement m = run();
+        m.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (options.counters) m.counters = PerfCounters::difference(PerfCounters::forThread().read(), countersStart);
+        if (i == 0 || m.seconds < result.seconds) result = m;
+    }
+    return result;
+}
+
+static Measurement benchLexer(const BenchOptions& options) {
+    std::string source = ProgramGenerator(options.program).generate();
+    return best(options, [&] {
+        // The copy is part of what fromSource costs a real compile
+        Lexer lexer = Lexer::fromSource(source);
+        while (lexer.getNextToken().type != TokenType::END) {}
+        return Measurement{0, double(source.size()), double(lexer.tokenCount()), "tokens"};
+    });
+}
+
+static Measurement benchDeclare(const BenchOptions& options) {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < options.items; ++i) names.push_back("v" + std::to_string(i));
+    return best(options, [&] {
+        // Backed by an arena as in a compile
+        std::pmr::monotonic_buffer_resource arena;
+        SymbolTable table(&arena);
+        for (const auto& name : names) table.declare(name, ValueType::Integer);
+        return Measurement{0, 0, double(names.size()), "declares"};
+    });
+}
+
+// Keeps the lookups from being optimized away
+static volatile long lookupSink;
+
+static Measurement benchLookup(const BenchOptions& options) {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < options.items; ++i) names.push_back("v" + std::to_string(i));
+    // Looked up from a function scope, as a function body reads a global
+    std::pmr::monotonic_buffer_resource arena;
+    SymbolTable table(&arena);
+    for (const auto& name : names) table.declare(name, ValueType::Integer);
+    table.enterScope();
+    table.declare("p0", ValueType::Integer);
+    long sum = 0;
+    Measurement m = best(options, [&] {
+        for (size_t i = 0; i < names.size(); ++i) {
+            sum += table.getAddress(names[(i * 7919) % names.size()]);
+        }
+        return Measurement{0, 0, double(names.size()), "lookups"};
+    });
+    lookupSink = sum;
+    return m;
+}
+
+static Measurement benchEmit(const BenchOptions& options) {
+    return best(options, [&] {
+        CodeGen codeGen;
+        codeGen.setTrace(nullptr);
+        for (size_t i = 0; i < options.items; i += 4) {
+            codeGen.emit("PUSHM", "10000");
+            codeGen.emit("PUSHI", "1");
+            codeGen.emit("ADDI");
+            codeGen.emit("POPM", "10000");
+        }
+        return Measurement{0, 0, double(codeGen.emittedCount()), "instructions"};
+    });
+}
+
+// An end to end compile, or one of the checks that parse without making code
+static Measurement compileWith(const BenchOptions& options, CompileMode mode) {
+    std::string source = ProgramGenerator(options.program).generate();
+    std::string listing;
+    return best(options, [&] {
+        listing.clear();
+        OutputWriter out(listing);
+        // Only profiled for the allocation count, the profiler times every token
+        Profiler profiler;
+        CompileOptions compile;
+        compile.mode = mode;
+        if (allocationsCounted) compile.profiler = &profiler;
+        CompileStats stats = compileSource(source, out, compile);
+        if (!stats.ok) throw std::runtime_error("generated program failed to compile: " + stats.error);
+        uint64_t allocations = profiler.allocations(Profiler::Parse);
+        if (allocations > options.parseAllocations) {
+            throw std::runtime_error("parsing made " + std::to_string(allocations) + " heap allocations, the budget is " +
+                                     std::to_string(options.parseAllocations));
+        }
+        if (mode != CompileMode::Full) {
+            return Measurement{0, double(source.size()), double(source.size()), "bytes", allocations};
+        }
+        return Measurement{0, double(source.size()), double(stats.instructions), "instructions", allocations};
+    });
+}
+
+static Measurement benchCompile(const BenchOptions& options) {
+    return compileWith(options, CompileMode::Full);
+}
+
+static Measurement benchSymbols(const BenchOptions& options) {
+    return compileWith(options, CompileMode::SymbolsOnly);
+}
+
+static Measurement benchSyntax(const BenchOptions& options) {
+    return compileWith(options, CompileMode::SyntaxOnly);
+}
+
+// The kind of program a service embeds. It is compiled right here at build
+// time, the embedded benchmark times what compiling it at start up would cost.
+static constexpr std::string_view embeddedSource = R"($$
+function clamp(value, low, high integer) {
+    if (value < low) return low; endif
+    if (value > high) return high; endif
+    return value;
+}
+$$
+integer limit, total, i;
+$$
+scan(limit);
+total = 0;
+i = 0;
+while (i < limit) { total = total + clamp(i * 3, 10, 100); i = i + 1; } endwhile
+print(total);
+$$)";
+
+static constexpr auto embeddedProgram = RAT25S_STATIC_COMPILE(embeddedSource);
+static_assert(embeddedProgram.functions.size() == 1 && embeddedProgram.symbols.size() == 3,
+              "the embedded program compiled to something else");
+
+static Measurement benchEmbedded(const BenchOptions& options) {
+    size_t runs = std::max<size_t>(options.items / 1024, 1);
+    return best(options, [&] {
+        for (size_t i = 0; i < runs; ++i) {
+            CompileResult result = compile(embeddedSource);
+            if (!result.ok || result.instructions.empty()) throw std::runtime_error("embedded program: " + result.error);
+        }
+        return Measurement{0, double(runs * embeddedSource.size()), double(runs), "compiles"};
+    });
+}
+
+struct Benchmark {
+    const char* name;
+    Measurement (*run)(const BenchOptions&);
+};
+
+static const Benchmark benchmarks[] = {
+    {"lexer", benchLexer},
+    {"declare", benchDeclare},
+    {"lookup", benchLookup},
+    {"emit", benchEmit},
+    {"compile", benchCompile},
+    {"symbols", benchSymbols},
+    {"syntax", benchSyntax},
+    {"embedded", benchEmbedded},
+};
+
+// Per item where there are items, IPC and miss rates with a PMU and page faults
+// and context switches without one
+static std::string counterColumns(const Measurement& m) {
+    const PerfCounters& counters = PerfCounters::forThread();
+    const uint64_t* value = m.counters.value;
+    double items = m.items > 0 ? m.items : 1;
+    char line[160];
+    int n;
+    if (counters.counts(PerfCounters::Cycles) && counters.counts(PerfCounters::Instructions)) {
+        double cycles = value[PerfCounters::Cycles] > 0 ? double(value[PerfCounters::Cycles]) : 1;
+        n = std::snprintf(line, sizeof(line), "  IPC %5.2f %8.1f cycles/item", value[PerfCounters::Instructions] / cycles,
+                          value[PerfCounters::Cycles] / items);
+    } else {
+        n = std::snprintf(line, sizeof(line), "  %8.1f ns/item", value[PerfCounters::TaskClock] / items);
+    }
+    std::string columns(line, n);
+    const PerfCounters::Event misses[] = {PerfCounters::BranchMisses, PerfCounters::L1Misses, PerfCounters::LLCMisses};
+    for (PerfCounters::Event event : misses) {
+        if (!counters.counts(event)) continue;
+        n = std::snprintf(line, sizeof(line), " %.3f %s/item", value[event] / items, PerfCounters::eventName(event));
+        columns.append(line, n);
+    }
+    n = std::snprintf(line, sizeof(line), " %llu faults %llu switches (%s)",
+                      static_cast<unsigned long long>(value[PerfCounters::PageFaults]),
+                      static_cast<unsigned long long>(value[PerfCounters::ContextSwitches]),
+                      PerfCounters::sourceName(counters.source()));
+    columns.append(line, n);
+    return columns;
+}
+
+// Runs one benchmark in a child and prints its line, false when it failed
+static bool runIsolated(const Benchmark& benchmark, const BenchOptions& options) {
+    int channel[2];
+    if (pipe(channel) < 0) return false;
+    std::cout.flush();
+    pid_t child = fork();
+    if (child < 0) return false;
+    if (child == 0) {
+        close(channel[0]);
+        std::string report;
+        int status = 0;
+        try {
+            Measurement m = benchmark.run(options);
+            char line[256];
+            double rate = m.seconds > 0 ? 1.0 / m.seconds : 0;
+            std::string unit = std::string(m.unit) + "/s";
+            int n = std::snprintf(line, sizeof(line), "%10.4f s %12.0f %-14s", m.seconds, m.items * rate, unit.c_str());
+            report.assign(line, n);
+            n = m.bytes > 0 ? std::snprintf(line, sizeof(line), " %8.2f MB/s", m.bytes * rate / 1e6)
+                            : std::snprintf(line, sizeof(line), " %13s", "");
+            report.append(line, n);
+            if (allocationsCounted && m.allocations > 0) {
+                n = std::snprintf(line, sizeof(line), " %10llu allocations",
+                                  static_cast<unsigned long long>(m.allocations));
+                report.append(line, n);
+            }
+            if (options.counters) report += counterColumns(m);
+        } catch (const std::exception& e) {
+            report = e.what();
+            status = 1;
+        }
+        ssize_t ignored = write(channel[1], report.data(), report.size());
+        (void)ignored;
+        _exit(status);
+    }
+
+    close(channel[1]);
+    std::string report;
+    char block[256];
+    ssize_t n;
+    while ((n = read(channel[0], block, sizeof(block))) > 0) report.append(block, n);
+    close(channel[0]);
+
+    int status = 0;
+    rusage usage{};
+    wait4(child, &status, 0, &usage);
+    bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    char line[64];
+    // ru_maxrss is in KB on Linux
+    std::snprintf(line, sizeof(line), "%-8s ", benchmark.name);
+    std::cout << "[BENCH] " << line << report;
+    if (ok) {
+        std::snprintf(line, sizeof(line), "  peak RSS %7.1f MB", usage.ru_maxrss / 1024.0);
+        std::cout << line;
+    } else if (report.empty()) {
+        std::cout << "failed";
+    }
+    std::cout << "\n";
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    options.program.bytes = 4 << 20;
+    std::vector<std::string> selected;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--size=", 0) == 0) {
+            options.program.bytes = std::stoull(arg.substr(7)) << 10;
+        } else if (arg.rfind("--seed=", 0) == 0) {
+            options.program.seed = std::stoull(arg.substr(7));
+        } else if (arg.rfind("--items=", 0) == 0) {
+            options.items = std::stoull(arg.substr(8));
+        } else if (arg.rfind("--repeat=", 0) == 0) {
+            options.repeat = std::max(1, std::stoi(arg.substr(9)));
+        } else if (arg.rfind("--parse-allocations=", 0) == 0) {
+            options.parseAllocations = std::stoull(arg.substr(20));
+        } else if (arg == "--counters") {
+            options.counters = true;
+        } else if (arg[0] != '-') {
+            selected.push_back(arg);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--size=KB] [--seed=N] [--items=N] [--repeat=N]"
+                      << " [--parse-allocations=N] [--counters] [lexer|declare|lookup|emit|compile|symbols|syntax|embedded ...]\n";
+            return 1;
+        }
+    }
+
+    std::cout << "[BENCH] program " << options.program.bytes / 1024 << " KB, seed " << options.program.seed
+              << ", " << options.items << " items, best of " << options.repeat << "\n";
+    bool ok = true;
+    for (const auto& benchmark : benchmarks) {
+        bool wanted = selected.empty();
+        for (const auto& name : selected) wanted = wanted || name == benchmark.name;
+        if (wanted) ok = runIsolated(benchmark, options) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+#include "AllocationCounter.h"
+
+#ifdef RAT25S_COUNT_ALLOCATIONS
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Plain counters, constant initialized, so the first allocation on a new
+// thread can't recurse into operator new
+static thread_local uint64_t allocations = 0;
+static thread_local uint64_t allocationBytes = 0;
+
+uint64_t allocationCount() { return allocations; }
+uint64_t allocatedBytes() { return allocationBytes; }
+
+static void* allocate(std::size_t size, std::size_t alignment = 0) {
+    allocations++;
+    allocationBytes += size;
+    if (size == 0) size = 1;
+    void* p = nullptr;
+    if (alignment <= alignof(std::max_align_t)) {
+        p = std::malloc(size);
+    } else if (posix_memalign(&p, alignment, size) != 0) {
+        p = nullptr;
+    }
+    return p;
+}
+
+void* operator new(std::size_t size) {
+    void* p = allocate(size);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return allocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return allocate(size); }
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    void* p = allocate(size, static_cast<std::size_t>(alignment));
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](std::size_t size, std::align_val_t alignment) { return operator new(size, alignment); }
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocate(size, static_cast<std::size_t>(alignment));
+}
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocate(size, static_cast<std::size_t>(alignment));
+}
+
+// Everything comes from malloc or posix_memalign, free() takes both
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+
+#else
+
+uint64_t allocationCount() { return 0; }
+uint64_t allocatedBytes() { return 0; }
+
+#endif
@@ -0,0 +1,15 @@
+#pragma once
+#include <cstdint>
+
+// Heap allocations made by the calling thread so far. They are only counted in
+// a build with RAT25S_COUNT_ALLOCATIONS defined (cmake -DRAT25S_COUNT_ALLOCATIONS=ON
+// or make COUNT_ALLOCATIONS=1), which replaces the global operator new. In any
+// other build nothing is hooked and both are always 0.
+#ifdef RAT25S_COUNT_ALLOCATIONS
+constexpr bool allocationsCounted = true;
+#else
+constexpr bool allocationsCounted = false;
+#endif
+
+uint64_t allocationCount();
+uint64_t allocatedBytes();
@@ -0,0 +1,219 @@
+#include "CallGraph.h"
+
+CallGraph::CallGraph(CodeGen& codeGen, int inlineLimit)
+    : codeGen(codeGen), inlineLimit(inlineLimit) {}
+
+void CallGraph::run() {
+    sizeBefore = codeGen.getInstructions().size();
+    callsBefore = countCalls();
+
+    // Inlining can expose more small callees, give it a few rounds
+    for (int round = 0; round < 4 && inlineCalls(); ++round) {}
+    convertTailCalls();
+    removeDeadFunctions();
+
+    sizeAfter = codeGen.getInstructions().size();
+    callsAfter = countCalls();
+}
+
+std::vector<int> CallGraph::owners() const {
+    std::vector<int> owner(codeGen.getInstructions().size(), -1);
+    const auto& functions = codeGen.getFunctions();
+    for (size_t f = 0; f < functions.size(); ++f) {
+        for (int addr = functions[f].entry; addr < functions[f].end; ++addr) {
+            owner[addr - 1] = f;
+        }
+    }
+    return owner;
+}
+
+std::vector<bool> CallGraph::jumpTargets() const {
+    const auto& code = codeGen.getInstructions();
+    std::vector<bool> target(code.size() + 1, false);
+    for (const auto& instr : code) {
+        if (CodeGen::isJump(instr.op) && !instr.operand.empty()) {
+            target[std::stoi(instr.operand) - 1] = true;
+        }
+    }
+    return target;
+}
+
+int CallGraph::countCalls() const {
+    int calls = 0;
+    for (const auto& instr : codeGen.getInstructions()) {
+        if (instr.op == "CALL") calls++;
+    }
+    return calls;
+}
+
+CallGraph::Graph CallGraph::build() const {
+    const auto& code = codeGen.getInstructions();
+    const auto& functions = codeGen.getFunctions();
+    std::vector<int> owner = owners();
+
+    Graph graph;
+    graph[""];
+    for (const auto& fn : functions) graph[fn.name];
+    for (size_t i = 0; i < code.size(); ++i) {
+        std::string caller = owner[i] < 0 ? "" : functions[owner[i]].name;
+        if (code[i].op == "CALL") {
+            graph[caller].insert(code[i].operand);
+        } else if (code[i].op == "JUMP") {
+            // A tail call is a jump onto another function's LABEL
+            size_t target = std::stoi(code[i].operand) - 1;
+            if (target < code.size() && code[target].op == "LABEL" && !code[target].operand.empty()) {
+                graph[caller].insert(code[target].operand);
+            }
+        }
+    }
+    return graph;
+}
+
+std::set<std::string> CallGraph::reachable(const Graph& graph, const std::string& from) const {
+    std::set<std::string> seen;
+    std::vector<std::string> work{from};
+    while (!work.empty()) {
+        std::string name = work.back();
+        work.pop_back();
+        auto it = graph.find(name);
+        if (it == graph.end()) continue;
+        for (const auto& callee : it->second) {
+            if (seen.insert(callee).second) work.push_back(callee);
+        }
+    }
+    return seen;
+}
+
+bool CallGraph::inlineCalls() {
+    const auto& code = codeGen.getInstructions();
+    const auto& functions = codeGen.getFunctions();
+    Graph graph = build();
+    std::vector<bool> target = jumpTargets();
+
+    // Straight-line, non-recursive bodies with a single RET at the end. The body
+    // keeps the parameter POPMs, the caller already pushed the arguments.
+    std::map<std::string, std::vector<Instruction>> bodies;
+    for (const auto& fn : functions) {
+        int size = fn.end - fn.entry - 1;
+        if (size > inlineLimit || code[fn.end - 2].op != "RET") continue;
+        if (reachable(graph, fn.name).count(fn.name)) continue;
+
+        bool straight = true;
+        for (int addr = fn.entry + 1; addr < fn.end; ++addr) {
+            const Instruction& instr = code[addr - 1];
+            if (target[addr - 1] || CodeGen::isJump(instr.op) || (instr.op == "RET" && addr != fn.end - 1)) {
+                straight = false;
+            }
+        }
+        if (!straight) continue;
+        bodies[fn.name].assign(code.begin() + fn.entry, code.begin() + fn.end - 2);
+    }
+    if (bodies.empty()) return false;
+
+    std::vector<Instruction> result;
+    result.reserve(code.size());
+    int inlined = 0;
+    for (size_t i = 0; i < code.size(); ++i) {
+        auto body = code[i].op == "CALL" ? bodies.find(code[i].operand) : bodies.end();
+        if (body == bodies.end()) {
+            result.push_back(code[i]);
+            continue;
+        }
+
+        // POP R1 right before the caller's PUSH R1 is a round trip, skip both
+        std::vector<Instruction> copy = body->second;
+        bool fuse = !copy.empty() && copy.back().op == "POP" && copy.back().operand == "R1" &&
+                    i + 1 < code.size() && code[i + 1].op == "PUSH" && code[i + 1].operand == "R1" &&
+                    !target[i + 1];
+        if (fuse) copy.pop_back();
+        for (auto& instr : copy) instr.address = 0;
+        if (!copy.empty()) copy.front().address = code[i].address;
+        result.insert(result.end(), copy.begin(), copy.end());
+        if (fuse) i++;
+        inlined++;
+    }
+
+    inlinedSites += inlined;
+    codeGen.relink(std::move(result));
+    return inlined > 0;
+}
+
+void CallGraph::convertTailCalls() {
+    const auto& code = codeGen.getInstructions();
+    std::vector<int> owner = owners();
+    std::vector<bool> target = jumpTargets();
+
+    std::vector<Instruction> result;
+    result.reserve(code.size());
+    int converted = 0;
+    for (size_t i = 0; i < code.size(); ++i) {
+        const FunctionInfo* callee = code[i].op == "CALL" ? codeGen.findFunction(code[i].operand) : nullptr;
+        if (callee == nullptr || owner[i] < 0) {
+            result.push_back(code[i]);
+            continue;
+        }
+
+        // CALL g [PUSH R1 POP R1] RET: g's RET can return straight to our caller
+        size_t ret = i + 1;
+        if (ret + 1 < code.size() && code[ret].op == "PUSH" && code[ret].operand == "R1" &&
+            code[ret + 1].op == "POP" && code[ret + 1].operand == "R1") {
+            ret += 2;
+        }
+        if (ret >= code.size() || code[ret].op != "RET" || owner[ret] != owner[i]) {
+            result.push_back(code[i]);
+            continue;
+        }
+
+        result.push_back({code[i].address, "JUMP", std::to_string(callee->entry)});
+        converted++;
+        // The tail is dead now, unless another path jumps into it
+        bool reached = false;
+        for (size_t k = i + 1; k <= ret; ++k) reached = reached || target[k];
+        if (!reached) i = ret;
+    }
+
+    if (converted == 0) return;
+    tailCalls += converted;
+    codeGen.relink(std::move(result));
+}
+
+void CallGraph::removeDeadFunctions() {
+    const auto& code = codeGen.getInstructions();
+    const auto& functions = codeGen.getFunctions();
+    std::vector<int> owner = owners();
+
+    // A file with no statements of its own has no entry to measure from
+    bool hasTopLevel = false;
+    for (int f : owner) hasTopLevel = hasTopLevel || f < 0;
+    if (!hasTopLevel) return;
+
+    std::set<std::string> live = reachable(build(), "");
+    std::vector<bool> dead(functions.size(), false);
+    bool any = false;
+    for (size_t f = 0; f < functions.size(); ++f) {
+        if (!live.count(functions[f].name)) {
+            dead[f] = true;
+            any = true;
+            removed.push_back(functions[f].name);
+        }
+    }
+    if (!any) return;
+
+    std::vector<Instruction> result;
+    result.reserve(code.size());
+    for (size_t i = 0; i < code.size(); ++i) {
+        if (owner[i] < 0 || !dead[owner[i]]) result.push_back(code[i]);
+    }
+    codeGen.relink(std::move(result));
+}
+
+void CallGraph::print(std::ostream& out) const {
+    out << "[CALLGRAPH] inlined " << inlinedSites << " call sites, " << tailCalls << " tail calls";
+    if (!removed.empty()) {
+        out << ", removed:";
+        for (const auto& name : removed) out << " " << name;
+    }
+    out << "\n";
+    out << "[CALLGRAPH] program: " << sizeBefore << " -> " << sizeAfter << " instructions, "
+        << callsBefore << " -> " << callsAfter << " calls\n";
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "CodeGen.h"
+
+// Whole-program pass over the functions CodeGen recorded. Small non-recursive
+// functions are inlined at their call sites, a CALL in tail position becomes a
+// JUMP, and functions the top-level statements can never reach are dropped.
+class CallGraph {
+public:
+    explicit CallGraph(CodeGen& codeGen, int inlineLimit = 24);
+
+    void run();
+    void print(std::ostream& out) const;
+
+private:
+    // Callees of every function, the top-level code is the entry ""
+    using Graph = std::map<std::string, std::set<std::string>>;
+
+    Graph build() const;
+    std::set<std::string> reachable(const Graph& graph, const std::string& from) const;
+    bool inlineCalls();
+    void convertTailCalls();
+    void removeDeadFunctions();
+
+    // Owning function index of every instruction, -1 for top-level code
+    std::vector<int> owners() const;
+    std::vector<bool> jumpTargets() const;
+    int countCalls() const;
+
+    CodeGen& codeGen;
+    int inlineLimit;
+
+    int sizeBefore = 0;
+    int sizeAfter = 0;
+    int callsBefore = 0;
+    int callsAfter = 0;
+    int inlinedSites = 0;
+    int tailCalls = 0;
+    std::vector<std::string> removed;
+};
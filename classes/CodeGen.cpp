@@ -1,39 +1,301 @@
 #include "CodeGen.h"
+#include "OutputWriter.h"
+#include "Superinstructions.h"
+#include <algorithm>
 #include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+CodeGen::CodeGen(std::pmr::memory_resource* memory) : trace(&std::cout), captures(memory) {}
 
 int CodeGen::emit(const std::string& op, const std::string& operand) {
-    int addr = instructions.size() + 1;
+    emitted++;
+    if (!captures.empty()) {
+        captures.back().push_back({0, op, operand});
+        return 0;
+    }
+    int addr = getNextAddress();
     instructions.push_back({addr, op, operand});
-    std::cout << "[EMIT]" << addr << ": " << op << " " << operand << std::endl;
+    if (trace != nullptr) *trace << "[EMIT]" << addr << ": " << op << " " << operand << "\n";
+    lastEmitted = op;
+    if (isJump(op)) {
+        if (!operand.empty()) {
+            furthestTarget = std::max(furthestTarget, std::stoi(operand));
+        } else if (sink != nullptr) {
+            pending.insert(addr);
+        }
+    }
+    if (sink != nullptr) drain();
     return addr;
 }
 
 void CodeGen::backpatch(int addr, const std::string& operand) {
-    if (addr > 0 && addr <= instructions.size()) {
-        instructions[addr - 1].operand = operand;
+    if (addr <= 0 || addr >= getNextAddress()) return;
+    if (!operand.empty()) {
+        furthestTarget = std::max(furthestTarget, std::stoi(operand));
+    }
+    if (addr > written) {
+        instructions[addr - written - 1].operand = operand;
+        if (pending.erase(addr) > 0) drain();
+        return;
+    }
+
+    // Already streamed out, only a jump written with a blank operand can change
+    auto blank = blankOperands.find(addr);
+    if (blank == blankOperands.end() || operand.size() > operandWidth) {
+        throw std::runtime_error("Cannot backpatch instruction " + std::to_string(addr) + ", it was already written");
+    }
+    if (!sink->patch(blank->second, operand)) {
+        throw std::runtime_error("Cannot backpatch instruction " + std::to_string(addr) + ", the output can't seek");
+    }
+    blankOperands.erase(blank);
+    seekPatches++;
+}
+
+void CodeGen::backpatch(const BackpatchList& list, int target) {
+    std::string operand = std::to_string(target);
+    for (int addr : list) {
+        backpatch(addr, operand);
+    }
+}
+
+void CodeGen::streamTo(OutputWriter& out, size_t window) {
+    if (!instructions.empty() || written > 0) {
+        throw std::runtime_error("Streaming has to start before any code is emitted");
+    }
+    sink = &out;
+    windowLimit = window;
+    out << "\nAssembly Code:\n";
+}
+
+void CodeGen::drain() {
+    peakWindow = std::max(peakWindow, instructions.size());
+    size_t k = 0;
+    for (; k < instructions.size(); ++k) {
+        const Instruction& instr = instructions[k];
+        if (!pending.count(instr.address)) {
+            writeInstruction(*sink, instr);
+            continue;
+        }
+        if (instructions.size() - k <= windowLimit) break;
+
+        // Long-range fixup: leave room for the operand and seek back for it later
+        *sink << instr.address << ' ' << instr.op << ' ';
+        blankOperands[instr.address] = sink->bytesWritten();
+        *sink << std::string_view("          ", operandWidth) << '\n';
+        pending.erase(instr.address);
+    }
+    instructions.erase(instructions.begin(), instructions.begin() + k);
+    written += k;
+}
+
+void CodeGen::printStreamStats(std::ostream& out) const {
+    out << "[STREAM] " << written + instructions.size() << " instructions, peak window " << peakWindow
+        << ", " << seekPatches << " patched in place\n";
+}
+
+void CodeGen::addFunction(const std::string& name, int entry, int params) {
+    functions.push_back({name, entry, getNextAddress(), params});
+}
+
+const FunctionInfo* CodeGen::functionAt(int addr) const {
+    for (const auto& fn : functions) {
+        if (addr >= fn.entry && addr < fn.end) return &fn;
+    }
+    return nullptr;
+}
+
+const FunctionInfo* CodeGen::findFunction(const std::string& name) const {
+    for (const auto& fn : functions) {
+        if (fn.name == name) return &fn;
+    }
+    return nullptr;
+}
+
+void CodeGen::addImport(const std::string& name, int params) {
+    imports[name] = params;
+}
+
+int CodeGen::paramsOf(const std::string& name) const {
+    if (const FunctionInfo* fn = findFunction(name)) return fn->params;
+    auto import = imports.find(name);
+    return import != imports.end() ? import->second : -1;
+}
+
+void CodeGen::markVerified(const std::string& name, int maxStack) {
+    for (auto& fn : functions) {
+        if (fn.name == name) {
+            fn.verified = true;
+            fn.maxStack = maxStack;
+        }
     }
 }
 
+void CodeGen::beginCapture() {
+    captures.emplace_back();
+}
+
+std::pmr::vector<Instruction> CodeGen::endCapture() {
+    std::pmr::vector<Instruction> code = std::move(captures.back());
+    captures.pop_back();
+    return code;
+}
+
+void CodeGen::append(const std::pmr::vector<Instruction>& code) {
+    for (const auto& instr : code) {
+        emit(instr.op, instr.operand);
+    }
+}
+
+int CodeGen::addConstant(const std::string& literal) {
+    for (size_t i = 0; i < constants.size(); ++i) {
+        if (constants[i] == literal) return i;
+    }
+    constants.push_back(literal);
+    return constants.size() - 1;
+}
+
 int CodeGen::getNextAddress() const {
-    return instructions.size() + 1;
+    return written + instructions.size() + 1;
 }
 
 void CodeGen::print() const {
-    std::cout << "\nAssembly Code:\n";
-    for (const auto& instr : instructions) {
-        std::cout << instr.address << " " << instr.op;
-        if (!instr.operand.empty())
-            std::cout << " " << instr.operand;
-        std::cout << "\n";
-    }
+    print(std::cout);
 }
 
 void CodeGen::print(std::ostream& out) const {
-    out << "\nAssembly Code:\n";
+    OutputWriter writer(out);
+    print(writer);
+}
+
+void CodeGen::print(OutputWriter& out) const {
+    // A streamed listing is already out, and its window is empty once parsing is done
+    if (sink == nullptr) out << "\nAssembly Code:\n";
     for (const auto& instr : instructions) {
-        out << instr.address << " " << instr.op;
-        if (!instr.operand.empty())
-            out << " " << instr.operand;
-        out << "\n";
+        writeInstruction(out, instr);
     }
-}
\ No newline at end of file
+    if (!constants.empty()) {
+        out << "\nConstant Pool:\n";
+        for (size_t i = 0; i < constants.size(); ++i) {
+            out << i << ' ' << constants[i] << '\n';
+        }
+    }
+}
+
+void CodeGen::writeInstruction(OutputWriter& out, const Instruction& instr) const {
+    out << instr.address << ' ' << instr.op;
+    if (!instr.operand.empty())
+        out << ' ' << instr.operand;
+    out << '\n';
+}
+
+bool CodeGen::isJump(const std::string& op) {
+    return op == "JUMP" || isConditionalJump(op);
+}
+
+// Fused compare-and-branch: pops b then a and jumps when a <rel> b, the F forms compare reals
+bool CodeGen::isConditionalJump(const std::string& op) {
+    std::string base = op.size() == 4 && op.back() == 'F' ? op.substr(0, 3) : op;
+    return base == "JEQ" || base == "JNE" || base == "JGT" || base == "JLT" || base == "JGE" || base == "JLE";
+}
+
+bool CodeGen::isVectorOp(const std::string& op) {
+    if (op == "VCOPY" || op == "VFILL") return true;
+    if ((op.size() != 5 && op.size() != 6) || op[0] != 'V' || (op.size() == 6 && op.back() != 'S')) return false;
+    std::string base = op.substr(1, 4);
+    return base == "ADDI" || base == "SUBI" || base == "MULI" || base == "ADDF" || base == "SUBF" || base == "MULF";
+}
+
+std::vector<int> CodeGen::addresses(const std::string& operand) {
+    std::vector<int> list;
+    size_t start = 0;
+    while (start <= operand.size()) {
+        size_t comma = operand.find(',', start);
+        if (comma == std::string::npos) comma = operand.size();
+        list.push_back(std::stoi(operand.substr(start, comma - start)));
+        start = comma + 1;
+    }
+    return list;
+}
+
+std::string CodeGen::addressOperand(const std::vector<int>& addresses) {
+    std::string operand;
+    for (int addr : addresses) {
+        if (!operand.empty()) operand += ',';
+        operand += std::to_string(addr);
+    }
+    return operand;
+}
+
+void CodeGen::relink(std::vector<Instruction> code) {
+    if (sink != nullptr) {
+        throw std::runtime_error("Cannot rewrite a streamed program");
+    }
+    // Old address (or new id) -> position in the rewritten program
+    std::unordered_map<int, int> newAddress;
+    for (size_t i = 0; i < code.size(); ++i) {
+        if (code[i].address != 0) {
+            newAddress[code[i].address] = i + 1;
+        }
+    }
+
+    int oldEnd = instructions.size() + 1;
+    int newEnd = code.size() + 1;
+    auto resolve = [&](int target) {
+        // Removed instructions fall through to the next one that was kept
+        while (target > 0 && target < oldEnd && !newAddress.count(target)) {
+            target++;
+        }
+        if (target > 0 && target >= oldEnd) return newEnd;
+        auto it = newAddress.find(target);
+        if (it == newAddress.end()) {
+            throw std::runtime_error("Jump to unknown instruction " + std::to_string(target));
+        }
+        return it->second;
+    };
+
+    for (auto& instr : code) {
+        if (isJump(instr.op) && !instr.operand.empty()) {
+            instr.operand = std::to_string(resolve(std::stoi(instr.operand)));
+        }
+    }
+
+    std::vector<FunctionInfo> moved;
+    for (const auto& fn : functions) {
+        if (newAddress.count(fn.entry)) {
+            // Changed code has to be verified again
+            moved.push_back({fn.name, newAddress[fn.entry], resolve(fn.end), fn.params});
+        }
+    }
+    functions = std::move(moved);
+    for (size_t i = 0; i < code.size(); ++i) {
+        code[i].address = i + 1;
+    }
+    instructions = std::move(code);
+}
+
+bool CodeGen::stackEffect(const std::string& op, int& pops, int& pushes) {
+    pops = 0;
+    pushes = 0;
+    if (op == "PUSHI" || op == "PUSHF" || op == "PUSHM" || op == "PUSH" || op == "IN") {
+        pushes = 1;
+    } else if (op == "POPM" || op == "POP" || op == "OUT") {
+        pops = 1;
+    } else if (op == "NEGI" || op == "NEGF" || op == "PUSHMX") {
+        pops = 1;
+        pushes = 1;
+    } else if (op == "ADDI" || op == "SUBI" || op == "MULI" || op == "DIVI" ||
+               op == "ADDF" || op == "SUBF" || op == "MULF" || op == "DIVF") {
+        pops = 2;
+        pushes = 1;
+    } else if (isConditionalJump(op) || op == "POPMX") {
+        pops = 2;
+    } else if (isVectorOp(op)) {
+        pops = op == "VFILL" || op.back() == 'S' ? 3 : 2;
+    } else if (Superinstructions::stackEffect(op, pops, pushes)) {
+        return true;
+    } else if (op != "JUMP" && op != "LABEL" && op != "RET") {
+        return false;
+    }
+    return true;
+}
@@ -1,21 +1,153 @@
 #pragma once
+#include <iosfwd>
+#include <memory_resource>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+class OutputWriter;
+
 struct Instruction {
     int address;
     std::string op;
     std::string operand;
 };
 
+// A function's code is [entry, end), entry being its LABEL
+struct FunctionInfo {
+    std::string name;
+    int entry;
+    int end;
+    int params;
+    // Set by the Verifier: stack balanced on every path and never deeper than maxStack
+    bool verified = false;
+    int maxStack = 0;
+};
+
 class CodeGen {
 public:
+    // Jumps waiting for the same target
+    using BackpatchList = std::pmr::vector<int>;
+
+    // Captured code comes from memory, normally the compilation's scratch pool,
+    // which takes it back once it is appended. The program itself stays on the
+    // heap.
+    explicit CodeGen(std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+
     int emit(const std::string& op, const std::string& operand = "");
     void backpatch(int addr, const std::string& operand);
+    // Point every jump in a backpatch list at target
+    void backpatch(const BackpatchList& list, int target);
     int getNextAddress() const;
+    // Instructions emitted, captured ones included, for the profiler
+    size_t emittedCount() const { return emitted; }
+    // Each emitted instruction is echoed here, nullptr turns the echo off
+    void setTrace(std::ostream* out) { trace = out; }
+    // Op of the last instruction emitted outside a capture, "" before the first
+    const std::string& lastOp() const { return lastEmitted; }
+    // True when some jump targets the next address, i.e. lands past all the code so far
+    bool jumpsToEnd() const { return furthestTarget >= getNextAddress(); }
+    // Index of a real literal in the constant pool, PUSHF's operand
+    int addConstant(const std::string& literal);
     void print() const;
     void print(std::ostream& out) const;
+    void print(OutputWriter& out) const;
+
+    // Write the listing to out while parsing instead of keeping the whole program.
+    // Instructions go out as soon as no earlier jump is waiting for its target, so
+    // only the stretch behind the oldest unpatched jump stays in memory. If that
+    // stretch grows past window instructions, the jump is written with a blank
+    // operand field and filled in with OutputWriter::patch once its target is
+    // known. The program is never complete in memory, so whole-program passes
+    // (getInstructions, relink) can't run on a streamed CodeGen. The code is also
+    // written before anything the parser lists once it is done, so a streamed
+    // listing has the Assembly Code section first, not last.
+    void streamTo(OutputWriter& out, size_t window = defaultWindow);
+    bool streaming() const { return sink != nullptr; }
+    void printStreamStats(std::ostream& out) const;
+    static constexpr size_t defaultWindow = 4096;
+
+    // Access for optimization passes that run after parsing
+    const std::vector<Instruction>& getInstructions() const { return instructions; }
+
+    // Record a finished function, it ends at the next address
+    void addFunction(const std::string& name, int entry, int params);
+    const std::vector<FunctionInfo>& getFunctions() const { return functions; }
+    // Function containing an address, nullptr for top-level code
+    const FunctionInfo* functionAt(int addr) const;
+    const FunctionInfo* findFunction(const std::string& name) const;
+    // A function this module calls but another one defines, for separate
+    // compilation. Its code only turns up when the modules are linked.
+    void addImport(const std::string& name, int params);
+    // Parameters of a function or an import, -1 when neither has the name
+    int paramsOf(const std::string& name) const;
+    void markVerified(const std::string& name, int maxStack);
+
+    const std::vector<std::string>& getConstants() const { return constants; }
+
+    // Replace the program with a rewritten copy. Each instruction's address must be
+    // the address it had before the rewrite, or a unique negative id for instructions
+    // the pass created. Jump operands may refer to either; they are resolved and the
+    // whole program is renumbered from 1. A jump to a removed instruction lands on
+    // the next instruction that survived. Function ranges move the same way, a
+    // function whose LABEL was removed is dropped. Code inserted in front of an
+    // instruction should take over that instruction's address when jumps and the
+    // range boundaries that pointed at the instruction are meant to reach it.
+    void relink(std::vector<Instruction> code);
+
+    // Divert emitted code into a side buffer so it can be placed later, e.g. a
+    // while test that goes after the loop body. Captured code can't hold jumps.
+    void beginCapture();
+    std::pmr::vector<Instruction> endCapture();
+    void append(const std::pmr::vector<Instruction>& code);
+
+    static bool isJump(const std::string& op);
+    static bool isConditionalJump(const std::string& op);
+    // Bulk ops over the elements [start, end) of arrays, end popped first, then
+    // start. The operand is the destination array's address followed by the
+    // source arrays', comma separated. VFILL and the S forms also pop a scalar
+    // from under the range: VFILL stores it, VADDIS a,b does a[k] = b[k] + s.
+    //   VCOPY dst,src   VFILL dst
+    //   VADDI VSUBI VMULI VADDF VSUBF VMULF         dst,src,src
+    //   VADDIS VSUBIS VMULIS VADDFS VSUBFS VMULFS   dst,src
+    static bool isVectorOp(const std::string& op);
+    // The memory addresses in an operand, one for PUSHM and the like, all of a vector op's
+    static std::vector<int> addresses(const std::string& operand);
+    static std::string addressOperand(const std::vector<int>& addresses);
+    // Values an instruction pops and pushes, a superinstruction's are those of
+    // its base sequence. False for CALL, whose pops depend on the callee, and for
+    // unknown ops.
+    static bool stackEffect(const std::string& op, int& pops, int& pushes);
 
 private:
+    void writeInstruction(OutputWriter& out, const Instruction& instr) const;
+    // Write out the instructions that are final, and the oldest pending jumps
+    // while the window is over its limit
+    void drain();
+
+    // Width of the blank operand field of a jump written before its target was
+    // known, enough for any int
+    static constexpr size_t operandWidth = 10;
+
+    // The whole program, or when streaming the window of unwritten instructions,
+    // which starts after the first `written`
     std::vector<Instruction> instructions;
+    int written = 0;
+    OutputWriter* sink = nullptr;
+    size_t windowLimit = 0;
+    // Streamed jumps without a target, held in the window or written blank
+    std::set<int> pending;
+    std::unordered_map<int, size_t> blankOperands;
+    size_t peakWindow = 0;
+    int seekPatches = 0;
+
+    std::ostream* trace;
+    size_t emitted = 0;
+    std::string lastEmitted;
+    int furthestTarget = 0;
+    std::pmr::vector<std::pmr::vector<Instruction>> captures;
+    std::vector<FunctionInfo> functions;
+    std::unordered_map<std::string, int> imports;
+    std::vector<std::string> constants;
 };
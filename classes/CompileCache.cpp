@@ -0,0 +1,178 @@
+#include "CompileCache.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Bump when the listing format changes without the binary changing
+static constexpr const char* cacheFormat = "rat25s-cache 1";
+
+// The running executable's size and mtime stand in for its version, so a
+// rebuilt compiler never reads entries an older build wrote
+static const std::string& compilerIdentity() {
+    static const std::string identity = [] {
+        std::string id = cacheFormat;
+        struct stat info;
+        if (stat("/proc/self/exe", &info) == 0) {
+            id += " " + std::to_string(info.st_size) + " " + std::to_string(info.st_mtim.tv_sec) + "." +
+                  std::to_string(info.st_mtim.tv_nsec);
+        }
+        return id;
+    }();
+    return identity;
+}
+
+static uint64_t fnv1a(uint64_t hash, std::string_view bytes) {
+    for (unsigned char c : bytes) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+CompileCache::CompileCache(std::string directory, uint64_t maxBytes)
+    : directory(std::move(directory)), maxBytes(maxBytes) {
+    std::error_code ec;
+    fs::create_directories(this->directory, ec);
+}
+
+uint64_t CompileCache::key(std::string_view source, std::string_view options) {
+    uint64_t hash = 14695981039346656037ull;
+    hash = fnv1a(hash, compilerIdentity());
+    hash = fnv1a(hash, std::string_view("\0", 1));
+    hash = fnv1a(hash, options);
+    hash = fnv1a(hash, std::string_view("\0", 1));
+    return fnv1a(hash, source);
+}
+
+std::string CompileCache::pathFor(uint64_t key) const {
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+    return directory + "/" + name;
+}
+
+// An entry is a header line,
+//   <ok> <instructions> <source bytes> <error length> <diagnostics length>
+// then the error text, the diagnostics and the listing
+bool CompileCache::lookup(uint64_t key, size_t sourceBytes, Entry& entry) {
+    std::string path = pathFor(key);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        misses++;
+        return false;
+    }
+    struct stat info;
+    std::string data;
+    if (fstat(fd, &info) == 0) {
+        data.resize(info.st_size);
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = read(fd, data.data() + done, data.size() - done);
+            if (n <= 0) break;
+            done += n;
+        }
+        data.resize(done);
+    }
+    close(fd);
+
+    size_t newline = data.find('\n');
+    int ok = 0, instructions = 0;
+    unsigned long long size = 0, errorLength = 0, diagnosticsLength = 0;
+    if (newline == std::string::npos ||
+        std::sscanf(data.c_str(), "%d %d %llu %llu %llu", &ok, &instructions, &size, &errorLength,
+                    &diagnosticsLength) != 5 ||
+        size != sourceBytes || newline + 1 + errorLength + diagnosticsLength > data.size()) {
+        // Damaged, or a hash collision with a different length of source
+        misses++;
+        return false;
+    }
+    entry.ok = ok != 0;
+    entry.instructions = instructions;
+    entry.error = data.substr(newline + 1, errorLength);
+    entry.diagnostics = data.substr(newline + 1 + errorLength, diagnosticsLength);
+    entry.output = std::move(data);
+    entry.output.erase(0, newline + 1 + errorLength + diagnosticsLength);
+
+    // Recently used, for eviction
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    hits++;
+    return true;
+}
+
+void CompileCache::store(uint64_t key, size_t sourceBytes, const Entry& entry) {
+    std::string header = std::to_string(entry.ok ? 1 : 0) + " " + std::to_string(entry.instructions) + " " +
+                         std::to_string(sourceBytes) + " " + std::to_string(entry.error.size()) + " " +
+                         std::to_string(entry.diagnostics.size()) + "\n";
+    uint64_t size = header.size() + entry.error.size() + entry.diagnostics.size() + entry.output.size();
+    if (size > maxBytes / 4 * 3) return;  // It would only push everything else out
+
+    std::ostringstream tempName;
+    tempName << directory << "/.tmp-" << getpid() << "-" << std::this_thread::get_id();
+    std::string temp = tempName.str();
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out << header << entry.error << entry.diagnostics << entry.output;
+        if (!out) {
+            std::remove(temp.c_str());
+            return;
+        }
+    }
+    if (std::rename(temp.c_str(), pathFor(key).c_str()) != 0) {
+        std::remove(temp.c_str());
+        return;
+    }
+    stores++;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (totalBytes < 0) {
+        totalBytes = 0;
+        std::error_code ec;
+        for (const auto& file : fs::directory_iterator(directory, ec)) {
+            totalBytes += file.file_size(ec);
+        }
+    } else {
+        totalBytes += size;
+    }
+    if (static_cast<uint64_t>(totalBytes) > maxBytes) evict();
+}
+
+void CompileCache::evict() {
+    struct File {
+        fs::file_time_type used;
+        uintmax_t size;
+        fs::path path;
+    };
+    std::vector<File> files;
+    std::error_code ec;
+    totalBytes = 0;
+    for (const auto& file : fs::directory_iterator(directory, ec)) {
+        if (!file.is_regular_file(ec) || file.path().filename().string().rfind(".tmp-", 0) == 0) continue;
+        File f{file.last_write_time(ec), file.file_size(ec), file.path()};
+        totalBytes += f.size;
+        files.push_back(std::move(f));
+    }
+    std::sort(files.begin(), files.end(), [](const File& a, const File& b) { return a.used < b.used; });
+
+    for (const auto& file : files) {
+        if (static_cast<uint64_t>(totalBytes) <= maxBytes / 4 * 3) break;
+        // Another process may have taken it already, that's as good
+        fs::remove(file.path, ec);
+        totalBytes -= file.size;
+        evictions++;
+    }
+}
+
+void CompileCache::printStats(std::ostream& out) const {
+    out << "[CACHE] " << hits << " hits, " << misses << " misses, " << stores << " stored, " << evictions
+        << " evicted (" << directory << ", limit " << (maxBytes >> 20) << " MB)\n";
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// Finished listings on disk, keyed by a hash of the source bytes, the compiler
+// build and the options that change the listing. Entries are written to a
+// temporary file and renamed into place, so readers (other threads or other
+// processes) never see half an entry. A hit refreshes the entry's mtime, and
+// once the directory grows past its limit the least recently used entries go.
+class CompileCache {
+public:
+    struct Entry {
+        bool ok = false;
+        int instructions = 0;
+        std::string error;
+        std::string diagnostics;
+        std::string output;
+    };
+
+    explicit CompileCache(std::string directory, uint64_t maxBytes = defaultMaxBytes);
+
+    // FNV-1a over the compiler identity, the options that change the output
+    // (spelled out by the Driver) and the source
+    static uint64_t key(std::string_view source, std::string_view options);
+    bool lookup(uint64_t key, size_t sourceBytes, Entry& entry);
+    void store(uint64_t key, size_t sourceBytes, const Entry& entry);
+
+    void printStats(std::ostream& out) const;
+
+    static constexpr uint64_t defaultMaxBytes = 256ull << 20;
+
+private:
+    std::string pathFor(uint64_t key) const;
+    // Drops the oldest entries until the cache is at 3/4 of its limit
+    void evict();
+
+    std::string directory;
+    uint64_t maxBytes;
+
+    std::mutex mutex;
+    // Size of the directory, measured on the first store and kept up to date
+    int64_t totalBytes = -1;
+
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+    std::atomic<size_t> stores{0};
+    std::atomic<size_t> evictions{0};
+};
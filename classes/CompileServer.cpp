@@ -0,0 +1,192 @@
+#include "CompileServer.h"
+#include "Driver.h"
+#include "OutputWriter.h"
+#include "Protocol.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+CompileServer::CompileServer(std::string endpoint, size_t threads, Profiler* profiler)
+    : endpoint(std::move(endpoint)), threads(threads), profiler(profiler) {}
+
+CompileServer::~CompileServer() {
+    if (listener >= 0) {
+        close(listener);
+        struct stat info;
+        if (socketInode != 0 && lstat(endpoint.c_str(), &info) == 0 && S_ISSOCK(info.st_mode) &&
+            info.st_dev == socketDevice && info.st_ino == socketInode) {
+            unlink(endpoint.c_str());
+        }
+    }
+    if (wakeRead >= 0) close(wakeRead);
+    if (wakeWrite >= 0) close(wakeWrite);
+}
+
+void CompileServer::run() {
+    listener = listenOn(endpoint);
+    struct stat info;
+    if (isUnixEndpoint(endpoint) && lstat(endpoint.c_str(), &info) == 0) {
+        socketDevice = info.st_dev;
+        socketInode = info.st_ino;
+    }
+    // Non-blocking both ends: a wake never waits for run(), and run() drains
+    // what is there without blocking
+    int ends[2];
+    if (pipe2(ends, O_CLOEXEC | O_NONBLOCK) < 0) {
+        throw std::runtime_error(std::string("pipe failed: ") + std::strerror(errno));
+    }
+    wakeRead = ends[0];
+    wakeWrite = ends[1];
+
+    ThreadPool pool(threads);
+    // Connections waiting for their next request. One being served is on a
+    // worker instead, so its requests are still answered in order.
+    std::vector<int> idle;
+    std::vector<pollfd> polled;
+    while (!stopping) {
+        polled.clear();
+        polled.push_back({listener, POLLIN, 0});
+        polled.push_back({wakeRead, POLLIN, 0});
+        for (int client : idle) polled.push_back({client, POLLIN, 0});
+        if (poll(polled.data(), polled.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("poll failed: ") + std::strerror(errno));
+        }
+        if (stopping) break;
+
+        if (polled[1].revents != 0) {
+            char drained[64];
+            while (read(wakeRead, drained, sizeof(drained)) > 0) {}
+            std::lock_guard<std::mutex> lock(clientsMutex);
+            idle.insert(idle.end(), returned.begin(), returned.end());
+            returned.clear();
+        }
+        // A request or a hang up, either way a worker reads it
+        for (size_t k = 2; k < polled.size(); ++k) {
+            if (polled[k].revents == 0) continue;
+            int client = polled[k].fd;
+            idle.erase(std::find(idle.begin(), idle.end(), client));
+            pool.submit([this, client] { serve(client); });
+        }
+        if (polled[0].revents == 0) continue;
+
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (stopping) break;
+            throw std::runtime_error(std::string("accept failed: ") + std::strerror(errno));
+        }
+        noDelay(client);
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        if (stopping) {
+            close(client);
+            break;
+        }
+        clients.insert(client);
+        idle.push_back(client);
+    }
+    pool.wait();
+    // Every request has been answered, what is still open is idle
+    for (int client : clients) close(client);
+    clients.clear();
+    returned.clear();
+}
+
+void CompileServer::stop() {
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    stopping = true;
+    // Wakes run() and every connection a worker is reading a request from
+    shutdown(listener, SHUT_RDWR);
+    for (int client : clients) shutdown(client, SHUT_RD);
+    wake();
+}
+
+void CompileServer::wake() {
+    char byte = 0;
+    // A full pipe already has a wake waiting
+    if (write(wakeWrite, &byte, 1) < 0) return;
+}
+
+void CompileServer::serve(int client) {
+    Frame request;
+    if (!stopping && readFrame(client, request) && handle(client, request)) {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        returned.push_back(client);
+        wake();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        clients.erase(client);
+    }
+    close(client);
+}
+
+bool CompileServer::handle(int client, Frame& request) {
+    if (request.type == 'Q') {
+        stop();
+        return false;
+    }
+
+    std::string_view header = request.payload;
+    RequestOptions requestOptions;
+    if ((request.type != 'P' && request.type != 'S') || !decodeOptions(header, requestOptions)) {
+        writeFrame(client, 'R', std::string(1, '\1') + "Bad request");
+        return false;
+    }
+
+    // Kept per worker so their capacity carries over to the next request
+    thread_local std::string listing;
+    thread_local std::ostringstream trace;
+    thread_local std::ostringstream diagnostics;
+    listing.clear();
+    trace.str("");
+    diagnostics.str("");
+
+    CompileOptions options;
+    uint8_t flags = requestOptions.flags;
+    options.stream = flags & RequestOptions::streamFlag;
+    if (requestOptions.window > 0) options.window = requestOptions.window;
+    if (flags & RequestOptions::traceFlag) options.trace = &trace;
+    options.lazy = flags & RequestOptions::lazyFlag;
+    options.strict = flags & RequestOptions::strictFlag;
+    options.module = flags & RequestOptions::moduleFlag;
+    options.fuse = flags & RequestOptions::fuseFlag;
+    if (flags & RequestOptions::syntaxOnlyFlag) options.mode = CompileMode::SyntaxOnly;
+    if (flags & RequestOptions::symbolsOnlyFlag) options.mode = CompileMode::SymbolsOnly;
+    options.diagnostics = &diagnostics;
+    options.profiler = profiler;
+
+    CompileStats stats;
+    {
+        OutputWriter out(listing);
+        std::string body = std::move(request.payload);
+        body.erase(0, body.size() - header.size());
+        if (request.type == 'P') {
+            stats = compileFile(body, out, options);
+        } else {
+            stats = compileSource(std::move(body), out, options);
+        }
+    }
+    served++;
+
+    std::string traceText = trace.str();
+    std::string diagnosticText = diagnostics.str();
+    if (!traceText.empty() && !writeFrame(client, 'T', traceText)) return false;
+    if (!diagnosticText.empty() && !writeFrame(client, 'D', diagnosticText)) return false;
+    constexpr size_t chunk = 1 << 20;
+    for (size_t at = 0; at < listing.size(); at += chunk) {
+        if (!writeFrame(client, 'O', std::string_view(listing).substr(at, chunk))) return false;
+    }
+    if (!writeFrame(client, 'I', encodeCount(stats.instructions))) return false;
+    return writeFrame(client, 'R', (stats.ok ? std::string(1, '\0') : std::string(1, '\1')) + stats.error);
+}
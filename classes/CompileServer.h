@@ -0,0 +1,61 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+struct Frame;
+class Profiler;
+
+// Long-running compiler behind a Unix or TCP socket, so build tools don't pay
+// process startup for every small file. A connection can send any number of
+// requests (see Protocol.h). Between requests it waits in the accepting
+// thread's poll set, and each request that arrives is served on a ThreadPool
+// worker, so idle clients hold no worker and can't keep others, or a 'Q',
+// waiting. A worker reuses its listing and reply buffers from one request to
+// the next. Coordinator runs these as its worker processes.
+class CompileServer {
+public:
+    // Requests report into profiler when there is one
+    CompileServer(std::string endpoint, size_t threads, Profiler* profiler = nullptr);
+    ~CompileServer();
+
+    // Serves until a client sends 'Q'. Throws when the socket can't be set up.
+    // Only a socket file the server made itself is removed when it stops.
+    void run();
+    size_t requestsServed() const { return served; }
+
+private:
+    // Reads and answers one request, then hands the connection back to run()
+    // or closes it
+    void serve(int client);
+    // False when the client is gone or asked the server to stop
+    bool handle(int client, Frame& request);
+    void stop();
+    // Wakes run() out of poll
+    void wake();
+
+    std::string endpoint;
+    size_t threads;
+    Profiler* profiler;
+    int listener = -1;
+    // The socket file listener made, so the one removed on the way out is that
+    // file and not whatever has taken its place
+    dev_t socketDevice = 0;
+    ino_t socketInode = 0;
+    std::atomic<bool> stopping{false};
+    std::atomic<size_t> served{0};
+
+    // Self-pipe run() polls with the connections, written on stop and when a
+    // worker hands a connection back
+    int wakeRead = -1;
+    int wakeWrite = -1;
+
+    // Open connections, shut down on stop so a request being read ends, and
+    // the ones workers have handed back for run() to poll again
+    std::mutex clientsMutex;
+    std::set<int> clients;
+    std::vector<int> returned;
+};
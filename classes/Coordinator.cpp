@@ -0,0 +1,220 @@
+#include "Coordinator.h"
+#include "OutputWriter.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <filesystem>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+Coordinator::Coordinator(std::string program, size_t workers, Transport transport)
+    : program(std::move(program)), transport(transport), workers(std::max<size_t>(workers, 1)) {
+    for (size_t slot = 0; slot < this->workers.size(); ++slot) start(this->workers[slot], slot);
+}
+
+Coordinator::~Coordinator() {
+    for (auto& worker : workers) stop(worker, true);
+}
+
+void Coordinator::start(Worker& worker, size_t slot) {
+    std::string endpoint = "tcp:127.0.0.1:0";
+    if (transport == Transport::Unix) {
+        endpoint = (std::filesystem::temp_directory_path() /
+                    ("rat25s-worker-" + std::to_string(getpid()) + "-" + std::to_string(slot) + ".sock"))
+                       .string();
+    }
+    int listener = listenOn(endpoint);
+    // Connected before the worker even exists, the connection waits in the
+    // listen queue, so there is no polling for the worker to come up
+    int fd = connectTo(boundEndpoint(listener));
+    if (transport == Transport::Unix) unlink(endpoint.c_str());
+    if (fd < 0) {
+        close(listener);
+        throw std::runtime_error("Could not connect to a worker on " + endpoint);
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Dies with the coordinator instead of serving nobody
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        int quiet = open("/dev/null", O_WRONLY);
+        if (quiet >= 0) dup2(quiet, STDOUT_FILENO);
+        // The listener is the only socket that survives exec, see listenOn
+        if (listener == 3) {
+            fcntl(listener, F_SETFD, 0);
+        } else {
+            dup2(listener, 3);
+        }
+        execl(program.c_str(), program.c_str(), "--serve=fd:3", "--jobs=1", static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    close(listener);
+    if (pid < 0) {
+        close(fd);
+        throw std::runtime_error(std::string("Could not start a worker: ") + std::strerror(errno));
+    }
+    worker.pid = pid;
+    worker.fd = fd;
+    worker.job = -1;
+}
+
+void Coordinator::stop(Worker& worker, bool ask) {
+    if (worker.fd >= 0) {
+        if (ask) writeFrame(worker.fd, 'Q', "");
+        close(worker.fd);
+        worker.fd = -1;
+    }
+    if (worker.pid > 0) {
+        if (!ask) kill(worker.pid, SIGKILL);
+        while (waitpid(worker.pid, nullptr, 0) < 0 && errno == EINTR) {}
+        worker.pid = -1;
+    }
+}
+
+// Appends the file to text, false if it can't be read
+static bool appendFile(const std::string& path, std::string& text) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    char block[1 << 16];
+    ssize_t n;
+    while ((n = read(fd, block, sizeof(block))) > 0) text.append(block, n);
+    close(fd);
+    return n == 0;
+}
+
+static bool writeListing(const std::string& path, const std::string& listing) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok;
+    {
+        OutputWriter out(fd);
+        out << listing;
+        out.flush();
+        ok = out.good();
+    }
+    close(fd);
+    return ok;
+}
+
+bool Coordinator::receive(Worker& worker, const Job& job, CompileStats& stats) {
+    worker.listing.clear();
+    Frame reply;
+    while (readFrame(worker.fd, reply)) {
+        switch (reply.type) {
+            // A batch prints neither traces nor diagnostics
+            case 'O': worker.listing += reply.payload; break;
+            case 'I': stats.instructions = decodeCount(reply.payload); break;
+            case 'R':
+                stats.opened = true;
+                stats.ok = !reply.payload.empty() && reply.payload[0] == '\0';
+                stats.error = reply.payload.empty() ? "" : reply.payload.substr(1);
+                stats.outputBytes = worker.listing.size();
+                if (!writeListing(job.output, worker.listing)) {
+                    stats.ok = false;
+                    stats.error = "Could not open output file.";
+                }
+                return true;
+            default: break;
+        }
+    }
+    return false;
+}
+
+std::vector<CompileStats> Coordinator::run(const std::vector<Job>& jobs, const CompileOptions& options) {
+    RequestOptions request;
+    if (options.stream) request.flags |= RequestOptions::streamFlag;
+    if (options.lazy) request.flags |= RequestOptions::lazyFlag;
+    if (options.strict) request.flags |= RequestOptions::strictFlag;
+    if (options.module) request.flags |= RequestOptions::moduleFlag;
+    if (options.fuse) request.flags |= RequestOptions::fuseFlag;
+    if (options.mode == CompileMode::SyntaxOnly) request.flags |= RequestOptions::syntaxOnlyFlag;
+    if (options.mode == CompileMode::SymbolsOnly) request.flags |= RequestOptions::symbolsOnlyFlag;
+    request.window = options.window;
+    const std::string header = encodeOptions(request);
+
+    std::vector<uintmax_t> sizes(jobs.size());
+    std::deque<size_t> pending;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        std::error_code ec;
+        sizes[i] = std::filesystem::file_size(jobs[i].source, ec);
+        pending.push_back(i);
+    }
+    std::stable_sort(pending.begin(), pending.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+    std::vector<CompileStats> results(jobs.size());
+    std::vector<int> attempts(jobs.size());
+    size_t done = 0;
+
+    // The worker in slot died, it is started again and its job goes back on
+    // the front of the queue unless that was its last attempt
+    auto lost = [&](size_t slot) {
+        Worker& worker = workers[slot];
+        size_t i = worker.job;
+        stop(worker, false);
+        restarted++;
+        start(worker, slot);
+        if (attempts[i] < maxAttempts) {
+            pending.push_front(i);
+            return;
+        }
+        CompileStats& stats = results[i];
+        stats.error = "A worker died compiling this file " + std::to_string(attempts[i]) + " times";
+        stats.opened = writeListing(jobs[i].output, "Exception: " + stats.error + "\n");
+        done++;
+    };
+
+    std::string payload;
+    std::vector<pollfd> polled;
+    std::vector<size_t> slots;
+    while (done < jobs.size()) {
+        for (size_t slot = 0; slot < workers.size(); ++slot) {
+            Worker& worker = workers[slot];
+            while (worker.job < 0 && !pending.empty()) {
+                size_t i = pending.front();
+                pending.pop_front();
+                payload = header;
+                if (!appendFile(jobs[i].source, payload)) {
+                    // Nothing to send, compiling it here reports the error as usual
+                    results[i] = compileFile(jobs[i].source, jobs[i].output, options);
+                    done++;
+                    continue;
+                }
+                results[i].sourceBytes = payload.size() - header.size();
+                attempts[i]++;
+                worker.job = i;
+                if (!writeFrame(worker.fd, 'S', payload)) lost(slot);
+            }
+        }
+
+        polled.clear();
+        slots.clear();
+        for (size_t slot = 0; slot < workers.size(); ++slot) {
+            if (workers[slot].job < 0) continue;
+            polled.push_back({workers[slot].fd, POLLIN, 0});
+            slots.push_back(slot);
+        }
+        if (polled.empty()) continue;
+        if (poll(polled.data(), polled.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("poll failed: ") + std::strerror(errno));
+        }
+        for (size_t k = 0; k < polled.size(); ++k) {
+            if (polled[k].revents == 0) continue;
+            Worker& worker = workers[slots[k]];
+            if (receive(worker, jobs[worker.job], results[worker.job])) {
+                worker.job = -1;
+                done++;
+            } else {
+                lost(slots[k]);
+            }
+        }
+    }
+    return results;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include "Driver.h"
+#include "Protocol.h"
+
+// Spreads a batch over worker processes. Every worker is the compiler itself
+// started as a one-thread CompileServer, and gets each source as an 'S' request
+// over its own connection (see Protocol.h), so a worker could as well be on
+// another host. The coordinator never compiles anything.
+//
+// Sources go out biggest first, each to the next worker that is free, which
+// keeps the workers evenly loaded by bytes. A worker that dies is started
+// again and its source sent to a worker once more, up to maxAttempts times.
+// Listings are written to their own files and the results come back in input
+// order, whichever worker finished first.
+class Coordinator {
+public:
+    enum class Transport { Unix, Tcp };
+
+    struct Job {
+        std::string source;
+        std::string output;
+    };
+
+    static constexpr int maxAttempts = 3;
+
+    // Workers run program (the compiler) and are started here
+    Coordinator(std::string program, size_t workers, Transport transport);
+    // Stops the workers and waits for them
+    ~Coordinator();
+    Coordinator(const Coordinator&) = delete;
+    Coordinator& operator=(const Coordinator&) = delete;
+
+    // Compiles every job with the options a --batch run would use. Only the
+    // mode, stream, lazy, fuse and module options reach the workers.
+    std::vector<CompileStats> run(const std::vector<Job>& jobs, const CompileOptions& options);
+
+    size_t size() const { return workers.size(); }
+    // Workers started again after one died
+    size_t restarts() const { return restarted; }
+
+private:
+    struct Worker {
+        pid_t pid = -1;
+        int fd = -1;
+        // The job it is compiling, -1 when it is free
+        long job = -1;
+        std::string listing;
+    };
+
+    void start(Worker& worker, size_t slot);
+    void stop(Worker& worker, bool ask);
+    // Reads the reply to the worker's job, false if the worker died first
+    bool receive(Worker& worker, const Job& job, CompileStats& stats);
+
+    std::string program;
+    Transport transport;
+    std::vector<Worker> workers;
+    size_t restarted = 0;
+};
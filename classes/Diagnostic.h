@@ -0,0 +1,17 @@
+#pragma once
+#include <string>
+
+// A syntax or type error as data, for callers that want more than the text
+struct Diagnostic {
+    // Syntax for the grammar, Type for names and types. The text says which
+    // too, "Syntax error: " or "Type error: ".
+    enum class Kind { Syntax, Type };
+    Kind kind = Kind::Syntax;
+    std::string message;
+    // The token it was found at and where that starts in the source
+    std::string lexeme;
+    size_t offset = 0;
+    // 1-based, worked out from offset
+    int line = 1;
+    int column = 1;
+};
@@ -0,0 +1,366 @@
+#include "Driver.h"
+#include "Lexer.h"
+#include "parser.h"
+#include "SymbolTable.h"
+#include "CallGraph.h"
+#include "LoopOptimizer.h"
+#include "Superinstructions.h"
+#include "Vectorizer.h"
+#include "Verifier.h"
+#include "ObjectModule.h"
+#include "FunctionIndex.h"
+#include "OutputWriter.h"
+#include "CompileCache.h"
+#include "Profiler.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <filesystem>
+#include <memory_resource>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <type_traits>
+
+// First block of a compilation's arena, later ones grow geometrically
+static constexpr size_t arenaBlock = 64 << 10;
+
+// Flushes the output and reports the compilation to the profiler, whether it
+// worked or not
+static void finish(OutputWriter& outFile, const CompileOptions& options, CompileStats& stats, const Lexer* lexer,
+                   size_t productions, const SymbolTable& symbolTable, size_t instructions) {
+    outFile.flush();
+    stats.outputBytes = outFile.bytesWritten();
+    if (!outFile.good() && stats.ok) {
+        stats.ok = false;
+        stats.error = "Could not write output file.";
+    }
+
+    if (options.profiler != nullptr) {
+        Profiler::Counters counters;
+        counters.files = 1;
+        counters.sourceBytes = stats.sourceBytes;
+        counters.tokens = lexer ? lexer->tokenCount() : 0;
+        counters.lexSeconds = lexer ? lexer->secondsLexing() : 0;
+        counters.productions = productions;
+        counters.symbolLookups = symbolTable.lookupCount();
+        counters.instructions = instructions;
+        counters.bytesWritten = stats.outputBytes;
+        options.profiler->add(counters);
+    }
+}
+
+// --syntax-only and --symbols-only: the source is parsed with a sink that makes
+// no code, and the output only says whether it is valid, with the globals when
+// they were collected
+template <typename Sink, typename MakeLexer>
+static void checkTo(OutputWriter& outFile, const std::string& name, MakeLexer makeLexer,
+                    const CompileOptions& options, CompileStats& stats, CompileResult* result) {
+    bool listing = result == nullptr || options.listing;
+    std::pmr::monotonic_buffer_resource arena(arenaBlock);
+    std::pmr::unsynchronized_pool_resource scratch;
+    std::optional<Lexer> lexer;
+    SymbolTable symbolTable(&arena, &scratch);
+    std::optional<BasicParser<Sink>> parser;
+    try {
+        {
+            Profiler::Scope scope(options.profiler, Profiler::Parse, name);
+            lexer.emplace(makeLexer());
+            lexer->setTiming(options.profiler != nullptr);
+            if constexpr (std::is_same_v<Sink, SyntaxSink>) {
+                parser.emplace(*lexer, Sink(), &arena, &scratch);
+            } else {
+                parser.emplace(*lexer, Sink(symbolTable), &arena, &scratch);
+            }
+            parser->setTrace(options.trace);
+            parser->setDiagnostics(options.diagnostics);
+            if (result != nullptr) parser->setDiagnosticList(&result->diagnostics);
+            if (listing) parser->setOutputFile(outFile);
+            parser->parse();
+        }
+        if (listing && Sink::checksTypes) {
+            Profiler::Scope scope(options.profiler, Profiler::Print, name);
+            symbolTable.print(outFile);
+        }
+        if (result != nullptr) result->symbols = symbolTable.entries();
+        stats.ok = true;
+    } catch (const std::exception& e) {
+        outFile << "Exception: " << e.what() << "\n";
+        stats.error = e.what();
+    }
+    finish(outFile, options, stats, lexer ? &*lexer : nullptr, parser ? parser->productionCount() : 0, symbolTable, 0);
+}
+
+// The Lexer is made inside the try so an unreadable input is reported like any
+// other error, in the output. With a result the program is also handed back as
+// data, and the listing is only written when options.listing asks for it.
+template <typename MakeLexer>
+static void compileTo(OutputWriter& outFile, const std::string& name, MakeLexer makeLexer,
+                      const CompileOptions& options, CompileStats& stats, CompileResult* result = nullptr) {
+    if (options.mode == CompileMode::SyntaxOnly) {
+        return checkTo<SyntaxSink>(outFile, name, makeLexer, options, stats, result);
+    }
+    if (options.mode == CompileMode::SymbolsOnly) {
+        return checkTo<SymbolSink>(outFile, name, makeLexer, options, stats, result);
+    }
+
+    bool listing = (result == nullptr || options.listing) && !options.module;
+    bool stream = options.stream && !options.module;
+    Profiler* profiler = options.profiler;
+    // What the parser and symbol table keep for the whole compilation, names and
+    // signatures, comes from the arena and is given back in one go when it goes
+    // out of scope. What only lives for a statement or a function, backpatch
+    // lists, captured code and scopes, comes from scratch, which reuses it: in
+    // the arena a streamed compile would grow with the program.
+    std::pmr::monotonic_buffer_resource arena(arenaBlock);
+    std::pmr::unsynchronized_pool_resource scratch;
+    // Outside the try so failed compilations are counted too
+    std::optional<Lexer> lexer;
+    SymbolTable symbolTable(&arena, &scratch);
+    CodeGen codeGen(&scratch);
+    std::optional<Parser> parser;
+    std::optional<FunctionIndex> functionIndex;
+    try {
+        codeGen.setTrace(options.trace);
+        if (stream) codeGen.streamTo(outFile, options.window);
+        {
+            Profiler::Scope scope(profiler, Profiler::Parse, name);
+            lexer.emplace(makeLexer());
+            lexer->setTiming(profiler != nullptr);
+            if (options.lazy && !options.module) {
+                functionIndex.emplace(FunctionIndex::scan(*lexer));
+                lexer->seek(0);
+            }
+            parser.emplace(*lexer, CodeSink(symbolTable, codeGen), &arena, &scratch);
+            parser->setFunctionIndex(functionIndex ? &*functionIndex : nullptr, options.strict);
+            parser->setTrace(options.trace);
+            parser->setDiagnostics(options.diagnostics);
+            if (result != nullptr) parser->setDiagnosticList(&result->diagnostics);
+            parser->setModuleMode(options.module);
+            if (!options.module) parser->setOutputFile(outFile);
+            parser->parse();
+        }
+        if (functionIndex && options.trace != nullptr) {
+            *options.trace << "[LAZY] " << functionIndex->reachableCount() << " of " << functionIndex->functions().size()
+                           << " functions reachable, " << parser->skippedFunctions() << " skipped"
+                           << (options.strict ? " after a syntax check" : "") << "\n";
+        }
+        if (listing) {
+            Profiler::Scope scope(profiler, Profiler::Print, name);
+            parser->outputParseTree(outFile);
+        }
+
+        // The passes need the whole program, a streamed one is already written
+        if (stream) {
+            if (options.trace != nullptr) codeGen.printStreamStats(*options.trace);
+        } else {
+            // Inlining and dead function removal wait for the linked program,
+            // another module may call any function
+            if (!options.module) {
+                Profiler::Scope scope(profiler, Profiler::CallGraph, name);
+                CallGraph callGraph(codeGen);
+                callGraph.run();
+                if (options.trace != nullptr) callGraph.print(*options.trace);
+            }
+            {
+                Profiler::Scope scope(profiler, Profiler::LoopOpt, name);
+                LoopOptimizer loopOptimizer(codeGen, symbolTable);
+                loopOptimizer.run();
+                if (options.trace != nullptr) loopOptimizer.print(*options.trace);
+            }
+            {
+                Profiler::Scope scope(profiler, Profiler::Vectorize, name);
+                Vectorizer vectorizer(codeGen);
+                vectorizer.run();
+                if (options.trace != nullptr) vectorizer.print(*options.trace);
+            }
+            if (options.fuse && !options.module) {
+                Profiler::Scope scope(profiler, Profiler::Fuse, name);
+                Superinstructions superinstructions(codeGen);
+                superinstructions.run();
+                if (options.trace != nullptr) superinstructions.print(*options.trace);
+            }
+            {
+                Profiler::Scope scope(profiler, Profiler::Verify, name);
+                Verifier verifier(codeGen, symbolTable);
+                verifier.run();
+                if (options.trace != nullptr) verifier.print(*options.trace);
+            }
+        }
+
+        if (listing) {
+            Profiler::Scope scope(profiler, Profiler::Print, name);
+            symbolTable.print(outFile);
+            codeGen.print(outFile);
+        }
+        if (options.module) {
+            Profiler::Scope scope(profiler, Profiler::Print, name);
+            ObjectModule::build(codeGen, symbolTable, parser->definedFunctions(), parser->importedFunctions())
+                .write(outFile);
+        }
+        if (result != nullptr) {
+            const auto& code = codeGen.getInstructions();
+            result->instructions.assign(code.begin(), code.end());
+            result->functions = codeGen.getFunctions();
+            result->constants = codeGen.getConstants();
+            result->symbols = symbolTable.entries();
+        }
+        stats.instructions = codeGen.getNextAddress() - 1;
+        stats.ok = true;
+    } catch (const std::exception& e) {
+        outFile << "Exception: " << e.what() << "\n";
+        stats.error = e.what();
+    }
+
+    finish(outFile, options, stats, lexer ? &*lexer : nullptr, parser ? parser->productionCount() : 0, symbolTable,
+           codeGen.emittedCount());
+}
+
+// The options that change what compileFile writes, part of the cache key
+static std::string cacheOptions(const CompileOptions& options) {
+    switch (options.mode) {
+        case CompileMode::SyntaxOnly: return "syntax ";
+        case CompileMode::SymbolsOnly: return "symbols ";
+        case CompileMode::Full: break;
+    }
+    // An object module is never streamed, or lazy
+    if (options.module) return "module ";
+    std::string text = options.stream ? "stream " + std::to_string(options.window) : "whole ";
+    if (options.lazy) text += options.strict ? " lazy strict" : " lazy";
+    if (options.fuse && !options.stream) text += " fuse";
+    return text;
+}
+
+static bool readSource(const std::string& inputFile, std::string& source) {
+    int fd = open(inputFile.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    bool ok = fstat(fd, &info) == 0;
+    if (ok) {
+        source.resize(info.st_size);
+        size_t done = 0;
+        while (done < source.size()) {
+            ssize_t n = read(fd, source.data() + done, source.size() - done);
+            if (n <= 0) break;
+            done += n;
+        }
+        ok = done == source.size();
+    }
+    close(fd);
+    return ok;
+}
+
+CompileStats compileFile(const std::string& inputFile, const std::string& outputFile,
+                         const CompileOptions& options) {
+    int fd = open(outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        CompileStats stats;
+        stats.error = "Could not open output file.";
+        return stats;
+    }
+    // Closed on every return, after outFile has flushed
+    struct FdCloser { int fd; ~FdCloser() { close(fd); } } closer{fd};
+    OutputWriter outFile(fd);
+
+    // An unreadable input goes the normal way, the Lexer reports it
+    std::string source;
+    if (options.cache == nullptr || !readSource(inputFile, source)) {
+        return compileFile(inputFile, outFile, options);
+    }
+
+    CompileCache& cache = *options.cache;
+    uint64_t key = CompileCache::key(source, cacheOptions(options));
+    size_t sourceBytes = source.size();
+    CompileCache::Entry entry;
+    CompileStats stats;
+    std::optional<Profiler::Scope> lookup(std::in_place, options.profiler, Profiler::Cache, inputFile);
+    if (cache.lookup(key, sourceBytes, entry)) {
+        if (options.diagnostics != nullptr) *options.diagnostics << entry.diagnostics;
+        outFile << entry.output;
+        outFile.flush();
+        lookup.reset();
+        if (options.profiler != nullptr) {
+            Profiler::Counters counters;
+            counters.files = 1;
+            counters.sourceBytes = sourceBytes;
+            counters.bytesWritten = entry.output.size();
+            options.profiler->add(counters);
+        }
+        stats.ok = entry.ok && outFile.good();
+        stats.opened = true;
+        stats.sourceBytes = sourceBytes;
+        stats.outputBytes = entry.output.size();
+        stats.instructions = entry.instructions;
+        stats.error = outFile.good() ? entry.error : "Could not write output file.";
+        return stats;
+    }
+
+    lookup.reset();
+
+    // The listing and diagnostics are kept to store them, then passed on
+    std::ostringstream diagnostics;
+    CompileOptions capture = options;
+    capture.diagnostics = &diagnostics;
+    {
+        OutputWriter listing(entry.output);
+        stats = compileSource(std::move(source), listing, capture, inputFile);
+    }
+    entry.diagnostics = diagnostics.str();
+    if (options.diagnostics != nullptr) *options.diagnostics << entry.diagnostics;
+    entry.ok = stats.ok;
+    entry.instructions = stats.instructions;
+    entry.error = stats.error;
+    {
+        Profiler::Scope scope(options.profiler, Profiler::Cache, inputFile);
+        cache.store(key, sourceBytes, entry);
+    }
+
+    outFile << entry.output;
+    outFile.flush();
+    if (!outFile.good() && stats.ok) {
+        stats.ok = false;
+        stats.error = "Could not write output file.";
+    }
+    return stats;
+}
+
+CompileStats compileFile(const std::string& inputFile, OutputWriter& out, const CompileOptions& options) {
+    CompileStats stats;
+    std::error_code ec;
+    stats.sourceBytes = std::filesystem::file_size(inputFile, ec);
+    if (ec) stats.sourceBytes = 0;
+    stats.opened = true;
+    compileTo(out, inputFile, [&] { return Lexer(inputFile); }, options, stats);
+    return stats;
+}
+
+CompileStats compileSource(std::string source, OutputWriter& out, const CompileOptions& options,
+                           const std::string& name) {
+    CompileStats stats;
+    stats.sourceBytes = source.size();
+    stats.opened = true;
+    compileTo(out, name, [&] { return Lexer::fromSource(std::move(source)); }, options, stats);
+    return stats;
+}
+
+CompileResult compile(std::string_view source, const CompileOptions& options) {
+    CompileOptions whole = options;
+    whole.stream = false;
+    whole.cache = nullptr;
+    whole.module = false;
+
+    CompileResult result;
+    CompileStats stats;
+    stats.sourceBytes = source.size();
+    stats.opened = true;
+    // Without a listing the writer only ever sees the error line, if that
+    std::string scratch;
+    {
+        OutputWriter out(options.listing ? result.listing : scratch);
+        compileTo(out, "<source>", [&] { return Lexer::fromView(source); }, whole, stats, &result);
+    }
+    result.ok = stats.ok;
+    result.error = stats.error;
+    return result;
+}
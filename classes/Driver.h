@@ -0,0 +1,102 @@
+#pragma once
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "CodeGen.h"
+#include "Diagnostic.h"
+#include "SymbolTable.h"
+
+class OutputWriter;
+class CompileCache;
+class Profiler;
+
+// How much of the compiler runs. The checks parse with a cheaper sink (see
+// ParseSink.h) and make no code, their output only says if the source is valid.
+enum class CompileMode {
+    Full,
+    // Declarations, name lookups and type checks
+    SymbolsOnly,
+    // The grammar alone
+    SyntaxOnly,
+};
+
+struct CompileOptions {
+    CompileMode mode = CompileMode::Full;
+    bool stream = false;
+    size_t window = CodeGen::defaultWindow;
+    // Parser and CodeGen trace plus the pass reports, nullptr for none
+    std::ostream* trace = nullptr;
+    // Syntax errors as they are found, nullptr for none
+    std::ostream* diagnostics = nullptr;
+    // compileFile serves unchanged sources from here without lexing them, and
+    // stores what it compiles. A hit writes no trace, the diagnostics are replayed.
+    CompileCache* cache = nullptr;
+    // Phase times and counters are added here, nullptr for none
+    Profiler* profiler = nullptr;
+    // compile() only: also return the listing a file compile writes
+    bool listing = false;
+    // Write an object module for the Linker instead of a listing. Calls to
+    // functions the source doesn't define become imports, and the call graph
+    // pass, which needs the whole program, is left for after linking. Never
+    // streamed.
+    bool module = false;
+    // Only compile the functions the top-level statements can reach, found by a
+    // pre-scan that matches braces (FunctionIndex). The rest are skipped without
+    // even being parsed unless strict is set, then they are syntax checked.
+    // Ignored for modules, where every function can be called.
+    bool lazy = false;
+    bool strict = false;
+    // Fuse the commonest sequences into superinstructions (Superinstructions.h)
+    // once the other passes are done. Ignored for streamed compiles, which
+    // don't run the passes, and for modules, which the Linker takes in the
+    // base set.
+    bool fuse = false;
+};
+
+struct CompileStats {
+    bool ok = false;
+    bool opened = false;
+    size_t sourceBytes = 0;
+    size_t outputBytes = 0;
+    int instructions = 0;
+    // Why the compilation failed, also written to the output when it was opened
+    std::string error;
+};
+
+// What compile() hands back, the compiled program as data
+struct CompileResult {
+    bool ok = false;
+    std::string error;
+    // Empty when the compilation failed
+    std::vector<Instruction> instructions;
+    std::vector<FunctionInfo> functions;
+    std::vector<std::string> constants;
+    std::vector<SymbolEntry> symbols;
+    // The error that stopped the parse, if it was a syntax or type error
+    std::vector<Diagnostic> diagnostics;
+    // With CompileOptions::listing, the text compileFile would write
+    std::string listing;
+};
+
+// Compiles one source file into its listing. All state lives in the call, so
+// compilations can run side by side on different threads.
+CompileStats compileFile(const std::string& inputFile, const std::string& outputFile,
+                         const CompileOptions& options);
+
+// The same with the listing going to out
+CompileStats compileFile(const std::string& inputFile, OutputWriter& out, const CompileOptions& options);
+// Source that is already in memory, the listing goes to out. name stands in for
+// the file name in profiles.
+CompileStats compileSource(std::string source, OutputWriter& out, const CompileOptions& options,
+                           const std::string& name = "<source>");
+
+// The library entry point: compiles source straight from the caller's memory,
+// without copying it or touching any file, and returns the result as data.
+// source only has to stay valid during the call. The trace, diagnostics and
+// profiler in options are used as usual, and a checking mode only fills in ok,
+// the diagnostics and the symbols. stream, cache and module are ignored, the
+// passes need the whole program. Like the rest of the Driver it keeps no state
+// between calls, so any number of threads can compile at once.
+CompileResult compile(std::string_view source, const CompileOptions& options = {});
@@ -0,0 +1,81 @@
+#include "FunctionIndex.h"
+
+FunctionIndex FunctionIndex::scan(Lexer& lexer) {
+    FunctionIndex index;
+    Span span{};
+    bool inFunction = false;
+    bool named = false;
+    bool inBody = false;
+    bool closed = false;
+    int depth = 0;
+    // Last token that wasn't a comment, a call is an identifier then '('
+    Token previous{{}, TokenType::END};
+
+    for (Token token = lexer.getNextToken();; token = lexer.getNextToken()) {
+        if (closed) {
+            // The span ends where the next token starts, comment or not
+            span.end = lexer.offsetOf(token);
+            index.byOffset[span.begin] = index.spans.size();
+            index.spans.push_back(std::move(span));
+            span = Span{};
+            inFunction = closed = false;
+        }
+        if (token.type == TokenType::END) break;
+        if (token.type == TokenType::COMM) continue;
+
+        if (!inFunction && token.type == TokenType::KEYW && token.lexeme == "function") {
+            span.begin = lexer.offsetOf(token);
+            inFunction = true;
+            named = inBody = false;
+            depth = 0;
+        } else if (inFunction && !named && token.type == TokenType::IDENT) {
+            // The name and its parameter list aren't a call
+            span.name = token.lexeme;
+            named = true;
+            previous = Token{{}, TokenType::END};
+            continue;
+        } else if (token.type == TokenType::SEPA && token.lexeme == "(" && previous.type == TokenType::IDENT) {
+            (inFunction ? span.calls : index.roots).push_back(previous.lexeme);
+        } else if (inFunction && token.type == TokenType::SEPA && token.lexeme == "{") {
+            depth++;
+            inBody = true;
+        } else if (inFunction && token.type == TokenType::SEPA && token.lexeme == "}") {
+            closed = inBody && --depth == 0;
+        }
+        previous = token;
+    }
+
+    index.markReachable();
+    return index;
+}
+
+void FunctionIndex::markReachable() {
+    std::unordered_map<std::string_view, std::vector<size_t>> byName;
+    for (size_t i = 0; i < spans.size(); ++i) {
+        byName[spans[i].name].push_back(i);
+    }
+    std::vector<std::string_view> work = roots;
+    while (!work.empty()) {
+        std::string_view name = work.back();
+        work.pop_back();
+        auto found = byName.find(name);
+        if (found == byName.end()) continue;
+        for (size_t i : found->second) {
+            if (spans[i].reachable) continue;
+            spans[i].reachable = true;
+            work.insert(work.end(), spans[i].calls.begin(), spans[i].calls.end());
+        }
+    }
+}
+
+const FunctionIndex::Span* FunctionIndex::skippable(size_t offset) const {
+    auto found = byOffset.find(offset);
+    if (found == byOffset.end() || spans[found->second].reachable) return nullptr;
+    return &spans[found->second];
+}
+
+size_t FunctionIndex::reachableCount() const {
+    size_t count = 0;
+    for (const auto& span : spans) count += span.reachable;
+    return count;
+}
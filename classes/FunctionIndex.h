@@ -0,0 +1,40 @@
+#pragma once
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Lexer.h"
+
+// Where each function is in the source and what it may call, found in one pass
+// over the tokens that only matches braces and never runs the grammar. An
+// identifier followed by '(' is a call, wherever it is. Functions no call from
+// the top-level statements can reach are dead, and the Parser can skip their
+// tokens instead of compiling code that CallGraph would throw away.
+class FunctionIndex {
+public:
+    struct Span {
+        std::string_view name;
+        // The 'function' keyword, and the token after the closing brace
+        size_t begin;
+        size_t end;
+        std::vector<std::string_view> calls;
+        bool reachable = false;
+    };
+
+    // Reads the lexer to the end. A function with unbalanced braces is left
+    // out, the Parser compiles it and reports the error.
+    static FunctionIndex scan(Lexer& lexer);
+
+    const std::vector<Span>& functions() const { return spans; }
+    // The dead function starting at offset, nullptr when there is none to skip
+    const Span* skippable(size_t offset) const;
+    size_t reachableCount() const;
+
+private:
+    void markReachable();
+
+    std::vector<Span> spans;
+    std::unordered_map<size_t, size_t> byOffset;
+    // Calls made by the top-level statements
+    std::vector<std::string_view> roots;
+};
@@ -9,6 +9,15 @@
 
 
 Token Lexer::getNextToken() {
+    tokens++;
+    if (!timing) return scanToken();
+    auto start = std::chrono::steady_clock::now();
+    Token token = scanToken();
+    lexSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return token;
+}
+
+Token Lexer::scanToken() {
     currentState = State::START;
 
     while (currentState != State::END && currentState != State::ERROR) {
@@ -11,6 +11,8 @@
 #include <functional>
 #include <stdexcept>
 #include <fstream>
+#include <chrono>
+#include <memory>
 
 //usiong string_view for faster string operations :b
 using sv = std::string_view;
@@ -48,7 +50,11 @@ struct Token {
 class Lexer {
 private:
     //Buffer the entire file for faster access
-    std::string buffer;
+    //The source is scanned through buffer, which views either the lexer's own
+    //copy or memory the caller owns. The copy sits behind a pointer so the view
+    //survives the Lexer being moved.
+    std::unique_ptr<std::string> owned;
+    sv buffer;
     size_t start = 0;
     size_t pos = 0;
     State currentState = State::START;
@@ -96,6 +102,14 @@ private:
 
     Token lastToken;
 
+    // Counted always, timed only when asked since a clock read per token isn't free
+    size_t tokens = 0;
+    bool timing = false;
+    double lexSeconds = 0;
+    Token scanToken();
+
+    Lexer() = default;
+
 public:
     explicit Lexer(const std::string& filename) {
         std::ifstream file(filename, std::ios::binary | std::ios::ate);
@@ -106,15 +120,57 @@ public:
         auto size = file.tellg();
         file.seekg(0);
 
-        buffer.resize(size);
-        file.read(buffer.data(), size);
+        owned = std::make_unique<std::string>(static_cast<size_t>(size), '\0');
+        file.read(owned->data(), size);
+        buffer = *owned;
+    }
+    // Lexes source already in memory, e.g. sent by a client, instead of a file
+    static Lexer fromSource(std::string source) {
+        Lexer lexer;
+        lexer.owned = std::make_unique<std::string>(std::move(source));
+        lexer.buffer = *lexer.owned;
+        return lexer;
+    }
+    // Lexes the caller's memory in place, without a copy. source has to stay
+    // alive and unchanged for as long as the Lexer and its tokens are used.
+    static Lexer fromView(sv source) {
+        Lexer lexer;
+        lexer.buffer = source;
+        return lexer;
+    }
+
+    // Byte offset of a token's lexeme in the source
+    size_t offsetOf(const Token& token) const {
+        return token.lexeme.empty() ? pos : token.lexeme.data() - buffer.data();
+    }
+    // Carry on lexing from a byte offset, which must be where a token starts
+    void seek(size_t offset) {
+        start = pos = offset;
+        currentState = State::START;
     }
+    // 1-based line and column of a byte offset, only worked out for errors
+    void position(size_t offset, int& line, int& column) const {
+        line = 1;
+        size_t lineStart = 0;
+        for (size_t i = 0; i < offset && i < buffer.size(); ++i) {
+            if (buffer[i] == '\n') {
+                line++;
+                lineStart = i + 1;
+            }
+        }
+        column = static_cast<int>(offset - lineStart) + 1;
+    }
+
     Token getNextToken();
+    void setTiming(bool enabled) { timing = enabled; }
+    size_t tokenCount() const { return tokens; }
+    double secondsLexing() const { return lexSeconds; }
     Token peekToken() {
         size_t savedStart = start;
         size_t savedPos = pos;
         State savedState = currentState;
         Token savedLastToken = lastToken;
+        size_t savedTokens = tokens;
     
         Token peeked = getNextToken();
     
@@ -122,6 +178,7 @@ public:
         pos = savedPos;
         currentState = savedState;
         lastToken = savedLastToken;
+        tokens = savedTokens;
     
         return peeked;
     }    
@@ -0,0 +1,196 @@
+#include "Linker.h"
+#include "OutputWriter.h"
+
+#include <stdexcept>
+#include <unordered_map>
+
+// "(integer, real)"
+static std::string describe(const std::vector<ValueType>& params) {
+    std::string text = "(";
+    for (size_t i = 0; i < params.size(); ++i) {
+        if (i) text += ", ";
+        text += typeName(params[i]);
+    }
+    return text + ")";
+}
+
+void Linker::add(const std::string& name, ObjectModule module) {
+    inputs.push_back({name, std::move(module)});
+}
+
+size_t Linker::functionCount() const {
+    size_t count = 0;
+    for (const auto& input : inputs) count += input.module.exports.size();
+    return count;
+}
+
+void Linker::resolve() const {
+    std::string errors;
+    auto problem = [&](const std::string& message) { errors += (errors.empty() ? "" : "\n") + message; };
+
+    struct Definition {
+        const Input* input;
+        const FunctionType* type;
+    };
+    std::unordered_map<std::string, Definition> defined;
+    for (const auto& input : inputs) {
+        for (const auto& fn : input.module.exports) {
+            auto [it, added] = defined.try_emplace(fn.type.name, Definition{&input, &fn.type});
+            if (!added) {
+                problem("function '" + fn.type.name + "' is defined in both " + it->second.input->name + " and " +
+                        input.name);
+            }
+        }
+    }
+
+    for (const auto& input : inputs) {
+        for (const auto& call : input.module.imports) {
+            auto it = defined.find(call.name);
+            if (it == defined.end()) {
+                problem(input.name + " calls '" + call.name + "', which no module defines");
+                continue;
+            }
+            const FunctionType& callee = *it->second.type;
+            const std::string& where = it->second.input->name;
+            if (call.params != callee.params) {
+                problem(input.name + " calls '" + call.name + "' with " + describe(call.params) + ", " + where +
+                        " defines it with " + describe(callee.params));
+            }
+            if (call.resultUsed && callee.returnType != call.returnType) {
+                problem(input.name + " uses the result of '" + call.name + "' as " + typeName(call.returnType) +
+                        ", " + where + " returns " + typeName(callee.returnType));
+            }
+        }
+    }
+    if (!errors.empty()) throw std::runtime_error(errors);
+}
+
+void Linker::link() {
+    resolve();
+    program.clear();
+    constants.clear();
+
+    // Memory and constants, module by module
+    std::vector<std::vector<int>> constantIndex(inputs.size());
+    std::unordered_map<std::string, int> pooled;
+    dataEnd = SymbolTable::firstAddress;
+    for (size_t m = 0; m < inputs.size(); ++m) {
+        Input& input = inputs[m];
+        input.dataBase = dataEnd;
+        dataEnd += input.module.dataSize;
+        for (const auto& literal : input.module.constants) {
+            auto [it, added] = pooled.try_emplace(literal, static_cast<int>(constants.size()));
+            if (added) constants.push_back(literal);
+            constantIndex[m].push_back(it->second);
+        }
+    }
+
+    // New address of every instruction, the functions take the first ones
+    std::vector<std::vector<int>> place(inputs.size());
+    std::vector<std::vector<bool>> inFunction(inputs.size());
+    int next = 1;
+    for (size_t m = 0; m < inputs.size(); ++m) {
+        const ObjectModule& module = inputs[m].module;
+        place[m].assign(module.code.size() + 2, 0);
+        inFunction[m].assign(module.code.size() + 2, false);
+        for (const auto& fn : module.exports) {
+            for (int addr = fn.entry; addr < fn.end; ++addr) {
+                place[m][addr] = next++;
+                inFunction[m][addr] = true;
+            }
+        }
+    }
+    // Top-level code only jumps within top-level code, so a target that is a
+    // function or the end of the module goes on to the next top-level
+    // instruction, or just past the module's top-level code
+    std::vector<std::vector<int>> topTarget(inputs.size());
+    for (size_t m = 0; m < inputs.size(); ++m) {
+        int size = static_cast<int>(inputs[m].module.code.size());
+        for (int addr = 1; addr <= size; ++addr) {
+            if (!inFunction[m][addr]) place[m][addr] = next++;
+        }
+        topTarget[m].assign(size + 2, next);
+        for (int addr = size; addr >= 1; --addr) {
+            topTarget[m][addr] = inFunction[m][addr] ? topTarget[m][addr + 1] : place[m][addr];
+        }
+    }
+
+    program.assign(next - 1, Instruction{});
+    for (size_t m = 0; m < inputs.size(); ++m) {
+        const Input& input = inputs[m];
+        const ObjectModule& module = input.module;
+        int size = static_cast<int>(module.code.size());
+        for (const auto& instr : module.code) {
+            Instruction& placed = program[place[m][instr.address] - 1];
+            placed = instr;
+            placed.address = place[m][instr.address];
+        }
+        for (const auto& fixup : module.fixups) {
+            Instruction& placed = program[place[m][fixup.address] - 1];
+            std::string where = input.name + ":" + std::to_string(fixup.address);
+            if (fixup.kind == ObjectModule::Relocation::Data) {
+                // A vector op has a list of addresses, all of them move
+                std::vector<int> addresses = CodeGen::addresses(placed.operand);
+                for (int& addr : addresses) {
+                    if (addr < 0 || addr >= module.dataSize) {
+                        throw std::runtime_error(where + ": memory " + std::to_string(addr) + " is outside the module");
+                    }
+                    addr += input.dataBase;
+                }
+                placed.operand = CodeGen::addressOperand(addresses);
+                continue;
+            }
+            int value = std::stoi(placed.operand);
+            switch (fixup.kind) {
+                case ObjectModule::Relocation::Code:
+                    if (value < 1 || value > size + 1) {
+                        throw std::runtime_error(where + ": jump to " + placed.operand + " is outside the module");
+                    }
+                    if (inFunction[m][fixup.address]) {
+                        if (!inFunction[m][value]) {
+                            throw std::runtime_error(where + ": jump to " + placed.operand + " leaves the function");
+                        }
+                        value = place[m][value];
+                    } else {
+                        value = topTarget[m][value];
+                    }
+                    break;
+                case ObjectModule::Relocation::Data:
+                    // Moved above
+                    break;
+                case ObjectModule::Relocation::Constant:
+                    if (value < 0 || value >= static_cast<int>(constantIndex[m].size())) {
+                        throw std::runtime_error(where + ": constant " + placed.operand + " is not in the pool");
+                    }
+                    value = constantIndex[m][value];
+                    break;
+            }
+            placed.operand = std::to_string(value);
+        }
+    }
+}
+
+void Linker::print(OutputWriter& out) const {
+    out << "\nSymbol Table:\n";
+    for (const auto& input : inputs) {
+        out << "Module " << input.name << ":\n";
+        for (const auto& symbol : input.module.symbols) {
+            out << "  " << symbol.name << " @ " << input.dataBase + symbol.memoryAddress << " : "
+                << typeName(symbol.type);
+            if (symbol.length > 0) out << '[' << symbol.length << ']';
+            out << '\n';
+        }
+    }
+    out << "\nAssembly Code:\n";
+    for (const auto& instr : program) {
+        out << instr.address << ' ' << instr.op;
+        if (!instr.operand.empty()) out << ' ' << instr.operand;
+        out << '\n';
+    }
+    if (!constants.empty()) {
+        out << "\nConstant Pool:\n";
+        for (size_t i = 0; i < constants.size(); ++i) {
+            out << i << ' ' << constants[i] << '\n';
+        }
+    }
+}
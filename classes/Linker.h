@@ -0,0 +1,46 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "ObjectModule.h"
+
+class OutputWriter;
+
+// Puts object modules together into one program. Every import has to be
+// exported by exactly one module with the same parameter types, and with an
+// integer result where a caller used it. The program has the layout of a
+// single compile: all the functions first, module by module, then each
+// module's top-level statements in the order the modules were added. Memory is
+// handed out from SymbolTable::firstAddress in the same order and the constant
+// pools are merged, so every operand the modules marked is moved.
+class Linker {
+public:
+    void add(const std::string& name, ObjectModule module);
+
+    // Throws std::runtime_error with every problem found, one per line
+    void link();
+
+    const std::vector<Instruction>& getInstructions() const { return program; }
+    const std::vector<std::string>& getConstants() const { return constants; }
+    // Memory words the program uses
+    int dataSize() const { return dataEnd - SymbolTable::firstAddress; }
+    size_t functionCount() const;
+    size_t moduleCount() const { return inputs.size(); }
+
+    // A listing like the compiler's, with the globals grouped by module
+    void print(OutputWriter& out) const;
+
+private:
+    struct Input {
+        std::string name;
+        ObjectModule module;
+        int dataBase = 0;
+    };
+
+    void resolve() const;
+
+    std::vector<Input> inputs;
+    std::vector<Instruction> program;
+    std::vector<std::string> constants;
+    int dataEnd = SymbolTable::firstAddress;
+};
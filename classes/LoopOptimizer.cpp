@@ -0,0 +1,338 @@
+#include "LoopOptimizer.h"
+#include <map>
+#include <unordered_map>
+
+namespace {
+
+bool isIntegerLiteral(const std::string& s) {
+    if (s.empty() || s.size() > 9) return false;
+    for (char c : s) {
+        if (!std::isdigit(static_cast<unsigned char>(c))) return false;
+    }
+    return true;
+}
+
+bool isArithmetic(const std::string& op) {
+    // Division is left out on purpose, hoisting it could trap on a loop that never runs
+    return op == "ADDI" || op == "SUBI" || op == "MULI" || op == "ADDF" || op == "SUBF" || op == "MULF";
+}
+
+bool isNegate(const std::string& op) {
+    return op == "NEGI" || op == "NEGF";
+}
+
+}
+
+LoopOptimizer::LoopOptimizer(CodeGen& codeGen, SymbolTable& symbolTable)
+    : codeGen(codeGen), symbolTable(symbolTable) {}
+
+void LoopOptimizer::run() {
+    const std::vector<Instruction>& code = codeGen.getInstructions();
+    sizeBefore = code.size();
+    sizeAfter = sizeBefore;
+    reports.clear();
+
+    // Every backward jump closes a natural loop
+    std::vector<bool> isTarget(code.size() + 1, false);
+    std::vector<Loop> loops;
+    for (size_t j = 0; j < code.size(); ++j) {
+        if (CodeGen::isJump(code[j].op) && !code[j].operand.empty()) {
+            int target = std::stoi(code[j].operand) - 1;
+            if (target >= 0 && target < static_cast<int>(isTarget.size())) {
+                isTarget[target] = true;
+            }
+            // Tail calls jump back to a function LABEL, those aren't loops we can optimize
+            bool backward = target >= 0 && target <= static_cast<int>(j);
+            if (backward && !(code[target].op == "LABEL" && !code[target].operand.empty()) &&
+                codeGen.functionAt(target + 1) == codeGen.functionAt(j + 1)) {
+                // A while loop is entered by a JUMP down to its test, the preheader goes before it
+                int entry = target;
+                if (target > 0 && code[target - 1].op == "JUMP") {
+                    int test = std::stoi(code[target - 1].operand) - 1;
+                    if (test > target && test <= static_cast<int>(j)) entry = target - 1;
+                }
+                loops.push_back({entry, target, static_cast<int>(j)});
+            }
+        }
+    }
+
+    std::vector<Loop> innermost;
+    for (size_t a = 0; a < loops.size(); ++a) {
+        bool inner = true;
+        for (size_t b = 0; b < loops.size(); ++b) {
+            if (a != b && loops[a].head <= loops[b].head && loops[b].tail <= loops[a].tail) {
+                inner = false;
+            }
+        }
+        if (inner) innermost.push_back(loops[a]);
+    }
+
+    std::vector<Rewrite> rewrites(innermost.size());
+    bool changed = false;
+    for (size_t l = 0; l < innermost.size(); ++l) {
+        LoopReport report{};
+        report.head = code[innermost[l].head].address;
+        report.sizeBefore = innermost[l].tail - innermost[l].head + 1;
+        optimizeLoop(code, innermost[l], isTarget, rewrites[l], report);
+        changed = changed || !rewrites[l].preheader.empty();
+        reports.push_back(report);
+    }
+    if (!changed) return;
+
+    // Index everything by position so the program is rebuilt in one sweep
+    std::unordered_map<int, size_t> loopAtEntry;
+    std::unordered_map<int, std::pair<int, int>> replaceAt;   // start -> end, temp
+    std::unordered_map<int, std::vector<Instruction>> insertAfter;
+    std::vector<int> preheaderId(innermost.size(), 0);
+    int nextId = -1;
+    for (size_t l = 0; l < innermost.size(); ++l) {
+        const Rewrite& rewrite = rewrites[l];
+        if (rewrite.preheader.empty()) continue;
+        loopAtEntry[innermost[l].entry] = l;
+        preheaderId[l] = nextId--;
+        for (size_t r = 0; r < rewrite.replaced.size(); ++r) {
+            replaceAt[rewrite.replaced[r].first] = {rewrite.replaced[r].second, rewrite.replacedTemp[r]};
+        }
+        for (const auto& [index, extra] : rewrite.insertAfter) {
+            auto& slot = insertAfter[index];
+            slot.insert(slot.end(), extra.begin(), extra.end());
+        }
+    }
+
+    std::vector<Instruction> result;
+    result.reserve(code.size() + 16);
+    for (int i = 0; i < static_cast<int>(code.size()); ++i) {
+        auto entry = loopAtEntry.find(i);
+        bool entryMoved = false;
+        if (entry != loopAtEntry.end()) {
+            const Loop& loop = innermost[entry->second];
+            const auto& preheader = rewrites[entry->second].preheader;
+            result.push_back(preheader.front());
+            if (loop.entry != loop.head) {
+                // Only outside code reaches the entry JUMP, so the preheader can take its place
+                result.back().address = code[i].address;
+                entryMoved = true;
+            } else {
+                result.back().address = preheaderId[entry->second];
+            }
+            result.insert(result.end(), preheader.begin() + 1, preheader.end());
+        }
+
+        auto replace = replaceAt.find(i);
+        if (replace != replaceAt.end()) {
+            // Keep the old address so jumps to the start of the expression still land here
+            result.push_back({code[i].address, "PUSHM", std::to_string(replace->second.second)});
+            i = replace->second.first;
+        } else {
+            Instruction instr = code[i];
+            if (entryMoved) instr.address = nextId--;
+            // Jumps entering a loop from outside must run its preheader first
+            if (CodeGen::isJump(instr.op) && !instr.operand.empty()) {
+                int target = std::stoi(instr.operand) - 1;
+                auto entered = loopAtEntry.find(target);
+                if (entered != loopAtEntry.end()) {
+                    const Loop& loop = innermost[entered->second];
+                    if (loop.entry == loop.head && (i < loop.entry || i > loop.tail)) {
+                        instr.operand = std::to_string(preheaderId[entered->second]);
+                    }
+                }
+            }
+            result.push_back(instr);
+        }
+
+        auto extra = insertAfter.find(i);
+        if (extra != insertAfter.end()) {
+            result.insert(result.end(), extra->second.begin(), extra->second.end());
+        }
+    }
+
+    sizeAfter = result.size();
+    codeGen.relink(std::move(result));
+}
+
+void LoopOptimizer::optimizeLoop(const std::vector<Instruction>& code, const Loop& loop,
+                                 const std::vector<bool>& isTarget, Rewrite& rewrite, LoopReport& report) {
+    report.sizeAfter = report.sizeBefore;
+
+    std::unordered_map<int, int> defs;  // address -> stores inside the loop
+    for (int i = loop.head; i <= loop.tail; ++i) {
+        if (code[i].op == "POPM") defs[std::stoi(code[i].operand)]++;
+        if (code[i].op == "CALL") report.hasCall = true;
+    }
+    if (report.hasCall) return;
+
+    // Simulate the operand stack to find maximal invariant expressions. Each entry
+    // remembers the instructions that computed it.
+    struct Entry {
+        int start;
+        int end;
+        bool invariant;
+        bool compound;
+    };
+    std::vector<Entry> stack;
+    std::vector<std::pair<int, int>> candidates;
+    auto offer = [&](const Entry& e) {
+        if (e.invariant && e.compound) candidates.push_back({e.start, e.end});
+    };
+
+    for (int i = loop.head; i <= loop.tail; ++i) {
+        if (isTarget[i]) stack.clear();  // values don't flow across labels
+        const std::string& op = code[i].op;
+
+        if (op == "PUSHI" || op == "PUSHF") {
+            stack.push_back({i, i, true, false});
+        } else if (op == "PUSHM") {
+            stack.push_back({i, i, defs.count(std::stoi(code[i].operand)) == 0, false});
+        } else if (isNegate(op)) {
+            if (stack.empty()) continue;
+            Entry operand = stack.back();
+            stack.pop_back();
+            bool invariant = operand.invariant && operand.end + 1 == i;
+            if (!invariant) offer(operand);
+            stack.push_back({operand.start, i, invariant, true});
+        } else if (isArithmetic(op)) {
+            if (stack.size() < 2) {
+                stack.clear();
+                continue;
+            }
+            Entry right = stack.back();
+            stack.pop_back();
+            Entry left = stack.back();
+            stack.pop_back();
+            bool contiguous = left.end + 1 == right.start && right.end + 1 == i;
+            Entry e{left.start, i, contiguous && left.invariant && right.invariant, true};
+            if (!e.invariant) {
+                offer(left);
+                offer(right);
+            }
+            stack.push_back(e);
+        } else {
+            int pops, pushes;
+            if (!CodeGen::stackEffect(op, pops, pushes)) {
+                for (const auto& e : stack) offer(e);
+                stack.clear();
+                continue;
+            }
+            for (int k = 0; k < pops && !stack.empty(); ++k) {
+                offer(stack.back());
+                stack.pop_back();
+            }
+            if (pushes) stack.push_back({i, i, false, false});
+            if (CodeGen::isJump(op) || op == "RET") stack.clear();
+        }
+    }
+
+    // Identical expressions share one temp
+    std::map<std::string, int> temps;
+    for (const auto& [start, end] : candidates) {
+        std::string key;
+        for (int i = start; i <= end; ++i) key += code[i].op + " " + code[i].operand + "\n";
+
+        auto found = temps.find(key);
+        if (found == temps.end()) {
+            // The last op says what the expression produces
+            const std::string& last = code[end].op;
+            int temp = symbolTable.allocateTemp(last.back() == 'F' ? ValueType::Real : ValueType::Integer);
+            found = temps.emplace(key, temp).first;
+            for (int i = start; i <= end; ++i) {
+                rewrite.preheader.push_back({0, code[i].op, code[i].operand});
+            }
+            rewrite.preheader.push_back({0, "POPM", std::to_string(temp)});
+        }
+        rewrite.replaced.push_back({start, end});
+        rewrite.replacedTemp.push_back(found->second);
+        report.sizeAfter -= end - start;
+        report.hoisted++;
+    }
+
+    // Basic induction variables: the only store is x = x + k or x = x - k
+    struct Induction {
+        int address;
+        long long step;
+        int update;  // index of the POPM
+    };
+    std::vector<Induction> inductions;
+    for (int i = loop.head + 3; i <= loop.tail; ++i) {
+        if (code[i].op != "POPM") continue;
+        int addr = std::stoi(code[i].operand);
+        if (defs[addr] != 1 || isTarget[i - 2] || isTarget[i - 1] || isTarget[i]) continue;
+
+        const Instruction& a = code[i - 3];
+        const Instruction& b = code[i - 2];
+        const Instruction& arith = code[i - 1];
+        std::string self = std::to_string(addr);
+        long long step = 0;
+        if (a.op == "PUSHM" && a.operand == self && b.op == "PUSHI" && isIntegerLiteral(b.operand) &&
+            (arith.op == "ADDI" || arith.op == "SUBI")) {
+            step = std::stoll(b.operand) * (arith.op == "ADDI" ? 1 : -1);
+        } else if (a.op == "PUSHI" && isIntegerLiteral(a.operand) && b.op == "PUSHM" && b.operand == self &&
+                   arith.op == "ADDI") {
+            step = std::stoll(a.operand);
+        } else {
+            continue;
+        }
+        inductions.push_back({addr, step, i});
+        report.inductionVars.push_back(addr);
+    }
+
+    // Derived induction variables: i * c becomes a temp bumped by c * step
+    for (const auto& iv : inductions) {
+        std::string self = std::to_string(iv.address);
+        std::map<long long, std::vector<int>> uses;  // c -> start of each i * c
+        for (int i = loop.head; i + 2 <= loop.tail; ++i) {
+            if (code[i + 2].op != "MULI" || isTarget[i + 1] || isTarget[i + 2]) continue;
+            if (i + 2 >= iv.update - 3 && i <= iv.update) continue;
+            const Instruction& a = code[i];
+            const Instruction& b = code[i + 1];
+            if (a.op == "PUSHM" && a.operand == self && b.op == "PUSHI" && isIntegerLiteral(b.operand)) {
+                uses[std::stoll(b.operand)].push_back(i);
+            } else if (a.op == "PUSHI" && isIntegerLiteral(a.operand) && b.op == "PUSHM" && b.operand == self) {
+                uses[std::stoll(a.operand)].push_back(i);
+            }
+        }
+
+        for (const auto& [factor, starts] : uses) {
+            // The update costs as much as two uses save, so only reduce when it doesn't grow the loop
+            if (starts.size() < 2) continue;
+            long long delta = factor * iv.step;
+
+            int temp = symbolTable.allocateTemp(ValueType::Integer);
+            std::string tempAddr = std::to_string(temp);
+            rewrite.preheader.push_back({0, "PUSHM", self});
+            rewrite.preheader.push_back({0, "PUSHI", std::to_string(factor)});
+            rewrite.preheader.push_back({0, "MULI", ""});
+            rewrite.preheader.push_back({0, "POPM", tempAddr});
+
+            for (int start : starts) {
+                rewrite.replaced.push_back({start, start + 2});
+                rewrite.replacedTemp.push_back(temp);
+                report.sizeAfter -= 2;
+                report.reduced++;
+            }
+            rewrite.insertAfter.push_back({iv.update, {
+                {0, "PUSHM", tempAddr},
+                {0, "PUSHI", std::to_string(delta < 0 ? -delta : delta)},
+                {0, delta < 0 ? "SUBI" : "ADDI", ""},
+                {0, "POPM", tempAddr}}});
+            report.sizeAfter += 4;
+        }
+    }
+}
+
+void LoopOptimizer::print(std::ostream& out) const {
+    for (const auto& r : reports) {
+        out << "[LOOPOPT] loop @" << r.head << ": " << r.sizeBefore << " -> " << r.sizeAfter
+            << " instructions per iteration";
+        if (r.hasCall) {
+            out << " (contains CALL, skipped)\n";
+            continue;
+        }
+        out << ", " << r.hoisted << " hoisted, " << r.reduced << " strength reduced";
+        if (!r.inductionVars.empty()) {
+            out << ", induction vars:";
+            for (int addr : r.inductionVars) out << " " << addr;
+        }
+        out << "\n";
+    }
+    out << "[LOOPOPT] program: " << sizeBefore << " -> " << sizeAfter << " instructions\n";
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CodeGen.h"
+#include "SymbolTable.h"
+
+// Loop pass over the code CodeGen produced for while loops. A natural loop is a
+// backward jump plus the code it jumps over. For every innermost loop the pass
+// hoists loop-invariant expressions into a preheader and strength reduces
+// multiplications of induction variables (x = x + k / x = x - k).
+class LoopOptimizer {
+public:
+    struct LoopReport {
+        int head;                       // address of the loop head before the pass
+        int sizeBefore;                 // instructions inside the loop
+        int sizeAfter;
+        int hoisted;                    // invariant expressions moved to the preheader
+        int reduced;                    // multiplications replaced by an updated temp
+        bool hasCall;                   // calls may write anything, loop left alone
+        std::vector<int> inductionVars; // addresses of basic induction variables
+    };
+
+    LoopOptimizer(CodeGen& codeGen, SymbolTable& symbolTable);
+
+    void run();
+    void print(std::ostream& out) const;
+
+private:
+    struct Loop {
+        int entry;  // where the preheader goes: the head, or the JUMP down to the test
+        int head;   // index of the first instruction of the loop
+        int tail;   // index of the backward jump
+    };
+
+    // Pending changes, applied to the whole program in one relink
+    struct Rewrite {
+        std::vector<Instruction> preheader;
+        std::vector<std::pair<int, int>> replaced;  // [start, end] -> PUSHM temp
+        std::vector<int> replacedTemp;
+        std::vector<std::pair<int, std::vector<Instruction>>> insertAfter;
+    };
+
+    void optimizeLoop(const std::vector<Instruction>& code, const Loop& loop,
+                      const std::vector<bool>& isTarget, Rewrite& rewrite, LoopReport& report);
+
+    CodeGen& codeGen;
+    SymbolTable& symbolTable;
+    std::vector<LoopReport> reports;
+    int sizeBefore = 0;
+    int sizeAfter = 0;
+};
@@ -0,0 +1,204 @@
+#include "ObjectModule.h"
+#include "OutputWriter.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+// Bumped whenever a record changes meaning
+static constexpr const char* objectFormat = "rat25s-object 2";
+
+static const char* relocationName(ObjectModule::Relocation kind) {
+    switch (kind) {
+        case ObjectModule::Relocation::Code: return "code";
+        case ObjectModule::Relocation::Data: return "data";
+        case ObjectModule::Relocation::Constant: return "constant";
+    }
+    return "unknown";
+}
+
+ObjectModule ObjectModule::build(const CodeGen& codeGen, const SymbolTable& symbolTable,
+                                 const std::vector<FunctionType>& defined, const std::vector<FunctionType>& imported) {
+    ObjectModule module;
+    module.dataSize = symbolTable.getNextAddress() - SymbolTable::firstAddress;
+    module.constants = codeGen.getConstants();
+    module.imports = imported;
+
+    const auto& code = codeGen.getInstructions();
+    module.code.assign(code.begin(), code.end());
+    for (auto& instr : module.code) {
+        if (instr.op == "PUSHM" || instr.op == "POPM" || instr.op == "PUSHMX" || instr.op == "POPMX" ||
+            CodeGen::isVectorOp(instr.op)) {
+            std::vector<int> addresses = CodeGen::addresses(instr.operand);
+            for (int& addr : addresses) addr -= SymbolTable::firstAddress;
+            instr.operand = CodeGen::addressOperand(addresses);
+            module.fixups.push_back({instr.address, Relocation::Data});
+        } else if (instr.op == "PUSHF") {
+            module.fixups.push_back({instr.address, Relocation::Constant});
+        } else if (CodeGen::isJump(instr.op)) {
+            module.fixups.push_back({instr.address, Relocation::Code});
+        }
+    }
+
+    for (const auto& fn : codeGen.getFunctions()) {
+        Export entry{};
+        entry.type.name = fn.name;
+        entry.entry = fn.entry;
+        entry.end = fn.end;
+        for (const auto& type : defined) {
+            if (type.name == fn.name) entry.type = type;
+        }
+        module.exports.push_back(entry);
+    }
+
+    for (auto symbol : symbolTable.entries()) {
+        if (symbol.scope != 0) continue;
+        symbol.memoryAddress -= SymbolTable::firstAddress;
+        module.symbols.push_back(symbol);
+    }
+    return module;
+}
+
+static void writeType(OutputWriter& out, const FunctionType& type) {
+    out << ' ' << typeName(type.returnType);
+    for (ValueType param : type.params) out << ' ' << typeName(param);
+    out << '\n';
+}
+
+void ObjectModule::write(OutputWriter& out) const {
+    out << objectFormat << '\n';
+    out << "data " << dataSize << '\n';
+    for (const auto& literal : constants) out << "constant " << literal << '\n';
+    for (const auto& symbol : symbols) {
+        out << "symbol " << symbol.name << ' ' << symbol.memoryAddress << ' ' << typeName(symbol.type);
+        if (symbol.length > 0) out << ' ' << symbol.length;
+        out << '\n';
+    }
+    for (const auto& fn : exports) {
+        out << "export " << fn.type.name << ' ' << fn.entry << ' ' << fn.end;
+        writeType(out, fn.type);
+    }
+    for (const auto& fn : imports) {
+        out << "import " << fn.name << ' ' << (fn.resultUsed ? 1 : 0);
+        writeType(out, fn);
+    }
+    for (const auto& instr : code) {
+        out << "code " << instr.op;
+        if (!instr.operand.empty()) out << ' ' << instr.operand;
+        out << '\n';
+    }
+    for (const auto& fixup : fixups) out << "fixup " << fixup.address << ' ' << relocationName(fixup.kind) << '\n';
+}
+
+static ValueType parseType(const std::string& name) {
+    for (ValueType type : {ValueType::Integer, ValueType::Real, ValueType::Boolean}) {
+        if (typeName(type) == name) return type;
+    }
+    throw std::runtime_error("unknown type " + name);
+}
+
+// The rest of a record: a return type then the parameter types
+static void readType(std::istringstream& fields, FunctionType& type) {
+    std::string word;
+    if (!(fields >> word)) throw std::runtime_error("missing return type");
+    type.returnType = parseType(word);
+    while (fields >> word) type.params.push_back(parseType(word));
+}
+
+ObjectModule ObjectModule::read(std::string_view text) {
+    ObjectModule module;
+    size_t lineNumber = 0;
+    size_t start = 0;
+    bool sawHeader = false;
+    try {
+        while (start < text.size()) {
+            size_t end = text.find('\n', start);
+            if (end == std::string_view::npos) end = text.size();
+            std::string line(text.substr(start, end - start));
+            start = end + 1;
+            lineNumber++;
+            if (!sawHeader) {
+                if (line != objectFormat) throw std::runtime_error("not a rat25s object module");
+                sawHeader = true;
+                continue;
+            }
+
+            std::istringstream fields(line);
+            std::string record;
+            fields >> record;
+            if (record == "data") {
+                if (!(fields >> module.dataSize) || module.dataSize < 0) throw std::runtime_error("bad data size");
+            } else if (record == "constant") {
+                std::string literal;
+                if (!(fields >> literal)) throw std::runtime_error("missing constant");
+                module.constants.push_back(literal);
+            } else if (record == "symbol") {
+                SymbolEntry symbol{};
+                std::string type;
+                if (!(fields >> symbol.name >> symbol.memoryAddress >> type)) throw std::runtime_error("bad symbol");
+                symbol.type = parseType(type);
+                // An array has its length after the type
+                if (!(fields >> symbol.length)) symbol.length = 0;
+                module.symbols.push_back(symbol);
+            } else if (record == "export") {
+                Export fn{};
+                if (!(fields >> fn.type.name >> fn.entry >> fn.end)) throw std::runtime_error("bad export");
+                readType(fields, fn.type);
+                module.exports.push_back(fn);
+            } else if (record == "import") {
+                FunctionType fn;
+                int used;
+                if (!(fields >> fn.name >> used)) throw std::runtime_error("bad import");
+                fn.resultUsed = used != 0;
+                readType(fields, fn);
+                module.imports.push_back(fn);
+            } else if (record == "code") {
+                Instruction instr{};
+                instr.address = static_cast<int>(module.code.size()) + 1;
+                if (!(fields >> instr.op)) throw std::runtime_error("missing op");
+                fields >> instr.operand;
+                module.code.push_back(instr);
+            } else if (record == "fixup") {
+                Fixup fixup{};
+                std::string kind;
+                if (!(fields >> fixup.address >> kind)) throw std::runtime_error("bad fixup");
+                if (kind == "code") fixup.kind = Relocation::Code;
+                else if (kind == "data") fixup.kind = Relocation::Data;
+                else if (kind == "constant") fixup.kind = Relocation::Constant;
+                else throw std::runtime_error("unknown relocation " + kind);
+                module.fixups.push_back(fixup);
+            } else if (!record.empty()) {
+                throw std::runtime_error("unknown record " + record);
+            }
+        }
+        if (!sawHeader) throw std::runtime_error("not a rat25s object module");
+
+        // Records that point into the code are checked once it is all read
+        int size = static_cast<int>(module.code.size());
+        int previousEnd = 1;
+        for (const auto& fn : module.exports) {
+            if (fn.entry < previousEnd || fn.end <= fn.entry || fn.end > size + 1) {
+                throw std::runtime_error("export " + fn.type.name + " is outside the code or overlaps another");
+            }
+            previousEnd = fn.end;
+        }
+        for (const auto& fixup : module.fixups) {
+            if (fixup.address < 1 || fixup.address > size) throw std::runtime_error("fixup outside the code");
+        }
+    } catch (const std::runtime_error& e) {
+        throw std::runtime_error("line " + std::to_string(lineNumber) + ": " + e.what());
+    }
+    return module;
+}
+
+ObjectModule ObjectModule::readFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("Could not open object module " + path);
+    std::ostringstream text;
+    text << in.rdbuf();
+    try {
+        return read(text.str());
+    } catch (const std::runtime_error& e) {
+        throw std::runtime_error(path + ": " + e.what());
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "CodeGen.h"
+#include "SymbolTable.h"
+
+class OutputWriter;
+
+// A function's type as modules see each other
+struct FunctionType {
+    std::string name;
+    std::vector<ValueType> params;
+    ValueType returnType = ValueType::Integer;
+    // Imports only: some call uses the result, so the definition has to return
+    // what the caller assumed
+    bool resultUsed = false;
+};
+
+// One separately compiled source: its code with addresses that still have to be
+// moved, the functions it defines (exports) and the ones it calls without
+// defining (imports). Code addresses count from 1 and memory addresses from 0
+// within the module, the relocation table says which operands are which. The
+// Linker puts modules together into a program.
+struct ObjectModule {
+    struct Export {
+        FunctionType type;
+        // [entry, end) in the module's code, entry being the LABEL
+        int entry;
+        int end;
+    };
+
+    enum class Relocation { Code, Data, Constant };
+    struct Fixup {
+        // Module address of the instruction whose operand moves
+        int address;
+        Relocation kind;
+    };
+
+    // Memory words the module uses, locals and temps included
+    int dataSize = 0;
+    std::vector<Instruction> code;
+    std::vector<Fixup> fixups;
+    std::vector<Export> exports;
+    std::vector<FunctionType> imports;
+    std::vector<std::string> constants;
+    // Globals with module relative addresses, for the linked listing
+    std::vector<SymbolEntry> symbols;
+
+    // Takes a finished, unstreamed compilation apart. defined and imported are
+    // the Parser's view of the function types.
+    static ObjectModule build(const CodeGen& codeGen, const SymbolTable& symbolTable,
+                              const std::vector<FunctionType>& defined, const std::vector<FunctionType>& imported);
+
+    // A text format in the style of the listing, one record per line
+    void write(OutputWriter& out) const;
+    // Throws std::runtime_error naming the line that is wrong
+    static ObjectModule read(std::string_view text);
+    static ObjectModule readFile(const std::string& path);
+};
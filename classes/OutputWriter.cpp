@@ -0,0 +1,109 @@
+#include "OutputWriter.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/uio.h>
+#include <unistd.h>
+
+OutputWriter::OutputWriter(int fd, size_t capacity)
+    : fd(fd), buffer(capacity), capacity(capacity) {}
+
+OutputWriter::OutputWriter(std::ostream& stream, size_t capacity)
+    : stream(&stream), buffer(capacity), capacity(capacity) {}
+
+OutputWriter::OutputWriter(std::string& text, size_t capacity)
+    : textOut(&text), textStart(text.size()), buffer(capacity), capacity(capacity) {}
+
+OutputWriter::~OutputWriter() {
+    flush();
+}
+
+OutputWriter& OutputWriter::operator<<(std::string_view text) {
+    if (text.size() <= capacity - used) {
+        std::memcpy(buffer.data() + used, text.data(), text.size());
+        used += text.size();
+    } else if (text.size() < capacity / 2) {
+        flush();
+        std::memcpy(buffer.data(), text.data(), text.size());
+        used = text.size();
+    } else {
+        // Big blocks skip the copy and go out together with what's buffered
+        send(text.data(), text.size());
+    }
+    return *this;
+}
+
+OutputWriter& OutputWriter::operator<<(char c) {
+    if (used == capacity) flush();
+    buffer[used++] = c;
+    return *this;
+}
+
+bool OutputWriter::patch(size_t offset, std::string_view text) {
+    // Part of the text can be out already and the rest still buffered
+    size_t split = offset < written ? std::min(text.size(), written - offset) : 0;
+    if (split > 0 && textOut != nullptr) {
+        textOut->replace(textStart + offset, split, text.substr(0, split));
+    } else if (split > 0) {
+        if (fd < 0) return false;
+        size_t done = 0;
+        while (done < split) {
+            ssize_t n = pwrite(fd, text.data() + done, split - done, offset + done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                failed = true;
+                return false;
+            }
+            done += n;
+        }
+    }
+    std::memcpy(buffer.data() + (offset + split - written), text.data() + split, text.size() - split);
+    return true;
+}
+
+void OutputWriter::flush() {
+    send(nullptr, 0);
+}
+
+void OutputWriter::send(const char* data, size_t size) {
+    if (used + size == 0) return;
+    written += used + size;
+
+    if (textOut != nullptr) {
+        textOut->append(buffer.data(), used);
+        if (size) textOut->append(data, size);
+        used = 0;
+        return;
+    }
+    if (stream != nullptr) {
+        stream->write(buffer.data(), used);
+        if (size) stream->write(data, size);
+        stream->flush();
+        failed = failed || !*stream;
+        used = 0;
+        return;
+    }
+
+    iovec parts[2] = {{buffer.data(), used}, {const_cast<char*>(data), size}};
+    iovec* part = parts;
+    int count = size ? 2 : 1;
+    while (count > 0 && !failed) {
+        ssize_t n = writev(fd, part, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            failed = true;
+            break;
+        }
+        // Partial write, skip what got out and retry with the rest
+        while (count > 0 && static_cast<size_t>(n) >= part->iov_len) {
+            n -= part->iov_len;
+            ++part;
+            --count;
+        }
+        if (count > 0) {
+            part->iov_base = static_cast<char*>(part->iov_base) + n;
+            part->iov_len -= n;
+        }
+    }
+    used = 0;
+}
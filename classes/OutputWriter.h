@@ -0,0 +1,62 @@
+#pragma once
+#include <charconv>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Buffered output for the listing and reports. Text and integers (formatted with
+// std::to_chars) are collected in one large reusable buffer that goes to the OS
+// in a few big write()/writev() calls, or to an ostream or a string when there
+// is no file descriptor. Nothing is flushed per line.
+class OutputWriter {
+public:
+    explicit OutputWriter(int fd, size_t capacity = 1 << 16);
+    explicit OutputWriter(std::ostream& stream, size_t capacity = 1 << 16);
+    // Appends to text, which keeps its capacity from one use to the next
+    explicit OutputWriter(std::string& text, size_t capacity = 1 << 16);
+    ~OutputWriter();
+
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    OutputWriter& operator<<(std::string_view text);
+    OutputWriter& operator<<(const std::string& text) { return *this << std::string_view(text); }
+    OutputWriter& operator<<(const char* text) { return *this << std::string_view(text); }
+    OutputWriter& operator<<(char c);
+
+    template <typename T,
+              typename = std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, char> &&
+                                          !std::is_same_v<T, bool>>>
+    OutputWriter& operator<<(T value) {
+        if (capacity - used < 24) flush();
+        auto result = std::to_chars(buffer.data() + used, buffer.data() + capacity, value);
+        used = result.ptr - buffer.data();
+        return *this;
+    }
+
+    void flush();
+    // Overwrite text that was written earlier, offset counting from the first byte
+    // this writer produced (the start of the file for fd writers). Bytes still in
+    // the buffer or string are changed in place, flushed ones with pwrite(). False
+    // when the bytes are gone, i.e. already sent to an ostream.
+    bool patch(size_t offset, std::string_view text);
+    // Everything written so far, flushed or not
+    size_t bytesWritten() const { return written + used; }
+    bool good() const { return !failed; }
+
+private:
+    // Sends the buffer and then data, as one writev() when going to a file
+    void send(const char* data, size_t size);
+
+    int fd = -1;
+    std::ostream* stream = nullptr;
+    std::string* textOut = nullptr;
+    size_t textStart = 0;
+    std::vector<char> buffer;
+    size_t capacity;
+    size_t used = 0;
+    size_t written = 0;
+    bool failed = false;
+};
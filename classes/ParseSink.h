@@ -0,0 +1,121 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "CodeGen.h"
+#include "SymbolTable.h"
+
+// What BasicParser does with a program as it recognizes it. The parser is a
+// template on its sink and calls it directly, so the actions a sink leaves
+// empty compile away instead of being skipped at run time.
+//
+// A sink has the CodeGen calls the parser makes, the SymbolTable ones under
+// their own names, lookup plus load/store for a variable's PUSHM/POPM and
+// loadElement/storeElement for an array element's PUSHMX/POPMX, and
+// checksTypes, which turns every semantic check in the parser on or off. Only
+// CodeSink leaves a program behind.
+
+// Grammar only: no names, no types, no code. Any identifier is accepted as an
+// integer variable and any call as a function, so a lint of a whole corpus
+// pays for lexing and parsing and nothing else.
+struct SyntaxSink {
+    static constexpr bool checksTypes = false;
+
+    // Captured code that was never kept
+    struct Capture {};
+
+    template <typename... Args>
+    int emit(const Args&...) { return 0; }
+    void backpatch(const CodeGen::BackpatchList&, int) {}
+    int getNextAddress() const { return 0; }
+    const std::string& lastOp() const {
+        static const std::string none;
+        return none;
+    }
+    bool jumpsToEnd() const { return false; }
+    int addConstant(std::string_view) { return 0; }
+    void beginCapture() {}
+    Capture endCapture() { return {}; }
+    void append(const Capture&) {}
+    void addFunction(std::string_view, int, int) {}
+    void addImport(std::string_view, int) {}
+
+    void enterScope() {}
+    void exitScope() {}
+    bool declare(std::string_view, ValueType, int = 0) { return true; }
+    const Symbol* lookup(std::string_view) const {
+        static const Symbol any{ValueType::Integer, 0};
+        return &any;
+    }
+    int nextMemoryAddress() const { return 0; }
+    void load(const Symbol&) {}
+    void store(const Symbol&) {}
+    void loadElement(const Symbol&) {}
+    void storeElement(const Symbol&) {}
+};
+
+// Names and types: every declaration goes into the SymbolTable and every use is
+// looked up and type checked, but no code is made
+struct SymbolSink : SyntaxSink {
+    static constexpr bool checksTypes = true;
+
+    explicit SymbolSink(SymbolTable& symbolTable) : symbolTable(symbolTable) {}
+
+    void enterScope() { symbolTable.enterScope(); }
+    void exitScope() { symbolTable.exitScope(); }
+    bool declare(std::string_view name, ValueType type, int length = 0) {
+        return symbolTable.declare(name, type, length);
+    }
+    // nullptr for an undeclared variable, the parser reports it as it would when compiling
+    const Symbol* lookup(std::string_view name) const { return symbolTable.find(name); }
+    int nextMemoryAddress() const { return symbolTable.getNextAddress(); }
+
+    SymbolTable& symbolTable;
+};
+
+// The full compile
+struct CodeSink {
+    static constexpr bool checksTypes = true;
+
+    CodeSink(SymbolTable& symbolTable, CodeGen& codeGen) : symbolTable(symbolTable), codeGen(codeGen) {}
+
+    // An operand can be a view into the source, a name or a literal, and is
+    // only copied here, so the sinks that drop it never make the string
+    template <typename Operand = std::string>
+    int emit(const std::string& op, const Operand& operand = {}) {
+        if constexpr (std::is_same_v<Operand, std::string>) {
+            return codeGen.emit(op, operand);
+        } else {
+            return codeGen.emit(op, std::string(operand));
+        }
+    }
+    void backpatch(const CodeGen::BackpatchList& list, int target) { codeGen.backpatch(list, target); }
+    int getNextAddress() const { return codeGen.getNextAddress(); }
+    const std::string& lastOp() const { return codeGen.lastOp(); }
+    bool jumpsToEnd() const { return codeGen.jumpsToEnd(); }
+    int addConstant(std::string_view literal) { return codeGen.addConstant(std::string(literal)); }
+    void beginCapture() { codeGen.beginCapture(); }
+    std::pmr::vector<Instruction> endCapture() { return codeGen.endCapture(); }
+    void append(const std::pmr::vector<Instruction>& code) { codeGen.append(code); }
+    void addFunction(std::string_view name, int entry, int params) {
+        codeGen.addFunction(std::string(name), entry, params);
+    }
+    void addImport(std::string_view name, int params) { codeGen.addImport(std::string(name), params); }
+
+    void enterScope() { symbolTable.enterScope(); }
+    void exitScope() { symbolTable.exitScope(); }
+    bool declare(std::string_view name, ValueType type, int length = 0) {
+        return symbolTable.declare(name, type, length);
+    }
+    const Symbol* lookup(std::string_view name) const { return symbolTable.find(name); }
+    int nextMemoryAddress() const { return symbolTable.getNextAddress(); }
+    void load(const Symbol& symbol) { codeGen.emit("PUSHM", std::to_string(symbol.memoryAddress)); }
+    void store(const Symbol& symbol) { codeGen.emit("POPM", std::to_string(symbol.memoryAddress)); }
+    // The index is on the stack, under the value for a store
+    void loadElement(const Symbol& symbol) { codeGen.emit("PUSHMX", std::to_string(symbol.memoryAddress)); }
+    void storeElement(const Symbol& symbol) { codeGen.emit("POPMX", std::to_string(symbol.memoryAddress)); }
+
+    SymbolTable& symbolTable;
+    CodeGen& codeGen;
+};
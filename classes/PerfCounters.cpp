@@ -0,0 +1,136 @@
+#include "PerfCounters.h"
+
+#include <ctime>
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static bool isSoftware(PerfCounters::Event event) {
+    return event >= PerfCounters::TaskClock;
+}
+
+static perf_event_attr attributes(PerfCounters::Event event) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = isSoftware(event) ? PERF_TYPE_SOFTWARE : PERF_TYPE_HARDWARE;
+    switch (event) {
+        case PerfCounters::Cycles: attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+        case PerfCounters::Instructions: attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+        case PerfCounters::BranchMisses: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+        case PerfCounters::L1Misses:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case PerfCounters::LLCMisses: attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+        case PerfCounters::TaskClock: attr.config = PERF_COUNT_SW_TASK_CLOCK; break;
+        case PerfCounters::PageFaults: attr.config = PERF_COUNT_SW_PAGE_FAULTS; break;
+        case PerfCounters::ContextSwitches: attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES; break;
+        default: break;
+    }
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return attr;
+}
+
+PerfCounters& PerfCounters::forThread() {
+    thread_local PerfCounters counters;
+    return counters;
+}
+
+PerfCounters::PerfCounters() {
+    hardware = openGroup({Cycles, Instructions, BranchMisses, L1Misses, LLCMisses}, hardwareEvents);
+    software = openGroup({TaskClock, PageFaults, ContextSwitches}, softwareEvents);
+    for (Event event : hardwareEvents) counted[event] = true;
+    // Whatever perf_event_open didn't count comes from getrusage
+    for (int event = TaskClock; event < EventCount; ++event) counted[event] = true;
+}
+
+PerfCounters::~PerfCounters() {
+    for (int fd : fds) close(fd);
+}
+
+int PerfCounters::openGroup(const std::vector<Event>& events, std::vector<Event>& opened) {
+    int leader = -1;
+    for (Event event : events) {
+        perf_event_attr attr = attributes(event);
+        // This thread on any CPU, and not inherited by a compiler started with exec
+        int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC));
+        if (fd < 0) {
+            if (leader < 0) return -1;
+            continue;
+        }
+        if (leader < 0) leader = fd;
+        fds.push_back(fd);
+        opened.push_back(event);
+    }
+    return leader;
+}
+
+bool PerfCounters::readGroup(int leader, const std::vector<Event>& events, Reading& reading) const {
+    // nr, time enabled, time running, then a value per event
+    uint64_t data[3 + EventCount];
+    ssize_t n = ::read(leader, data, sizeof(data));
+    if (n < static_cast<ssize_t>((3 + events.size()) * sizeof(uint64_t)) || data[0] != events.size()) return false;
+    double scale = data[2] > 0 && data[2] < data[1] ? static_cast<double>(data[1]) / data[2] : 1.0;
+    for (size_t i = 0; i < events.size(); ++i) {
+        reading.value[events[i]] = static_cast<uint64_t>(data[3 + i] * scale);
+    }
+    return true;
+}
+
+PerfCounters::Reading PerfCounters::read() const {
+    Reading reading;
+    bool fromGroup[EventCount] = {};
+    if (hardware >= 0) readGroup(hardware, hardwareEvents, reading);
+    if (software >= 0 && readGroup(software, softwareEvents, reading)) {
+        for (Event event : softwareEvents) fromGroup[event] = true;
+    }
+
+    if (!fromGroup[TaskClock]) {
+        timespec now;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        reading.value[TaskClock] = static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+    }
+    if (!fromGroup[PageFaults] || !fromGroup[ContextSwitches]) {
+        rusage usage{};
+        getrusage(RUSAGE_THREAD, &usage);
+        if (!fromGroup[PageFaults]) reading.value[PageFaults] = usage.ru_minflt + usage.ru_majflt;
+        if (!fromGroup[ContextSwitches]) reading.value[ContextSwitches] = usage.ru_nvcsw + usage.ru_nivcsw;
+    }
+    return reading;
+}
+
+PerfCounters::Reading PerfCounters::difference(const Reading& end, const Reading& start) {
+    Reading delta;
+    for (int event = 0; event < EventCount; ++event) {
+        // Scaling can make a multiplexed count step back a little
+        delta.value[event] = end.value[event] > start.value[event] ? end.value[event] - start.value[event] : 0;
+    }
+    return delta;
+}
+
+const char* PerfCounters::eventName(Event event) {
+    switch (event) {
+        case Cycles: return "cycles";
+        case Instructions: return "instructions";
+        case BranchMisses: return "branchMisses";
+        case L1Misses: return "l1dMisses";
+        case LLCMisses: return "llcMisses";
+        case TaskClock: return "taskClockNs";
+        case PageFaults: return "pageFaults";
+        case ContextSwitches: return "contextSwitches";
+        default: return "unknown";
+    }
+}
+
+const char* PerfCounters::sourceName(Source source) {
+    switch (source) {
+        case Source::Hardware: return "hardware";
+        case Source::Software: return "software";
+        case Source::Rusage: return "rusage";
+    }
+    return "unknown";
+}
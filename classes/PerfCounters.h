@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Performance counters for the calling thread, read by the Profiler around each
+// phase. With a PMU, Linux perf_event_open counts cycles, instructions, branch
+// misses and L1 data and last level cache misses, in user mode only so the
+// default perf_event_paranoid allows it. Without one, as in most containers
+// and VMs, only the software events are counted: task clock, page faults and
+// context switches, from perf_event_open or failing that from getrusage. A
+// read is a syscall or two, fine around a phase but not around a token.
+class PerfCounters {
+public:
+    enum Event {
+        Cycles,
+        Instructions,
+        BranchMisses,
+        L1Misses,
+        LLCMisses,
+        // Nanoseconds on the CPU
+        TaskClock,
+        PageFaults,
+        ContextSwitches,
+        EventCount
+    };
+
+    // Best first
+    enum class Source { Hardware, Software, Rusage };
+
+    struct Reading {
+        uint64_t value[EventCount] = {};
+    };
+
+    // The calling thread's counters, opened the first time it asks
+    static PerfCounters& forThread();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    Reading read() const;
+    Source source() const { return hardware >= 0 ? Source::Hardware : software >= 0 ? Source::Software : Source::Rusage; }
+    bool counts(Event event) const { return counted[event]; }
+
+    // end - start, event by event
+    static Reading difference(const Reading& end, const Reading& start);
+    static const char* eventName(Event event);
+    static const char* sourceName(Source source);
+
+private:
+    PerfCounters();
+    // Opens events as one group, the first one leading, and returns the leader's
+    // fd or -1. Members the PMU doesn't have are left out.
+    int openGroup(const std::vector<Event>& events, std::vector<Event>& opened);
+    // Adds the group's counts to reading, scaled up if the kernel had to share
+    // the PMU with other groups
+    bool readGroup(int leader, const std::vector<Event>& events, Reading& reading) const;
+
+    int hardware = -1;
+    int software = -1;
+    std::vector<Event> hardwareEvents;
+    std::vector<Event> softwareEvents;
+    std::vector<int> fds;
+    bool counted[EventCount] = {};
+};
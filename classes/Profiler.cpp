@@ -0,0 +1,292 @@
+#include "Profiler.h"
+#include "AllocationCounter.h"
+
+#include <ctime>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <set>
+
+Profiler::Scope::Scope(Profiler* profiler, Phase phase, const std::string& detail)
+    : profiler(profiler), phase(phase), detail(detail) {
+    if (profiler == nullptr) return;
+    if (profiler->counting) countersStart = PerfCounters::forThread().read();
+    wallStart = std::chrono::steady_clock::now();
+    cpuStart = threadCpuSeconds();
+    allocationsStart = allocationCount();
+    bytesStart = allocatedBytes();
+}
+
+Profiler::Scope::~Scope() {
+    if (profiler == nullptr) return;
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    double cpuSeconds = threadCpuSeconds() - cpuStart;
+    // Read before record takes the lock, the counts are the phase's own
+    if (profiler->counting) {
+        const PerfCounters& counters = PerfCounters::forThread();
+        profiler->recordCounters(phase, counters, PerfCounters::difference(counters.read(), countersStart));
+    }
+    profiler->record(phase, detail, wallStart, wallSeconds, cpuSeconds, allocationCount() - allocationsStart,
+                     allocatedBytes() - bytesStart);
+}
+
+Profiler::Profiler(bool tracing, bool counting)
+    : tracing(tracing), counting(counting), origin(std::chrono::steady_clock::now()) {
+    for (bool& event : counted) event = true;
+}
+
+const char* Profiler::phaseName(Phase phase) {
+    switch (phase) {
+        case Parse: return "parse";
+        case CallGraph: return "callgraph";
+        case LoopOpt: return "loopopt";
+        case Vectorize: return "vectorize";
+        case Fuse: return "fuse";
+        case Verify: return "verify";
+        case Print: return "print";
+        case Cache: return "cache";
+        default: return "unknown";
+    }
+}
+
+uint64_t Profiler::allocations(Phase phase) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return heapAllocations[phase];
+}
+
+double Profiler::threadCpuSeconds() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int Profiler::threadNumber() {
+    static std::atomic<int> next{1};
+    thread_local int number = next++;
+    return number;
+}
+
+void Profiler::record(Phase phase, const std::string& detail, std::chrono::steady_clock::time_point wallStart,
+                      double wallSeconds, double cpuSeconds, uint64_t allocations, uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    wall[phase] += wallSeconds;
+    cpu[phase] += cpuSeconds;
+    heapAllocations[phase] += allocations;
+    heapBytes[phase] += bytes;
+    if (tracing) {
+        double start = std::chrono::duration<double, std::micro>(wallStart - origin).count();
+        events.push_back({phase, threadNumber(), start, wallSeconds * 1e6, allocations, detail});
+    }
+}
+
+void Profiler::recordCounters(Phase phase, const PerfCounters& source, const PerfCounters::Reading& delta) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int event = 0; event < PerfCounters::EventCount; ++event) {
+        counts[phase].value[event] += delta.value[event];
+        counted[event] = counted[event] && source.counts(static_cast<PerfCounters::Event>(event));
+    }
+    counterSource = std::max(counterSource, source.source());
+    countersRecorded = true;
+}
+
+void Profiler::add(const Counters& counters) {
+    std::lock_guard<std::mutex> lock(mutex);
+    totals.files += counters.files;
+    totals.sourceBytes += counters.sourceBytes;
+    totals.tokens += counters.tokens;
+    totals.productions += counters.productions;
+    totals.symbolLookups += counters.symbolLookups;
+    totals.instructions += counters.instructions;
+    totals.bytesWritten += counters.bytesWritten;
+    totals.lexSeconds += counters.lexSeconds;
+}
+
+void Profiler::print(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    double totalWall = 0, totalCpu = 0;
+    for (int p = 0; p < PhaseCount; ++p) {
+        totalWall += wall[p];
+        totalCpu += cpu[p];
+    }
+
+    uint64_t totalAllocations = 0, totalBytes = 0;
+    for (int p = 0; p < PhaseCount; ++p) {
+        totalAllocations += heapAllocations[p];
+        totalBytes += heapBytes[p];
+    }
+
+    char line[200];
+    auto row = [&](const char* name, double w, double c, uint64_t allocations, uint64_t bytes) {
+        char cpuText[32] = "-";
+        if (c >= 0) std::snprintf(cpuText, sizeof(cpuText), "%.3f", c * 1e3);
+        int n = std::snprintf(line, sizeof(line), "[TIME] %-12s %12.3f %12s %7.1f%%", name, w * 1e3, cpuText,
+                              totalWall > 0 ? 100 * w / totalWall : 0.0);
+        if (allocationsCounted && c >= 0) {
+            std::snprintf(line + n, sizeof(line) - n, " %12llu %12.1f", static_cast<unsigned long long>(allocations),
+                          bytes / 1024.0);
+        }
+        out << line << '\n';
+    };
+
+    int n = std::snprintf(line, sizeof(line), "[TIME] %-12s %12s %12s %8s", "phase", "wall ms", "cpu ms", "share");
+    if (allocationsCounted) std::snprintf(line + n, sizeof(line) - n, " %12s %12s", "allocations", "alloc KB");
+    out << line << '\n';
+    for (int p = 0; p < PhaseCount; ++p) {
+        if (wall[p] == 0 && cpu[p] == 0) continue;
+        row(phaseName(static_cast<Phase>(p)), wall[p], cpu[p], heapAllocations[p], heapBytes[p]);
+        // Timing every token for CPU time would cost more than the lexing
+        if (p == Parse && totals.lexSeconds > 0) row("  lex", totals.lexSeconds, -1, 0, 0);
+    }
+    row("total", totalWall, totalCpu, totalAllocations, totalBytes);
+
+    out << "[TIME] " << totals.files << " files, " << totals.sourceBytes << " source bytes, " << totals.tokens
+        << " tokens, " << totals.productions << " productions, " << totals.symbolLookups << " symbol lookups, "
+        << totals.instructions << " instructions, " << totals.bytesWritten << " bytes written\n";
+    if (totals.lexSeconds > 0 && totalWall > 0) {
+        std::snprintf(line, sizeof(line), "[TIME] %.2f M tokens/s lexing, %.2f MB/s source, %.2f MB/s written\n",
+                      totals.tokens / totals.lexSeconds / 1e6, totals.sourceBytes / totalWall / 1e6,
+                      totals.bytesWritten / totalWall / 1e6);
+        out << line;
+    }
+}
+
+void Profiler::printCounters(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!countersRecorded) return;
+    out << "[PERF] counters from " << PerfCounters::sourceName(counterSource);
+    if (counterSource != PerfCounters::Source::Hardware) out << ", no PMU: cycles, instructions and misses aren't counted";
+    out << "\n";
+
+    bool ipc = counted[PerfCounters::Cycles] && counted[PerfCounters::Instructions];
+    char line[64];
+    std::snprintf(line, sizeof(line), "[PERF] %-12s", "phase");
+    out << line;
+    for (int event = 0; event < PerfCounters::EventCount; ++event) {
+        if (!counted[event]) continue;
+        std::snprintf(line, sizeof(line), " %16s", PerfCounters::eventName(static_cast<PerfCounters::Event>(event)));
+        out << line;
+    }
+    out << (ipc ? "      IPC\n" : "\n");
+
+    PerfCounters::Reading total;
+    auto row = [&](const char* name, const PerfCounters::Reading& reading) {
+        std::snprintf(line, sizeof(line), "[PERF] %-12s", name);
+        out << line;
+        for (int event = 0; event < PerfCounters::EventCount; ++event) {
+            if (!counted[event]) continue;
+            std::snprintf(line, sizeof(line), " %16llu", static_cast<unsigned long long>(reading.value[event]));
+            out << line;
+        }
+        if (ipc) {
+            uint64_t cycles = reading.value[PerfCounters::Cycles];
+            std::snprintf(line, sizeof(line), " %8.2f",
+                          cycles > 0 ? double(reading.value[PerfCounters::Instructions]) / cycles : 0.0);
+            out << line;
+        }
+        out << '\n';
+    };
+    for (int p = 0; p < PhaseCount; ++p) {
+        if (wall[p] == 0 && cpu[p] == 0) continue;
+        row(phaseName(static_cast<Phase>(p)), counts[p]);
+        for (int event = 0; event < PerfCounters::EventCount; ++event) total.value[event] += counts[p].value[event];
+    }
+    row("total", total);
+}
+
+static void writeJsonString(std::ostream& out, const std::string& text) {
+    out << '"';
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c < 0x20) {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out << escape;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+bool Profiler::writeTrace(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out) return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    std::set<int> threads;
+    for (const auto& e : events) {
+        if (!first) out << ",\n";
+        first = false;
+        threads.insert(e.thread);
+        out << "{\"name\":\"" << phaseName(e.phase) << "\",\"cat\":\"compile\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+            << e.thread << ",\"ts\":" << e.start << ",\"dur\":" << e.length << ",\"args\":{\"file\":";
+        writeJsonString(out, e.detail);
+        if (allocationsCounted) out << ",\"allocations\":" << e.allocations;
+        out << "}}";
+    }
+    for (int thread : threads) {
+        out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread
+            << ",\"args\":{\"name\":\"compile " << thread << "\"}}";
+        first = false;
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+bool Profiler::writeReport(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out) return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    out << std::fixed << std::setprecision(3);
+    out << "{\"counters\":";
+    if (countersRecorded) {
+        out << '"' << PerfCounters::sourceName(counterSource) << '"';
+    } else {
+        out << "null";
+    }
+    out << ",\"compile\":{\"files\":" << totals.files << ",\"sourceBytes\":" << totals.sourceBytes
+        << ",\"tokens\":" << totals.tokens << ",\"productions\":" << totals.productions
+        << ",\"symbolLookups\":" << totals.symbolLookups << ",\"instructions\":" << totals.instructions
+        << ",\"bytesWritten\":" << totals.bytesWritten << ",\"lexMs\":" << totals.lexSeconds * 1e3 << "},\n";
+
+    out << "\"phases\":[";
+    bool first = true;
+    auto phase = [&](const char* name, double w, double c, uint64_t allocations, const PerfCounters::Reading& reading) {
+        out << (first ? "\n" : ",\n") << "{\"name\":\"" << name << "\",\"wallMs\":" << w * 1e3 << ",\"cpuMs\":" << c * 1e3;
+        first = false;
+        if (allocationsCounted) out << ",\"allocations\":" << allocations;
+        if (countersRecorded) {
+            for (int event = 0; event < PerfCounters::EventCount; ++event) {
+                if (!counted[event]) continue;
+                out << ",\"" << PerfCounters::eventName(static_cast<PerfCounters::Event>(event)) << "\":" << reading.value[event];
+            }
+            uint64_t cycles = reading.value[PerfCounters::Cycles];
+            if (counted[PerfCounters::Cycles] && counted[PerfCounters::Instructions] && cycles > 0) {
+                out << ",\"ipc\":" << double(reading.value[PerfCounters::Instructions]) / cycles;
+            }
+        }
+        out << '}';
+    };
+    double totalWall = 0, totalCpu = 0;
+    uint64_t totalAllocations = 0;
+    PerfCounters::Reading total;
+    for (int p = 0; p < PhaseCount; ++p) {
+        if (wall[p] == 0 && cpu[p] == 0) continue;
+        phase(phaseName(static_cast<Phase>(p)), wall[p], cpu[p], heapAllocations[p], counts[p]);
+        totalWall += wall[p];
+        totalCpu += cpu[p];
+        totalAllocations += heapAllocations[p];
+        for (int event = 0; event < PerfCounters::EventCount; ++event) total.value[event] += counts[p].value[event];
+    }
+    phase("total", totalWall, totalCpu, totalAllocations, total);
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
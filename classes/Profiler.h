@@ -0,0 +1,106 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "PerfCounters.h"
+
+// Where compile time goes. The Driver wraps each phase of a compilation in a
+// Scope and adds the compilation's counters when it finishes; any number of
+// compilations on any threads can report into one Profiler. With tracing on,
+// every scope is also kept as an event for a Chrome trace_event JSON file.
+// Nothing here runs unless a Profiler was handed in, a null Scope does nothing.
+// In a build that counts allocations (AllocationCounter.h) each phase also gets
+// the number of heap allocations its scopes made. With counters on, each scope
+// reads its thread's PerfCounters at both ends and the phase gets the
+// difference. Lexing, symbol lookups and code generation all happen inside
+// Parse and share its counts, rat25sbench --counters has them one by one.
+class Profiler {
+public:
+    enum Phase { Parse, CallGraph, LoopOpt, Vectorize, Fuse, Verify, Print, Cache, PhaseCount };
+
+    struct Counters {
+        size_t files = 0;
+        size_t sourceBytes = 0;
+        size_t tokens = 0;
+        size_t productions = 0;
+        size_t symbolLookups = 0;
+        size_t instructions = 0;
+        size_t bytesWritten = 0;
+        // Time inside Lexer::getNextToken, part of Parse
+        double lexSeconds = 0;
+    };
+
+    class Scope {
+    public:
+        // detail names the file in the trace
+        Scope(Profiler* profiler, Phase phase, const std::string& detail);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        Profiler* profiler;
+        Phase phase;
+        const std::string& detail;
+        PerfCounters::Reading countersStart;
+        std::chrono::steady_clock::time_point wallStart;
+        double cpuStart = 0;
+        uint64_t allocationsStart = 0;
+        uint64_t bytesStart = 0;
+    };
+
+    explicit Profiler(bool tracing = false, bool counting = false);
+
+    void add(const Counters& counters);
+    // The --time-passes report
+    void print(std::ostream& out) const;
+    // The --perf-counters table, nothing unless counting
+    void printCounters(std::ostream& out) const;
+    // False if the file can't be written
+    bool writeTrace(const std::string& path) const;
+    // Every phase's times and counters as JSON, for tracking them from run to
+    // run. False if the file can't be written.
+    bool writeReport(const std::string& path) const;
+
+    static const char* phaseName(Phase phase);
+    // Heap allocations made inside phase so far, always 0 unless they are counted
+    uint64_t allocations(Phase phase) const;
+
+private:
+    struct Event {
+        Phase phase;
+        int thread;
+        double start;   // microseconds since the Profiler was made
+        double length;
+        uint64_t allocations;
+        std::string detail;
+    };
+
+    void record(Phase phase, const std::string& detail, std::chrono::steady_clock::time_point wallStart,
+                double wallSeconds, double cpuSeconds, uint64_t allocations, uint64_t bytes);
+    void recordCounters(Phase phase, const PerfCounters& source, const PerfCounters::Reading& counts);
+    static double threadCpuSeconds();
+    // Small per-thread number for the trace, the first thread to report is 1
+    static int threadNumber();
+
+    bool tracing;
+    bool counting;
+    std::chrono::steady_clock::time_point origin;
+
+    mutable std::mutex mutex;
+    double wall[PhaseCount] = {};
+    double cpu[PhaseCount] = {};
+    uint64_t heapAllocations[PhaseCount] = {};
+    uint64_t heapBytes[PhaseCount] = {};
+    Counters totals;
+    std::vector<Event> events;
+    PerfCounters::Reading counts[PhaseCount];
+    // Events every reporting thread counted, and the worst source among them
+    bool counted[PerfCounters::EventCount];
+    PerfCounters::Source counterSource = PerfCounters::Source::Hardware;
+    bool countersRecorded = false;
+};
@@ -0,0 +1,277 @@
+#include "ProgramGenerator.h"
+#include "OutputWriter.h"
+#include <algorithm>
+
+static const char* const words[] = {
+    "update", "the", "running", "total", "check", "bound", "scale", "counter",
+    "value", "before", "next", "step", "result", "keep", "loop", "index",
+};
+
+ProgramGenerator::ProgramGenerator(const GeneratorOptions& options)
+    : options(options), state(options.seed) {
+    // A function needs a local for its loops, and an expression one operand
+    this->options.identifiers = std::max(this->options.identifiers, 1);
+    this->options.expressionLength = std::max(this->options.expressionLength, 1);
+    this->options.depth = std::max(this->options.depth, 0);
+    this->options.functions = std::max(this->options.functions, 0);
+}
+
+// splitmix64
+uint64_t ProgramGenerator::next() {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+int ProgramGenerator::below(int n) {
+    return n <= 1 ? 0 : static_cast<int>(next() % static_cast<uint64_t>(n));
+}
+
+bool ProgramGenerator::chance(int percent) {
+    return below(100) < percent;
+}
+
+uint64_t ProgramGenerator::write(OutputWriter& writer) {
+    out = &writer;
+    state = options.seed;
+    indent = 0;
+    arity.clear();
+    size_t start = out->bytesWritten();
+
+    *out << "[* generated program, seed " << options.seed << " *]\n$$\n";
+    for (int i = 0; i < options.functions; ++i) {
+        function(i);
+    }
+
+    // Globals, declared and set in the second section
+    *out << "$$\n";
+    vars.clear();
+    for (int i = 0; i < options.identifiers; ++i) {
+        vars.push_back("g" + std::to_string(i));
+    }
+    locked.assign(vars.size(), false);
+    *out << "integer ";
+    for (size_t i = 0; i < vars.size(); ++i) {
+        *out << (i ? ", " : "") << vars[i];
+    }
+    *out << ";\n";
+    for (const auto& var : vars) {
+        *out << var << " = " << below(1000) << ";\n";
+    }
+
+    *out << "$$\n";
+    do {
+        statement(0);
+    } while (out->bytesWritten() - start < options.bytes);
+    *out << "$$\n";
+
+    out = nullptr;
+    return writer.bytesWritten() - start;
+}
+
+std::string ProgramGenerator::generate() {
+    std::string text;
+    {
+        OutputWriter writer(text);
+        write(writer);
+    }
+    return text;
+}
+
+void ProgramGenerator::function(int index) {
+    int params = std::min(below(4), options.identifiers - 1);
+    vars.clear();
+    for (int i = 0; i < params; ++i) {
+        vars.push_back("p" + std::to_string(i));
+    }
+    for (int i = params; i < options.identifiers; ++i) {
+        vars.push_back("a" + std::to_string(i - params));
+    }
+    locked.assign(vars.size(), false);
+
+    *out << "function f" << index << " (";
+    for (int i = 0; i < params; ++i) {
+        *out << (i ? ", " : "") << vars[i] << " integer";
+    }
+    *out << ")\ninteger ";
+    for (size_t i = params; i < vars.size(); ++i) {
+        *out << (i > static_cast<size_t>(params) ? ", " : "") << vars[i];
+    }
+    *out << ";\n{\n";
+
+    indent = 1;
+    for (size_t i = params; i < vars.size(); ++i) {
+        indentLine();
+        *out << vars[i] << " = " << below(1000) << ";\n";
+    }
+    for (int i = 2 + below(4); i > 0; --i) {
+        statement(0);
+    }
+    indentLine();
+    *out << "return ";
+    expression(options.expressionLength, false);
+    *out << ";\n}\n";
+    indent = 0;
+
+    // Pushed after the body, a function never calls itself
+    arity.push_back(params);
+}
+
+void ProgramGenerator::block(int depth) {
+    *out << "{\n";
+    indent++;
+    for (int i = 1 + below(3); i > 0; --i) {
+        statement(depth + 1);
+    }
+    indent--;
+    indentLine();
+    *out << "}";
+}
+
+void ProgramGenerator::statement(int depth) {
+    if (chance(options.commentPercent)) {
+        comment();
+    }
+
+    int kind = below(100);
+    if (depth < options.depth && kind < 15) {
+        indentLine();
+        *out << "if (";
+        condition();
+        *out << ") ";
+        block(depth);
+        if (chance(40)) {
+            *out << " else ";
+            block(depth);
+        }
+        *out << "\n";
+        indentLine();
+        *out << "endif\n";
+    } else if (depth < options.depth && kind < 25) {
+        loop(depth);
+    } else if (kind < 35) {
+        indentLine();
+        *out << "print(";
+        expression(options.expressionLength, false);
+        *out << ");\n";
+    } else if (kind < 42 && !arity.empty()) {
+        indentLine();
+        int callee = below(static_cast<int>(arity.size()));
+        *out << "f" << callee << "(";
+        for (int i = 0; i < arity[callee]; ++i) {
+            if (i) *out << ", ";
+            operand(true);
+        }
+        *out << ");\n";
+    } else {
+        assignment();
+    }
+}
+
+void ProgramGenerator::assignment() {
+    std::vector<size_t> free;
+    for (size_t i = 0; i < vars.size(); ++i) {
+        if (!locked[i]) free.push_back(i);
+    }
+    indentLine();
+    if (free.empty()) {
+        // Every variable drives a loop around here
+        *out << "print(";
+        expression(options.expressionLength, false);
+        *out << ");\n";
+        return;
+    }
+    *out << vars[free[below(static_cast<int>(free.size()))]] << " = ";
+    expression(options.expressionLength, false);
+    *out << ";\n";
+}
+
+void ProgramGenerator::loop(int depth) {
+    std::vector<size_t> free;
+    for (size_t i = 0; i < vars.size(); ++i) {
+        if (!locked[i]) free.push_back(i);
+    }
+    if (free.empty()) {
+        assignment();
+        return;
+    }
+    size_t counter = free[below(static_cast<int>(free.size()))];
+    const std::string& name = vars[counter];
+
+    indentLine();
+    *out << name << " = 0;\n";
+    indentLine();
+    *out << "while (" << name << " < " << 1 + below(9) << ") {\n";
+    locked[counter] = true;
+    indent++;
+    for (int i = 1 + below(3); i > 0; --i) {
+        statement(depth + 1);
+    }
+    indentLine();
+    *out << name << " = " << name << " + 1;\n";
+    indent--;
+    locked[counter] = false;
+    indentLine();
+    *out << "}\n";
+    indentLine();
+    *out << "endwhile\n";
+}
+
+void ProgramGenerator::expression(int length, bool nested) {
+    operand(nested);
+    for (int i = below(length); i > 0; --i) {
+        switch (below(4)) {
+            case 0: *out << " + "; break;
+            case 1: *out << " - "; break;
+            case 2: *out << " * "; break;
+            default:
+                // Only ever divided by a literal that isn't 0
+                *out << " / " << 1 + below(99);
+                continue;
+        }
+        operand(nested);
+    }
+}
+
+void ProgramGenerator::operand(bool nested) {
+    int kind = below(100);
+    if (kind < 30) {
+        *out << below(1000);
+    } else if (kind < 85 || nested) {
+        *out << vars[below(static_cast<int>(vars.size()))];
+    } else if (kind < 93 && !arity.empty()) {
+        int callee = below(static_cast<int>(arity.size()));
+        *out << "f" << callee << "(";
+        for (int i = 0; i < arity[callee]; ++i) {
+            if (i) *out << ", ";
+            operand(true);
+        }
+        *out << ")";
+    } else {
+        *out << "(";
+        expression(std::min(options.expressionLength, 3), true);
+        *out << ")";
+    }
+}
+
+void ProgramGenerator::condition() {
+    // No "!=", the lexer doesn't take '!' as an operator
+    static const char* const relops[] = {"==", "<", ">", "<=", ">="};
+    expression(std::min(options.expressionLength, 2), false);
+    *out << " " << relops[below(5)] << " ";
+    expression(std::min(options.expressionLength, 2), false);
+}
+
+void ProgramGenerator::comment() {
+    indentLine();
+    *out << "[*";
+    for (int i = 2 + below(6); i > 0; --i) {
+        *out << " " << words[below(sizeof(words) / sizeof(words[0]))];
+    }
+    *out << " *]\n";
+}
+
+void ProgramGenerator::indentLine() {
+    for (int i = 0; i < indent; ++i) *out << "    ";
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class OutputWriter;
+
+struct GeneratorOptions {
+    uint64_t seed = 1;
+    // Main statements are added until the program is at least this big
+    uint64_t bytes = 64 << 10;
+    int functions = 16;
+    // Deepest if/while nesting
+    int depth = 3;
+    // Most operands in one expression
+    int expressionLength = 4;
+    // Variables in each scope, parameters included
+    int identifiers = 8;
+    // Chance, in percent, of a comment before a statement
+    int commentPercent = 10;
+};
+
+// Synthetic Rat25S programs for benchmarks. The same options and seed always
+// give the same program, on any platform: the random numbers come from a fixed
+// splitmix64 stream rather than <random>'s implementation defined distributions.
+// Programs are valid and type correct: integer only, every variable is set
+// before it is read, loops count a variable nothing else assigns, and functions
+// only call the ones defined before them, so they also terminate when run.
+class ProgramGenerator {
+public:
+    explicit ProgramGenerator(const GeneratorOptions& options);
+
+    // Writes one program, returns its size in bytes
+    uint64_t write(OutputWriter& out);
+    std::string generate();
+
+private:
+    uint64_t next();
+    int below(int n);
+    bool chance(int percent);
+
+    void function(int index);
+    void block(int depth);
+    void statement(int depth);
+    void assignment();
+    void loop(int depth);
+    void expression(int length, bool nested);
+    void operand(bool nested);
+    void condition();
+    void comment();
+    void indentLine();
+
+    GeneratorOptions options;
+    uint64_t state;
+    OutputWriter* out = nullptr;
+    int indent = 0;
+
+    // Variables of the scope being written. A loop counter is locked while its
+    // loop body is written, so the body can't stop the loop from ending.
+    std::vector<std::string> vars;
+    std::vector<bool> locked;
+    // Parameter count of each function written so far, they can all be called
+    std::vector<int> arity;
+};
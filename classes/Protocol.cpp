@@ -0,0 +1,218 @@
+#include "Protocol.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+std::string defaultSocketPath() {
+    const char* path = std::getenv("RAT25S_SOCKET");
+    return path != nullptr && *path ? path : "/tmp/rat25s.sock";
+}
+
+bool isUnixEndpoint(const std::string& endpoint) {
+    return endpoint.rfind("tcp:", 0) != 0 && endpoint.rfind("fd:", 0) != 0;
+}
+
+static bool unixAddress(const std::string& path, sockaddr_un& address) {
+    address = sockaddr_un{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    std::strcpy(address.sun_path, path.c_str());
+    return true;
+}
+
+// tcp:PORT or tcp:HOST:PORT
+static bool tcpAddress(const std::string& endpoint, sockaddr_in& address) {
+    std::string rest = endpoint.substr(4);
+    std::string host = "127.0.0.1";
+    size_t colon = rest.rfind(':');
+    if (colon != std::string::npos) {
+        host = rest.substr(0, colon);
+        rest.erase(0, colon + 1);
+    }
+    char* end = nullptr;
+    unsigned long port = std::strtoul(rest.c_str(), &end, 10);
+    if (rest.empty() || *end != '\0' || port > 65535) return false;
+    address = sockaddr_in{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    return inet_pton(AF_INET, host.c_str(), &address.sin_addr) == 1;
+}
+
+void noDelay(int fd) {
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+int listenOn(const std::string& endpoint) {
+    if (endpoint.rfind("fd:", 0) == 0) {
+        return std::stoi(endpoint.substr(3));
+    }
+
+    sockaddr_un unixAddr;
+    sockaddr_in tcpAddr;
+    bool tcp = !isUnixEndpoint(endpoint);
+    if (tcp ? !tcpAddress(endpoint, tcpAddr) : !unixAddress(endpoint, unixAddr)) {
+        throw std::runtime_error("Bad endpoint: " + endpoint);
+    }
+    // Close on exec, so a worker process started later doesn't hold it open
+    int fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("Could not create socket: ") + std::strerror(errno));
+    }
+    int bound;
+    if (tcp) {
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        bound = bind(fd, reinterpret_cast<sockaddr*>(&tcpAddr), sizeof(tcpAddr));
+    } else {
+        // A socket file left behind by a server that died would make bind fail.
+        // Only a socket nobody answers on is removed: a live server keeps its
+        // socket, and anything else at the path is left for bind to fail on.
+        struct stat info;
+        if (lstat(endpoint.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+            int live = connectTo(endpoint);
+            if (live >= 0) {
+                close(live);
+                close(fd);
+                throw std::runtime_error("A server is already serving on " + endpoint);
+            }
+            unlink(endpoint.c_str());
+        }
+        bound = bind(fd, reinterpret_cast<sockaddr*>(&unixAddr), sizeof(unixAddr));
+    }
+    if (bound < 0 || listen(fd, 128) < 0) {
+        std::string reason = std::strerror(errno);
+        close(fd);
+        throw std::runtime_error("Could not listen on " + endpoint + ": " + reason);
+    }
+    return fd;
+}
+
+std::string boundEndpoint(int listener) {
+    sockaddr_storage address{};
+    socklen_t size = sizeof(address);
+    if (getsockname(listener, reinterpret_cast<sockaddr*>(&address), &size) < 0) return "";
+    if (address.ss_family == AF_UNIX) {
+        return reinterpret_cast<sockaddr_un*>(&address)->sun_path;
+    }
+    auto* inet = reinterpret_cast<sockaddr_in*>(&address);
+    char host[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &inet->sin_addr, host, sizeof(host));
+    return std::string("tcp:") + host + ":" + std::to_string(ntohs(inet->sin_port));
+}
+
+int connectTo(const std::string& endpoint) {
+    sockaddr_un unixAddr;
+    sockaddr_in tcpAddr;
+    bool tcp = !isUnixEndpoint(endpoint);
+    if (endpoint.rfind("fd:", 0) == 0 || (tcp ? !tcpAddress(endpoint, tcpAddr) : !unixAddress(endpoint, unixAddr))) {
+        return -1;
+    }
+    int fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int connected = tcp ? connect(fd, reinterpret_cast<sockaddr*>(&tcpAddr), sizeof(tcpAddr))
+                        : connect(fd, reinterpret_cast<sockaddr*>(&unixAddr), sizeof(unixAddr));
+    if (connected < 0) {
+        close(fd);
+        return -1;
+    }
+    if (tcp) noDelay(fd);
+    return fd;
+}
+
+static void putU32(char* out, uint32_t value) {
+    for (int i = 3; i >= 0; --i) {
+        out[i] = static_cast<char>(value & 0xff);
+        value >>= 8;
+    }
+}
+
+static uint32_t getU32(const char* in) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) value = (value << 8) | static_cast<unsigned char>(in[i]);
+    return value;
+}
+
+static bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        // A client that went away must not take the server down with SIGPIPE
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool readAll(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = read(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool writeFrame(int fd, char type, std::string_view payload) {
+    if (payload.size() > maxFramePayload) return false;
+    char header[5];
+    header[0] = type;
+    putU32(header + 1, payload.size());
+    // Small frames go out in one send, so a request costs a single round trip
+    if (payload.size() <= 4096) {
+        char frame[5 + 4096];
+        std::copy(header, header + 5, frame);
+        std::copy(payload.begin(), payload.end(), frame + 5);
+        return writeAll(fd, frame, 5 + payload.size());
+    }
+    return writeAll(fd, header, 5) && writeAll(fd, payload.data(), payload.size());
+}
+
+bool readFrame(int fd, Frame& frame) {
+    char header[5];
+    if (!readAll(fd, header, 5)) return false;
+    uint32_t size = getU32(header + 1);
+    if (size > maxFramePayload) return false;
+    frame.type = header[0];
+    frame.payload.resize(size);
+    return readAll(fd, frame.payload.data(), size);
+}
+
+std::string encodeOptions(const RequestOptions& options) {
+    std::string out(5, '\0');
+    out[0] = static_cast<char>(options.flags);
+    putU32(out.data() + 1, options.window);
+    return out;
+}
+
+bool decodeOptions(std::string_view& payload, RequestOptions& options) {
+    if (payload.size() < 5) return false;
+    options.flags = static_cast<uint8_t>(payload[0]);
+    options.window = getU32(payload.data() + 1);
+    payload.remove_prefix(5);
+    return true;
+}
+
+std::string encodeCount(uint32_t value) {
+    std::string out(4, '\0');
+    putU32(out.data(), value);
+    return out;
+}
+
+uint32_t decodeCount(std::string_view payload) {
+    return payload.size() == 4 ? getU32(payload.data()) : 0;
+}
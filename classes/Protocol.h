@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Framing for the compile server's socket. Every message, either way, is a
+// frame: a type byte, the payload length as 4 bytes big-endian, the payload.
+//
+// Requests
+//   'P'  compile a file the server reads itself, payload: options + path
+//   'S'  compile source sent along, payload: options + source text
+//   'Q'  stop the server, no payload
+// options is a flag byte (the ...Flag constants) then the stream window, 4 bytes.
+//
+// Replies to 'P' and 'S', in this order
+//   'T'  trace text, only when asked for     'D'  diagnostics (syntax errors)
+//   'O'  the listing, in one or more chunks  'I'  instructions made, 4 bytes
+//   'R'  status byte, 0 for success, then the error message
+// A client skips reply types it doesn't know.
+struct Frame {
+    char type = 0;
+    std::string payload;
+};
+
+struct RequestOptions {
+    static constexpr uint8_t streamFlag = 1;
+    static constexpr uint8_t traceFlag = 2;
+    static constexpr uint8_t lazyFlag = 4;
+    static constexpr uint8_t strictFlag = 8;
+    static constexpr uint8_t syntaxOnlyFlag = 16;
+    static constexpr uint8_t symbolsOnlyFlag = 32;
+    static constexpr uint8_t moduleFlag = 64;
+    static constexpr uint8_t fuseFlag = 128;
+
+    uint8_t flags = 0;
+    uint32_t window = 0;
+};
+
+// Longest payload either side accepts
+constexpr uint32_t maxFramePayload = 1u << 30;
+
+// $RAT25S_SOCKET, or /tmp/rat25s.sock
+std::string defaultSocketPath();
+
+// Where a server listens: a Unix socket path, tcp:PORT or tcp:HOST:PORT (an
+// IPv4 address, 127.0.0.1 when left out), or fd:N for a listening socket the
+// process was started with. Throws when the socket can't be set up. A socket
+// file a dead server left at the path is replaced, one a live server answers
+// on, or anything that isn't a socket, is not.
+int listenOn(const std::string& endpoint);
+// The endpoint a listener is bound to, with the port filled in for tcp:0
+std::string boundEndpoint(int listener);
+// -1 when nothing is listening there
+int connectTo(const std::string& endpoint);
+// Sends small frames at once rather than waiting to fill a TCP segment, a
+// request and its reply are a few small frames each. Harmless on a Unix socket.
+void noDelay(int fd);
+// True for a path, the only kind that leaves a file behind
+bool isUnixEndpoint(const std::string& endpoint);
+
+// Both retry on EINTR and short transfers, false once the connection is gone
+bool writeFrame(int fd, char type, std::string_view payload);
+bool readFrame(int fd, Frame& frame);
+
+std::string encodeOptions(const RequestOptions& options);
+// Takes the options off the front of a request payload, false if it is too short
+bool decodeOptions(std::string_view& payload, RequestOptions& options);
+
+// The 4-byte big-endian numbers of 'I' replies
+std::string encodeCount(uint32_t value);
+uint32_t decodeCount(std::string_view payload);
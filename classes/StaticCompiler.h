@@ -0,0 +1,957 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "CodeGen.h"
+#include "Lexer.h"
+#include "SymbolTable.h"
+
+// Compiles a Rat25S program while the C++ around it is compiled, for the small
+// fixed programs a service embeds as string literals. Nothing is lexed or parsed
+// at run time, the program is already data:
+//
+//     static constexpr std::string_view source = "$$ $$ integer x; $$ x = 1 + 2; print(x); $$";
+//     constexpr auto program = RAT25S_STATIC_COMPILE(source);
+//
+// The code is what the Parser emits for the source, before the passes, as a
+// std::array of StaticInstruction, with the global symbols, the functions and
+// the constant pool next to it. A program the Parser rejects fails the build:
+// the compiler's error is a call to StaticParser::fail or typeFail, and the
+// notes under it ("in 'constexpr' expansion of ...") carry the Parser's
+// message, less the names and types the Parser fills in. Called at run time
+// they throw instead.
+//
+// Needs nothing past C++17. The lexing is Lexer's state machine redone over the
+// string_view, and names and constants stay views into the source, which has
+// to outlive the program (a string literal always does).
+
+enum class StaticOp : uint8_t {
+    PUSHI, PUSHF, PUSHM, POPM, PUSHMX, POPMX, PUSH, POP, IN, OUT,
+    ADDI, SUBI, MULI, DIVI, NEGI, ADDF, SUBF, MULF, DIVF, NEGF,
+    JUMP, JEQ, JNE, JGT, JLT, JGE, JLE, JEQF, JNEF, JGTF, JLTF, JGEF, JLEF,
+    LABEL, CALL, RET,
+};
+
+constexpr std::string_view staticOpName(StaticOp op) {
+    switch (op) {
+        case StaticOp::PUSHI: return "PUSHI";
+        case StaticOp::PUSHF: return "PUSHF";
+        case StaticOp::PUSHM: return "PUSHM";
+        case StaticOp::POPM: return "POPM";
+        case StaticOp::PUSHMX: return "PUSHMX";
+        case StaticOp::POPMX: return "POPMX";
+        case StaticOp::PUSH: return "PUSH";
+        case StaticOp::POP: return "POP";
+        case StaticOp::IN: return "IN";
+        case StaticOp::OUT: return "OUT";
+        case StaticOp::ADDI: return "ADDI";
+        case StaticOp::SUBI: return "SUBI";
+        case StaticOp::MULI: return "MULI";
+        case StaticOp::DIVI: return "DIVI";
+        case StaticOp::NEGI: return "NEGI";
+        case StaticOp::ADDF: return "ADDF";
+        case StaticOp::SUBF: return "SUBF";
+        case StaticOp::MULF: return "MULF";
+        case StaticOp::DIVF: return "DIVF";
+        case StaticOp::NEGF: return "NEGF";
+        case StaticOp::JUMP: return "JUMP";
+        case StaticOp::JEQ: return "JEQ";
+        case StaticOp::JNE: return "JNE";
+        case StaticOp::JGT: return "JGT";
+        case StaticOp::JLT: return "JLT";
+        case StaticOp::JGE: return "JGE";
+        case StaticOp::JLE: return "JLE";
+        case StaticOp::JEQF: return "JEQF";
+        case StaticOp::JNEF: return "JNEF";
+        case StaticOp::JGTF: return "JGTF";
+        case StaticOp::JLTF: return "JLTF";
+        case StaticOp::JGEF: return "JGEF";
+        case StaticOp::JLEF: return "JLEF";
+        case StaticOp::LABEL: return "LABEL";
+        case StaticOp::CALL: return "CALL";
+        case StaticOp::RET: return "RET";
+    }
+    return "";
+}
+
+constexpr bool isStaticJump(StaticOp op) {
+    return op >= StaticOp::JUMP && op <= StaticOp::JLEF;
+}
+
+// The operand is the value for PUSHI, the memory address for PUSHM and POPM
+// (the array's for PUSHMX and POPMX),
+// the constant pool index for PUSHF, the target address for jumps (0 while it
+// isn't known) and the function's index for LABEL and CALL. PUSH and POP always
+// move R1. The listing's text comes back with StaticProgram::instructions().
+struct StaticInstruction {
+    StaticOp op;
+    int32_t operand;
+};
+
+struct StaticSymbol {
+    std::string_view name;
+    ValueType type;
+    int address;
+    // Elements of an array, 0 for a scalar
+    int length;
+};
+
+// Code is [entry, end) like FunctionInfo
+struct StaticFunction {
+    std::string_view name;
+    int entry;
+    int end;
+    int params;
+    ValueType returnType;
+};
+
+struct StaticSizes {
+    size_t code;
+    size_t symbols;
+    size_t functions;
+    size_t constants;
+};
+
+// BasicParser's grammar, checks and code, written to run in a constant
+// expression: fixed arrays instead of containers, names as views, and no
+// exceptions thrown while compiling at compile time. It also rejects a function
+// defined twice, which the Parser lets through, since a CALL can't say which
+// one it means.
+class StaticParser {
+public:
+    // What one program may use, past these it fails to compile
+    static constexpr size_t maxCode = 2048;
+    static constexpr size_t maxCapture = 256;
+    static constexpr size_t maxSymbols = 256;
+    static constexpr size_t maxFunctions = 64;
+    static constexpr size_t maxParams = 16;
+    static constexpr size_t maxConstants = 64;
+
+    constexpr explicit StaticParser(std::string_view source) : source(source) { current = scan(pos); }
+
+    constexpr void parse() { parseRat25s(); }
+
+    constexpr StaticSizes sizes() const { return {codeSize, symbolCount, functionCount, constantCount}; }
+    constexpr const StaticInstruction& instruction(size_t i) const { return code[i]; }
+    constexpr const StaticSymbol& symbol(size_t i) const { return symbols[i]; }
+    constexpr StaticFunction function(size_t i) const {
+        const Signature& fn = signatures[i];
+        return {fn.name, fn.entry, fn.end, static_cast<int>(fn.paramCount), fn.returnType};
+    }
+    constexpr std::string_view constant(size_t i) const { return constants[i]; }
+
+    // Never constexpr, so reaching one in a constant expression is the build
+    // error. At run time they throw what the Parser and SymbolTable would.
+    [[noreturn]] void fail(const char* message) const {
+        throw std::runtime_error("Syntax error: " + std::string(message));
+    }
+    // A rule on names or types broken
+    [[noreturn]] void typeFail(const char* message) const {
+        throw std::runtime_error("Type error: " + std::string(message));
+    }
+    [[noreturn]] void undeclared(std::string_view name) const {
+        throw std::runtime_error("Type error: Variable " + std::string(name) + " not found in any scope");
+    }
+
+private:
+    struct Signature {
+        std::string_view name;
+        std::array<ValueType, maxParams> params{};
+        size_t paramCount = 0;
+        ValueType returnType = ValueType::Integer;
+        bool returnTypeKnown = false;
+        int entry = 0;
+        int end = 0;
+        // Called before its definition: the calls so far set params, took the
+        // result to be an integer when they used it
+        bool defined = true;
+        bool resultUsed = false;
+    };
+
+    struct Condition {
+        std::string_view relop;
+        ValueType type;
+    };
+
+    std::string_view source;
+    size_t pos = 0;
+    Token current{};
+
+    std::array<StaticInstruction, maxCode> code{};
+    size_t codeSize = 0;
+    // A while test, held back until its loop body is emitted
+    std::array<StaticInstruction, maxCapture> captured{};
+    size_t capturedSize = 0;
+    bool capturing = false;
+    bool emittedAny = false;
+    StaticOp lastOp = StaticOp::RET;
+    int furthestTarget = 0;
+
+    // Symbols in scope, the function's after the globals. A function's scope
+    // is the only one there is besides the global one.
+    std::array<StaticSymbol, maxSymbols> symbols{};
+    size_t symbolCount = 0;
+    size_t scopeStart = 0;
+    int nextAddress = SymbolTable::firstAddress;
+
+    std::array<Signature, maxFunctions> signatures{};
+    size_t functionCount = 0;
+    // Index of the function whose body is being parsed, -1 at the top level
+    int currentFunction = -1;
+
+    std::array<std::string_view, maxConstants> constants{};
+    size_t constantCount = 0;
+
+    // Lexer
+    static constexpr bool isSpace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+    static constexpr bool isDigit(char c) { return c >= '0' && c <= '9'; }
+    static constexpr bool isAlpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+    static constexpr bool isOperator(char c) {
+        return c == '<' || c == '>' || c == '=' || c == '+' || c == '-' || c == '*' || c == '/';
+    }
+    static constexpr bool isSeparator(char c) {
+        return c == '(' || c == ')' || c == '{' || c == '}' || c == '[' || c == ']' || c == ';' || c == ',' ||
+               c == '$';
+    }
+    static constexpr bool isKeyword(std::string_view word) {
+        constexpr std::string_view keywords[] = {"function", "integer", "boolean", "real", "if",
+                                                 "else", "endif", "while", "endwhile", "return",
+                                                 "scan", "print", "true", "false"};
+        for (std::string_view keyword : keywords) {
+            if (word == keyword) return true;
+        }
+        return false;
+    }
+
+    constexpr char charAt(size_t i) const { return i < source.size() ? source[i] : '\0'; }
+
+    // [start, end) without trailing whitespace, as Lexer::getCurrentLexeme
+    constexpr std::string_view lexeme(size_t start, size_t end) const {
+        if (end > source.size()) end = source.size();
+        while (end > start && isSpace(source[end - 1])) end--;
+        return source.substr(start, end - start);
+    }
+
+    // The next token from at, moving at past it. Lexer's states in one loop,
+    // an operator takes the character after it too unless that is a space.
+    constexpr Token scan(size_t& at) const {
+        for (;;) {
+            while (isSpace(charAt(at))) at++;
+            size_t start = at;
+            char c = charAt(at);
+            if (c == '\0') return {std::string_view{}, TokenType::END};
+            if (isAlpha(c) || c == '_') {
+                while (isAlpha(charAt(at)) || isDigit(charAt(at)) || charAt(at) == '_') at++;
+                std::string_view word = lexeme(start, at);
+                return {word, isKeyword(word) ? TokenType::KEYW : TokenType::IDENT};
+            }
+            if (c == '[' && charAt(at + 1) == '*') {
+                at += 2;
+                while (!(charAt(at) == '*' && charAt(at + 1) == ']')) {
+                    if (charAt(at) == '\0') return {lexeme(start, at), TokenType::UNKW};
+                    at++;
+                }
+                at += 2;
+                continue;
+            }
+            if (isDigit(c)) {
+                while (isDigit(charAt(at))) at++;
+                if (charAt(at) != '.' || !isDigit(charAt(at + 1))) return {lexeme(start, at), TokenType::INT};
+                at++;
+                while (isDigit(charAt(at))) at++;
+                return {lexeme(start, at), TokenType::REAL};
+            }
+            if (isOperator(c)) {
+                at++;
+                char next = charAt(at);
+                char after = charAt(at + 1);
+                if ((next == '=' || next == '<' || next == '>' || next == '!') && after == '=') {
+                    at += 2;
+                } else if (next == '/' && after == '/') {
+                    at += 2;
+                } else {
+                    at++;
+                }
+                return {lexeme(start, at), TokenType::OPER};
+            }
+            if (isSeparator(c)) {
+                at += c == '$' && charAt(at + 1) == '$' ? 2 : 1;
+                return {lexeme(start, at), TokenType::SEPA};
+            }
+            at++;
+            return {lexeme(start, at), TokenType::UNKW};
+        }
+    }
+
+    constexpr void advanceToken() {
+        if (current.type != TokenType::END) current = scan(pos);
+    }
+    constexpr Token peekToken() const {
+        size_t at = pos;
+        return scan(at);
+    }
+    constexpr bool isSeparatorToken(std::string_view lexeme) const {
+        return current.type == TokenType::SEPA && current.lexeme == lexeme;
+    }
+    constexpr bool isKeywordToken(std::string_view lexeme) const {
+        return current.type == TokenType::KEYW && current.lexeme == lexeme;
+    }
+    constexpr bool isQualifierToken() const {
+        return isKeywordToken("integer") || isKeywordToken("boolean") || isKeywordToken("real");
+    }
+    constexpr void expectSeparator(std::string_view lexeme, const char* message) {
+        if (!isSeparatorToken(lexeme)) fail(message);
+        advanceToken();
+    }
+
+    // CodeGen
+    constexpr int emit(StaticOp op, int operand = 0) {
+        if (capturing) {
+            if (capturedSize == maxCapture) fail("Loop condition too long to compile statically");
+            captured[capturedSize++] = {op, operand};
+            return 0;
+        }
+        if (codeSize == maxCode) fail("Program too long to compile statically");
+        code[codeSize++] = {op, operand};
+        emittedAny = true;
+        lastOp = op;
+        if (isStaticJump(op) && operand > furthestTarget) furthestTarget = operand;
+        return static_cast<int>(codeSize);
+    }
+    constexpr int nextCodeAddress() const { return static_cast<int>(codeSize) + 1; }
+    constexpr void backpatch(int address, int target) {
+        if (address <= 0 || address >= nextCodeAddress()) return;
+        if (target > furthestTarget) furthestTarget = target;
+        code[address - 1].operand = target;
+    }
+    constexpr int addConstant(std::string_view literal) {
+        for (size_t i = 0; i < constantCount; ++i) {
+            if (constants[i] == literal) return static_cast<int>(i);
+        }
+        if (constantCount == maxConstants) fail("Too many real constants to compile statically");
+        constants[constantCount] = literal;
+        return static_cast<int>(constantCount++);
+    }
+
+    // SymbolTable
+    constexpr void enterScope() { scopeStart = symbolCount; }
+    constexpr void exitScope() {
+        symbolCount = scopeStart;
+        scopeStart = 0;
+    }
+    constexpr bool declare(std::string_view name, ValueType type, int length = 0) {
+        for (size_t i = scopeStart; i < symbolCount; ++i) {
+            if (symbols[i].name == name) return false;
+        }
+        if (symbolCount == maxSymbols) fail("Too many variables to compile statically");
+        symbols[symbolCount++] = {name, type, nextAddress, length};
+        nextAddress += length > 0 ? length : 1;
+        return true;
+    }
+    // Innermost first
+    constexpr const StaticSymbol& lookup(std::string_view name) const {
+        for (size_t i = symbolCount; i > 0; --i) {
+            if (symbols[i - 1].name == name) return symbols[i - 1];
+        }
+        undeclared(name);
+    }
+    constexpr int findFunction(std::string_view name) const {
+        for (size_t i = 0; i < functionCount; ++i) {
+            if (signatures[i].name == name) return static_cast<int>(i);
+        }
+        return -1;
+    }
+
+    // R1. <Rat25S> ::= $$ <Program> $$, then any further sections each ending with $$
+    constexpr void parseRat25s() {
+        if (!isSeparatorToken("$$")) fail("Expected $$ at start of Rat25s");
+        advanceToken();
+        parseProgram();
+        expectSeparator("$$", "Expected $$ at end of Rat25s");
+        while (current.type != TokenType::END) {
+            parseProgram();
+            expectSeparator("$$", "Expected $$ at end of section");
+        }
+        for (size_t i = 0; i < functionCount; ++i) {
+            if (!signatures[i].defined) typeFail("Undeclared function");
+        }
+    }
+
+    constexpr void parseProgram() {
+        while (!isSeparatorToken("$$")) {
+            if (current.type == TokenType::END) {
+                fail("Unexpected end of file before closing $$");
+            } else if (current.type == TokenType::KEYW) {
+                if (current.lexeme == "function") {
+                    parseFunction();
+                } else if (isQualifierToken()) {
+                    parseDeclaration();
+                    expectSeparator(";", "Expected ';' after declaration");
+                } else {
+                    parseStatement();
+                }
+            } else if (current.type == TokenType::IDENT) {
+                parseStatement();
+            } else {
+                fail("Unexpected token in program");
+            }
+        }
+    }
+
+    // R4. <Function> ::= function <Identifier> ( <Opt Parameter List> ) <Opt Declaration List> <Body>
+    constexpr void parseFunction() {
+        advanceToken();
+        if (current.type != TokenType::IDENT) fail("Expected function identifier");
+        std::string_view name = current.lexeme;
+        // A function called before now already has its slot
+        int index = findFunction(name);
+        if (index >= 0 && signatures[index].defined) typeFail("Function already defined");
+        bool called = index >= 0;
+        if (!called && functionCount == maxFunctions) fail("Too many functions to compile statically");
+        advanceToken();
+        if (!called) index = static_cast<int>(functionCount);
+        int entry = emit(StaticOp::LABEL, index);
+        enterScope();
+
+        expectSeparator("(", "Expected '(' after function identifier");
+        int firstParam = nextAddress;
+        Signature signature{name};
+        if (current.type == TokenType::IDENT) {
+            parseParameter(signature);
+            while (isSeparatorToken(",")) {
+                advanceToken();
+                parseParameter(signature);
+            }
+        }
+        int paramCount = nextAddress - firstParam;
+        // Known before the body so recursive calls can be checked
+        if (called) {
+            const Signature& calls = signatures[index];
+            bool same = calls.paramCount == signature.paramCount;
+            for (size_t i = 0; same && i < signature.paramCount; ++i) same = calls.params[i] == signature.params[i];
+            if (!same) typeFail("Function is defined with other parameters than it is called with");
+            signature.resultUsed = calls.resultUsed;
+            signatures[index] = signature;
+        } else {
+            signatures[functionCount++] = signature;
+        }
+        currentFunction = index;
+
+        // Arguments were pushed left to right, so the last parameter is on top
+        for (int address = firstParam + paramCount - 1; address >= firstParam; --address) {
+            emit(StaticOp::POPM, address);
+        }
+        expectSeparator(")", "Expected ')' after parameter list");
+        while (isQualifierToken()) {
+            parseDeclaration();
+            expectSeparator(";", "Expected ';' after declaration");
+        }
+        expectSeparator("{", "Expected '{' at the beginning of function body");
+        parseStatementList();
+        expectSeparator("}", "Expected '}' at the end of function body");
+
+        if (!emittedAny || lastOp != StaticOp::RET || furthestTarget >= nextCodeAddress()) {
+            emit(StaticOp::RET);
+        }
+        signatures[index].entry = entry;
+        signatures[index].end = nextCodeAddress();
+        if (signatures[index].resultUsed && signatures[index].returnType != ValueType::Integer) {
+            typeFail("function returns another type than a call before it used");
+        }
+        currentFunction = -1;
+        exitScope();
+    }
+
+    // R7. <Parameter> ::= <IDs> <Qualifier>
+    constexpr void parseParameter(Signature& signature) {
+        std::array<std::string_view, maxParams> names{};
+        size_t count = parseIDs(names);
+        ValueType type = parseQualifier();
+        for (size_t i = 0; i < count; ++i) {
+            if (!declare(names[i], type)) typeFail("Identifier already declared");
+            if (signature.paramCount == maxParams) fail("Too many parameters to compile statically");
+            signature.params[signature.paramCount++] = type;
+        }
+    }
+
+    // R8. <Qualifier> ::= integer | boolean | real
+    constexpr ValueType parseQualifier() {
+        if (!isQualifierToken()) fail("Expected type qualifier (integer, boolean, real)");
+        ValueType type = current.lexeme == "integer" ? ValueType::Integer
+                       : current.lexeme == "real"    ? ValueType::Real
+                                                     : ValueType::Boolean;
+        advanceToken();
+        return type;
+    }
+
+    // R12. <Declaration> ::= <Qualifier> <IDs>, with array lengths
+    constexpr void parseDeclaration() {
+        ValueType type = parseQualifier();
+        std::array<std::string_view, maxSymbols> names{};
+        std::array<int, maxSymbols> lengths{};
+        size_t count = parseIDs(names, &lengths);
+        for (size_t i = 0; i < count; ++i) {
+            if (!declare(names[i], type, lengths[i])) typeFail("Identifier already declared");
+        }
+    }
+
+    // R13. <IDs> ::= <Identifier> | <Identifier>, <IDs>
+    template <size_t N>
+    constexpr size_t parseIDs(std::array<std::string_view, N>& names, std::array<int, N>* lengths = nullptr) {
+        if (current.type != TokenType::IDENT) fail("Expected an Identifier");
+        size_t count = 0;
+        for (;;) {
+            if (count == N) fail("Too many names in one list to compile statically");
+            names[count] = current.lexeme;
+            advanceToken();
+            if (lengths != nullptr) (*lengths)[count] = parseArrayLength();
+            count++;
+            if (!isSeparatorToken(",")) return count;
+            advanceToken();
+            if (current.type != TokenType::IDENT) fail("Expected an identifier after ',' in ID list");
+        }
+    }
+
+    // [ <Integer> ] after a declared identifier, 0 when there is none
+    constexpr int parseArrayLength() {
+        if (!isSeparatorToken("[")) return 0;
+        advanceToken();
+        int length = current.type == TokenType::INT && current.lexeme.size() <= 9 ? integerValue() : 0;
+        if (length == 0) fail("Expected a positive integer array length");
+        advanceToken();
+        expectSeparator("]", "Expected ']' after array length");
+        return length;
+    }
+
+    // <Index> ::= [ <Expression> ], a literal index is checked against the length
+    constexpr void parseIndex(const StaticSymbol& array) {
+        advanceToken();
+        if (current.type == TokenType::INT) {
+            Token next = peekToken();
+            if (next.type == TokenType::SEPA && next.lexeme == "]" &&
+                (current.lexeme.size() > 9 || integerValue() >= array.length)) {
+                typeFail("Array index is out of bounds");
+            }
+        }
+        if (parseExpression() != ValueType::Integer) typeFail("Array index must be an integer");
+        expectSeparator("]", "Expected ']' after array index");
+    }
+
+    constexpr void checkIndexed(const StaticSymbol& symbol, bool indexed) const {
+        if (indexed && symbol.length == 0) typeFail("Indexed variable is not an array");
+        if (!indexed && symbol.length > 0) typeFail("Array needs an index");
+    }
+
+    // The current INT token's value
+    constexpr int integerValue() const {
+        int64_t value = 0;
+        for (char digit : current.lexeme) {
+            value = value * 10 + (digit - '0');
+            if (value > INT32_MAX) fail("Integer too large to compile statically");
+        }
+        return static_cast<int>(value);
+    }
+
+    // R14. <Statement List> ::= <Statement> | <Statement> <Statement List>
+    constexpr void parseStatementList() {
+        parseStatement();
+        while (current.type != TokenType::END && !isSeparatorToken("}")) {
+            parseStatement();
+        }
+    }
+
+    // R15. <Statement> ::= <Compound> | <Assign> | <If> | <Return> | <Print> | <Scan> | <While> | <Declaration>
+    constexpr void parseStatement() {
+        if (isSeparatorToken("{")) {
+            advanceToken();
+            parseStatementList();
+            expectSeparator("}", "Expected '}' at the end of compound statement");
+        } else if (current.type == TokenType::IDENT) {
+            Token next = peekToken();
+            if (next.type == TokenType::SEPA && next.lexeme == "(") {
+                parseCallStatement();
+            } else {
+                parseAssign();
+            }
+        } else if (current.type == TokenType::KEYW) {
+            if (current.lexeme == "if") {
+                parseIf();
+            } else if (current.lexeme == "return") {
+                parseReturn();
+            } else if (current.lexeme == "print") {
+                parsePrint();
+            } else if (current.lexeme == "scan") {
+                parseScan();
+            } else if (current.lexeme == "while") {
+                parseWhile();
+            } else if (isQualifierToken()) {
+                parseDeclaration();
+                expectSeparator(";", "Expected ';' after declaration");
+            } else {
+                fail("Unexpected keyword in statement");
+            }
+        } else {
+            fail("Invalid statement");
+        }
+    }
+
+    // R17. <Assign> ::= <Identifier> = <Expression> ; | <Identifier> <Index> = <Expression> ;
+    constexpr void parseAssign() {
+        std::string_view target = current.lexeme;
+        advanceToken();
+        // An element's index goes on the stack under the value
+        bool element = isSeparatorToken("[");
+        if (element) {
+            checkIndexed(lookup(target), true);
+            parseIndex(lookup(target));
+        }
+        if (current.type != TokenType::OPER || current.lexeme != "=") {
+            fail("Expected an '=' in the assignment statement");
+        }
+        advanceToken();
+        ValueType valueType = parseExpression();
+        const StaticSymbol& symbol = lookup(target);
+        checkIndexed(symbol, element);
+        if (valueType != symbol.type) typeFail("cannot assign a value of another type");
+        emit(element ? StaticOp::POPMX : StaticOp::POPM, symbol.address);
+        expectSeparator(";", "Expected ';' after assignment");
+    }
+
+    // <Identifier> ( <Arguments> ) ; with the result left in R1
+    constexpr void parseCallStatement() {
+        std::string_view callee = current.lexeme;
+        advanceToken();
+        parseCall(callee, false);
+        expectSeparator(";", "Expected ';' after function call");
+    }
+
+    // ( <Expression> {, <Expression>} ) pushed left to right, returns the type in R1.
+    // A function defined further down gets its slot from the first call.
+    constexpr ValueType parseCall(std::string_view callee, bool resultUsed = true) {
+        int index = findFunction(callee);
+
+        std::array<ValueType, maxParams> args{};
+        size_t count = 0;
+        expectSeparator("(", "Expected '(' after function name");
+        if (!isSeparatorToken(")")) {
+            for (;;) {
+                ValueType type = parseExpression();
+                if (count < maxParams) args[count] = type;
+                count++;
+                if (!isSeparatorToken(",")) break;
+                advanceToken();
+            }
+        }
+        expectSeparator(")", "Expected ')' after function arguments");
+        if (index < 0) {
+            if (count > maxParams) fail("Too many parameters to compile statically");
+            if (functionCount == maxFunctions) fail("Too many functions to compile statically");
+            index = static_cast<int>(functionCount);
+            Signature& called = signatures[functionCount++];
+            called = Signature{callee};
+            called.defined = false;
+            for (size_t i = 0; i < count; ++i) called.params[i] = args[i];
+            called.paramCount = count;
+        }
+        emit(StaticOp::CALL, index);
+
+        Signature& fn = signatures[index];
+        if (!fn.defined) {
+            // Only the calls can be checked until the definition comes
+            fn.resultUsed = fn.resultUsed || resultUsed;
+            if (count != fn.paramCount) typeFail("Calls to a function pass different arguments");
+            for (size_t i = 0; i < count; ++i) {
+                if (args[i] != fn.params[i]) typeFail("Calls to a function pass different arguments");
+            }
+            return ValueType::Integer;
+        }
+        if (count != fn.paramCount) typeFail("Wrong number of arguments in call");
+        for (size_t i = 0; i < count; ++i) {
+            if (args[i] != fn.params[i]) typeFail("argument of the wrong type in call");
+        }
+        // A recursive call can come before the first return, assume integer until one shows up
+        fn.returnTypeKnown = true;
+        return fn.returnType;
+    }
+
+    // R18. <If> ::= if ( <Condition> ) <Statement> [else <Statement>] endif
+    constexpr void parseIf() {
+        advanceToken();
+        expectSeparator("(", "Expected '(' after 'if'");
+        // Jump away when the condition fails so the then branch is the fall-through
+        Condition condition = parseCondition();
+        int falseJump = emit(branchOp(condition, true));
+        expectSeparator(")", "Expected ')' after condition in if statement");
+        parseStatement();
+        if (isKeywordToken("else")) {
+            advanceToken();
+            int endJump = emit(StaticOp::JUMP);
+            backpatch(falseJump, nextCodeAddress());
+            parseStatement();
+            backpatch(endJump, nextCodeAddress());
+        } else {
+            backpatch(falseJump, nextCodeAddress());
+        }
+        if (!isKeywordToken("endif")) fail("Expected 'endif' at end of if statement");
+        advanceToken();
+    }
+
+    // R19. <Return> ::= return ; | return <Expression> ;
+    constexpr void parseReturn() {
+        advanceToken();
+        if (isSeparatorToken(";")) {
+            advanceToken();
+            emit(StaticOp::RET);
+            return;
+        }
+        ValueType type = parseExpression();
+        if (currentFunction >= 0) {
+            Signature& fn = signatures[currentFunction];
+            if (fn.returnTypeKnown && fn.returnType != type) typeFail("function returns another type");
+            fn.returnType = type;
+            fn.returnTypeKnown = true;
+        }
+        emit(StaticOp::POP);
+        emit(StaticOp::RET);
+        expectSeparator(";", "Expected ';' after return expression");
+    }
+
+    // R20. <Print> ::= print ( <Expression> );
+    constexpr void parsePrint() {
+        advanceToken();
+        expectSeparator("(", "Expected '(' after 'print'");
+        parseExpression();
+        emit(StaticOp::OUT);
+        expectSeparator(")", "Expected ')' after expression in print statement");
+        expectSeparator(";", "Expected ';' after print statement");
+    }
+
+    // R21. <Scan> ::= scan ( <IDs> );
+    constexpr void parseScan() {
+        advanceToken();
+        expectSeparator("(", "Expected '(' after 'scan'");
+        std::array<std::string_view, maxSymbols> names{};
+        size_t count = parseIDs(names);
+        for (size_t i = 0; i < count; ++i) {
+            checkIndexed(lookup(names[i]), false);
+            emit(StaticOp::IN);
+            emit(StaticOp::POPM, lookup(names[i]).address);
+        }
+        expectSeparator(")", "Expected ')' after IDs in scan statement");
+        expectSeparator(";", "Expected ';' after scan statement");
+    }
+
+    // R22. <While> ::= while ( <Condition> ) <Statement> endwhile [;]
+    // The test goes at the bottom of the loop, its code is held back until the
+    // body is emitted
+    constexpr void parseWhile() {
+        advanceToken();
+        expectSeparator("(", "Expected '(' after 'while'");
+        capturing = true;
+        capturedSize = 0;
+        Condition condition = parseCondition();
+        capturing = false;
+        std::array<StaticInstruction, maxCapture> test = captured;
+        size_t testSize = capturedSize;
+        int entryJump = emit(StaticOp::JUMP);
+        int bodyStart = nextCodeAddress();
+        expectSeparator(")", "Expected ')' after condition in while loop");
+        parseStatement();
+        backpatch(entryJump, nextCodeAddress());
+        for (size_t i = 0; i < testSize; ++i) emit(test[i].op, test[i].operand);
+        emit(branchOp(condition, false), bodyStart);
+        if (!isKeywordToken("endwhile")) fail("Expected 'endwhile' after statement in while loop");
+        advanceToken();
+        if (isSeparatorToken(";")) advanceToken();
+    }
+
+    // R23. <Condition> ::= <Expression> <Relop> <Expression>
+    constexpr Condition parseCondition() {
+        ValueType left = parseExpression();
+        std::string_view relop = current.lexeme;
+        if (current.type != TokenType::OPER ||
+            (relop != "==" && relop != "!=" && relop != ">" && relop != "<" && relop != "<=" && relop != ">=")) {
+            fail("Expected relational operator in condition");
+        }
+        advanceToken();
+        ValueType right = parseExpression();
+        if (left != right) typeFail("cannot compare values of different types");
+        if (left == ValueType::Boolean && relop != "==" && relop != "!=") {
+            typeFail("Booleans can only be compared with == and !=");
+        }
+        return {relop, left};
+    }
+
+    // Fused compare-and-branch for a relop, or its inverse when negate is set
+    static constexpr StaticOp branchOp(const Condition& condition, bool negate) {
+        std::string_view relop = condition.relop;
+        bool real = condition.type == ValueType::Real;
+        if (relop == "==") return negate ? (real ? StaticOp::JNEF : StaticOp::JNE) : (real ? StaticOp::JEQF : StaticOp::JEQ);
+        if (relop == "!=") return negate ? (real ? StaticOp::JEQF : StaticOp::JEQ) : (real ? StaticOp::JNEF : StaticOp::JNE);
+        if (relop == ">") return negate ? (real ? StaticOp::JLEF : StaticOp::JLE) : (real ? StaticOp::JGTF : StaticOp::JGT);
+        if (relop == "<") return negate ? (real ? StaticOp::JGEF : StaticOp::JGE) : (real ? StaticOp::JLTF : StaticOp::JLT);
+        if (relop == "<=") return negate ? (real ? StaticOp::JGTF : StaticOp::JGT) : (real ? StaticOp::JLEF : StaticOp::JLE);
+        return negate ? (real ? StaticOp::JLTF : StaticOp::JLT) : (real ? StaticOp::JGEF : StaticOp::JGE);
+    }
+
+    // Integer and real operands can't be mixed and booleans don't do arithmetic
+    constexpr ValueType arithmeticType(ValueType left, ValueType right) const {
+        if (left == ValueType::Boolean || right == ValueType::Boolean) typeFail("boolean operand");
+        if (left != right) typeFail("cannot mix integer and real");
+        return left;
+    }
+
+    // R25. <Expression> ::= <Term> { (+ | -) <Term> }
+    constexpr ValueType parseExpression() {
+        ValueType left = parseTerm();
+        while (current.type == TokenType::OPER && (current.lexeme == "+" || current.lexeme == "-")) {
+            bool add = current.lexeme == "+";
+            advanceToken();
+            left = arithmeticType(left, parseTerm());
+            bool real = left == ValueType::Real;
+            emit(add ? (real ? StaticOp::ADDF : StaticOp::ADDI) : (real ? StaticOp::SUBF : StaticOp::SUBI));
+        }
+        return left;
+    }
+
+    // R26. <Term> ::= <Factor> { (* | /) <Factor> }
+    constexpr ValueType parseTerm() {
+        ValueType left = parseFactor();
+        while (current.type == TokenType::OPER && (current.lexeme == "*" || current.lexeme == "/")) {
+            bool multiply = current.lexeme == "*";
+            advanceToken();
+            left = arithmeticType(left, parseFactor());
+            bool real = left == ValueType::Real;
+            emit(multiply ? (real ? StaticOp::MULF : StaticOp::MULI) : (real ? StaticOp::DIVF : StaticOp::DIVI));
+        }
+        return left;
+    }
+
+    // R27. <Factor> ::= - <Primary> | <Primary>
+    constexpr ValueType parseFactor() {
+        if (current.type != TokenType::OPER || current.lexeme != "-") return parsePrimary();
+        advanceToken();
+        ValueType type = parsePrimary();
+        if (type == ValueType::Boolean) typeFail("cannot negate a boolean");
+        emit(type == ValueType::Real ? StaticOp::NEGF : StaticOp::NEGI);
+        return type;
+    }
+
+    // R28. <Primary> ::= <Identifier> | <Integer> | <Identifier> ( <Arguments> ) | ( <Expression> ) | <Real> | true | false
+    constexpr ValueType parsePrimary() {
+        if (current.type == TokenType::IDENT) {
+            std::string_view name = current.lexeme;
+            advanceToken();
+            if (isSeparatorToken("(")) {
+                ValueType type = parseCall(name);
+                emit(StaticOp::PUSH);
+                return type;
+            }
+            const StaticSymbol& symbol = lookup(name);
+            bool element = isSeparatorToken("[");
+            checkIndexed(symbol, element);
+            if (element) parseIndex(symbol);
+            emit(element ? StaticOp::PUSHMX : StaticOp::PUSHM, symbol.address);
+            return symbol.type;
+        }
+        if (current.type == TokenType::INT) {
+            emit(StaticOp::PUSHI, integerValue());
+            advanceToken();
+            return ValueType::Integer;
+        }
+        if (current.type == TokenType::REAL) {
+            // Reals live in the constant pool, PUSHF takes the pool index
+            emit(StaticOp::PUSHF, addConstant(current.lexeme));
+            advanceToken();
+            return ValueType::Real;
+        }
+        if (isSeparatorToken("(")) {
+            advanceToken();
+            ValueType type = parseExpression();
+            expectSeparator(")", "Expected a matching ')' after sub-expression");
+            return type;
+        }
+        if (isKeywordToken("true") || isKeywordToken("false")) {
+            emit(StaticOp::PUSHI, current.lexeme == "true" ? 1 : 0);
+            advanceToken();
+            return ValueType::Boolean;
+        }
+        fail("Expected an identifier, number, or sub-expression");
+    }
+};
+
+// A compiled program, every array exactly as long as it needs to be
+template <size_t Code, size_t Symbols, size_t Functions, size_t Constants>
+struct StaticProgram {
+    std::array<StaticInstruction, Code> code{};
+    // The global scope, in declaration order
+    std::array<StaticSymbol, Symbols> symbols{};
+    std::array<StaticFunction, Functions> functions{};
+    std::array<std::string_view, Constants> constants{};
+
+    // The code as CodeGen holds it, numbered from 1, e.g. to print it or hand
+    // it to something that takes a listing
+    std::vector<Instruction> instructions() const {
+        std::vector<Instruction> list;
+        list.reserve(Code);
+        for (size_t i = 0; i < Code; ++i) {
+            const StaticInstruction& instr = code[i];
+            std::string operand;
+            switch (instr.op) {
+                case StaticOp::LABEL:
+                case StaticOp::CALL: operand = std::string(functions[instr.operand].name); break;
+                case StaticOp::PUSH:
+                case StaticOp::POP: operand = "R1"; break;
+                case StaticOp::PUSHI:
+                case StaticOp::PUSHF:
+                case StaticOp::PUSHM:
+                case StaticOp::POPM:
+                case StaticOp::PUSHMX:
+                case StaticOp::POPMX: operand = std::to_string(instr.operand); break;
+                default:
+                    if (isStaticJump(instr.op) && instr.operand != 0) operand = std::to_string(instr.operand);
+                    break;
+            }
+            list.push_back({static_cast<int>(i) + 1, std::string(staticOpName(instr.op)), std::move(operand)});
+        }
+        return list;
+    }
+};
+
+constexpr StaticParser staticParse(std::string_view source) {
+    StaticParser parser(source);
+    parser.parse();
+    return parser;
+}
+
+// How big the arrays of source's program are, for the template arguments
+constexpr StaticSizes staticSizes(std::string_view source) {
+    return staticParse(source).sizes();
+}
+
+template <size_t Code, size_t Symbols, size_t Functions, size_t Constants>
+constexpr StaticProgram<Code, Symbols, Functions, Constants> staticCompile(std::string_view source) {
+    StaticParser parser = staticParse(source);
+    StaticSizes sizes = parser.sizes();
+    if (sizes.code != Code || sizes.symbols != Symbols || sizes.functions != Functions || sizes.constants != Constants) {
+        parser.fail("Array sizes don't fit the program, take them from staticSizes");
+    }
+    StaticProgram<Code, Symbols, Functions, Constants> program;
+    for (size_t i = 0; i < Code; ++i) program.code[i] = parser.instruction(i);
+    for (size_t i = 0; i < Symbols; ++i) program.symbols[i] = parser.symbol(i);
+    for (size_t i = 0; i < Functions; ++i) program.functions[i] = parser.function(i);
+    for (size_t i = 0; i < Constants; ++i) program.constants[i] = parser.constant(i);
+    return program;
+}
+
+// source has to be a constant expression, a string literal or a constexpr
+// string_view. Compiles it once for the sizes, which the compiler keeps, and
+// once for the program.
+#define RAT25S_STATIC_COMPILE(source)                                                                  \
+    staticCompile<staticSizes(source).code, staticSizes(source).symbols, staticSizes(source).functions, \
+                  staticSizes(source).constants>(source)
@@ -0,0 +1,190 @@
+#include "Superinstructions.h"
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+bool isPlaceholder(const char* operand) {
+    return operand[0] >= 'a' && operand[0] <= 'z' && operand[1] == '\0';
+}
+
+const Superinstructions::Pattern* patternFor(const std::string& op) {
+    for (const auto& pattern : Superinstructions::patterns()) {
+        if (op == pattern.op) return &pattern;
+    }
+    return nullptr;
+}
+
+// The fused instruction for code[start...] when it has the pattern's shape
+bool match(const std::vector<Instruction>& code, size_t start, const std::vector<bool>& isTarget,
+           const Superinstructions::Pattern& pattern, std::string& operand) {
+    if (start + pattern.sequence.size() > code.size()) return false;
+    std::unordered_map<char, const std::string*> bound;
+    for (size_t k = 0; k < pattern.sequence.size(); ++k) {
+        const Instruction& instr = code[start + k];
+        const auto& [op, text] = pattern.sequence[k];
+        if (instr.op != op || (k > 0 && isTarget[start + k])) return false;
+        if (!isPlaceholder(text)) {
+            if (instr.operand != text) return false;
+            continue;
+        }
+        auto [value, added] = bound.emplace(text[0], &instr.operand);
+        if (!added && *value->second != instr.operand) return false;
+    }
+
+    operand.clear();
+    for (const char* p = pattern.operand; *p; ++p) {
+        if (*p == ',') {
+            operand += ',';
+        } else {
+            operand += *bound.at(*p);
+        }
+    }
+    return true;
+}
+
+}
+
+Superinstructions::Superinstructions(CodeGen& codeGen) : codeGen(codeGen) {}
+
+const std::vector<Superinstructions::Pattern>& Superinstructions::patterns() {
+    static const std::vector<Pattern> table = {
+        {"INCM", "a,k", {{"PUSHM", "a"}, {"PUSHI", "k"}, {"ADDI", ""}, {"POPM", "a"}}},
+        {"MULMM", "a,b", {{"PUSHM", "a"}, {"PUSHM", "b"}, {"MULI", ""}}},
+        {"RETM", "a", {{"PUSHM", "a"}, {"POP", "R1"}, {"RET", ""}}},
+        {"SETM", "a,k", {{"PUSHI", "k"}, {"POPM", "a"}}},
+    };
+    return table;
+}
+
+bool Superinstructions::isFused(const std::string& op) {
+    return patternFor(op) != nullptr;
+}
+
+bool Superinstructions::returns(const std::string& op) {
+    const Pattern* pattern = patternFor(op);
+    return pattern != nullptr && std::string(pattern->sequence.back().first) == "RET";
+}
+
+bool Superinstructions::stackEffect(const std::string& op, int& pops, int& pushes) {
+    const Pattern* pattern = patternFor(op);
+    if (pattern == nullptr) return false;
+    // Depth relative to the start, the lowest it gets is what the sequence pops
+    int depth = 0, lowest = 0;
+    for (const auto& piece : pattern->sequence) {
+        int piecePops, piecePushes;
+        CodeGen::stackEffect(piece.first, piecePops, piecePushes);
+        depth -= piecePops;
+        lowest = std::min(lowest, depth);
+        depth += piecePushes;
+    }
+    pops = -lowest;
+    pushes = depth - lowest;
+    return true;
+}
+
+std::vector<Instruction> Superinstructions::expand(const Instruction& instr) {
+    const Pattern* pattern = patternFor(instr.op);
+    if (pattern == nullptr) return {instr};
+
+    std::unordered_map<char, std::string> bound;
+    size_t start = 0;
+    for (const char* p = pattern->operand; *p; ++p) {
+        if (*p == ',') continue;
+        size_t comma = instr.operand.find(',', start);
+        if (comma == std::string::npos) comma = instr.operand.size();
+        bound[*p] = instr.operand.substr(start, comma - start);
+        start = comma + 1;
+    }
+    if (start != instr.operand.size() + 1) {
+        throw std::runtime_error("Bad operand '" + instr.operand + "' for " + instr.op);
+    }
+
+    std::vector<Instruction> base;
+    for (const auto& [op, text] : pattern->sequence) {
+        base.push_back({0, op, isPlaceholder(text) ? bound.at(text[0]) : text});
+    }
+    return base;
+}
+
+std::vector<Instruction> Superinstructions::expand(const std::vector<Instruction>& code,
+                                                   std::vector<FunctionInfo>* functions) {
+    // Old address -> new, one past the end included
+    std::vector<int> moved(code.size() + 2);
+    std::vector<Instruction> result;
+    result.reserve(code.size());
+    for (size_t i = 0; i < code.size(); ++i) {
+        moved[i + 1] = static_cast<int>(result.size()) + 1;
+        for (auto& instr : expand(code[i])) {
+            instr.address = static_cast<int>(result.size()) + 1;
+            result.push_back(std::move(instr));
+        }
+    }
+    moved[code.size() + 1] = static_cast<int>(result.size()) + 1;
+
+    auto move = [&](int addr) {
+        return addr >= 1 && addr <= static_cast<int>(code.size()) + 1 ? moved[addr] : addr;
+    };
+    for (auto& instr : result) {
+        if (CodeGen::isJump(instr.op) && !instr.operand.empty()) {
+            instr.operand = std::to_string(move(std::stoi(instr.operand)));
+        }
+    }
+    if (functions != nullptr) {
+        for (auto& fn : *functions) {
+            fn.entry = move(fn.entry);
+            fn.end = move(fn.end);
+        }
+    }
+    return result;
+}
+
+void Superinstructions::run() {
+    const std::vector<Instruction>& code = codeGen.getInstructions();
+    sizeBefore = sizeAfter = static_cast<int>(code.size());
+    fused.clear();
+
+    // Jump targets and function boundaries can only start a fused instruction
+    std::vector<bool> isTarget(code.size() + 1, false);
+    for (const auto& instr : code) {
+        if (CodeGen::isJump(instr.op) && !instr.operand.empty()) {
+            int target = std::stoi(instr.operand) - 1;
+            if (target >= 0 && target < static_cast<int>(isTarget.size())) isTarget[target] = true;
+        }
+    }
+    for (const auto& fn : codeGen.getFunctions()) {
+        if (fn.entry >= 1 && fn.entry <= static_cast<int>(code.size())) isTarget[fn.entry - 1] = true;
+        if (fn.end >= 1 && fn.end <= static_cast<int>(code.size())) isTarget[fn.end - 1] = true;
+    }
+
+    std::vector<Instruction> result;
+    result.reserve(code.size());
+    std::string operand;
+    for (size_t i = 0; i < code.size(); ++i) {
+        const Pattern* found = nullptr;
+        for (const auto& pattern : patterns()) {
+            if (match(code, i, isTarget, pattern, operand)) {
+                found = &pattern;
+                break;
+            }
+        }
+        if (found == nullptr) {
+            result.push_back(code[i]);
+            continue;
+        }
+        // The fused instruction keeps the first one's address, jumps to it still land
+        result.push_back({code[i].address, found->op, operand});
+        fused[found->op]++;
+        i += found->sequence.size() - 1;
+    }
+    if (fused.empty()) return;
+    sizeAfter = static_cast<int>(result.size());
+    codeGen.relink(std::move(result));
+}
+
+void Superinstructions::print(std::ostream& out) const {
+    out << "[FUSE] " << sizeBefore << " -> " << sizeAfter << " instructions";
+    for (const auto& [op, count] : fused) out << ", " << count << " " << op;
+    out << "\n";
+}
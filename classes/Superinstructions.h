@@ -0,0 +1,59 @@
+#pragma once
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "CodeGen.h"
+
+// Fuses the base instruction sequences the parser makes most, found by mining
+// a corpus with rat25sgrams, into one instruction each, so an executor
+// dispatches once where it did two to four times:
+//
+//     INCM a,k    PUSHM a; PUSHI k; ADDI; POPM a     x = x + k
+//     MULMM a,b   PUSHM a; PUSHM b; MULI             x * y
+//     RETM a      PUSHM a; POP R1; RET               return x;
+//     SETM a,k    PUSHI k; POPM a                    x = k
+//
+// Only the order the parser emits is fused, k + x is left alone, so expanding
+// a fused program gives back exactly the code it came from. Runs last, after
+// the passes that look for base sequences and before the Verifier, which
+// checks a fused instruction as the sequence it stands for. A sequence is only
+// fused when nothing jumps into the middle of it.
+class Superinstructions {
+public:
+    struct Pattern {
+        const char* op;
+        // Placeholders of the sequence, comma separated: a and b are
+        // addresses, k an integer literal
+        const char* operand;
+        // Base op and operand pairs, an operand is a placeholder or literal text
+        std::vector<std::pair<const char*, const char*>> sequence;
+    };
+
+    explicit Superinstructions(CodeGen& codeGen);
+
+    void run();
+    void print(std::ostream& out) const;
+
+    static const std::vector<Pattern>& patterns();
+    static bool isFused(const std::string& op);
+    // Fused ops that end in RET
+    static bool returns(const std::string& op);
+    // What the base sequence pops and pushes in all, false for other ops
+    static bool stackEffect(const std::string& op, int& pops, int& pushes);
+    // The base sequence an instruction stands for, itself when it isn't fused.
+    // The pieces have address 0.
+    static std::vector<Instruction> expand(const Instruction& instr);
+    // A whole program in the base set, for an executor without the fused ops.
+    // code is numbered from 1 as CodeGen has it, jumps and the function ranges
+    // are moved to the expanded addresses.
+    static std::vector<Instruction> expand(const std::vector<Instruction>& code,
+                                           std::vector<FunctionInfo>* functions = nullptr);
+
+private:
+    CodeGen& codeGen;
+    int sizeBefore = 0;
+    int sizeAfter = 0;
+    std::map<std::string, int> fused;
+};
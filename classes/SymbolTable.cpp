@@ -1,65 +1,95 @@
 #include "SymbolTable.h"
+#include "OutputWriter.h"
 #include <iostream>
+#include <stdexcept>
 
-bool SymbolTable::declare(const std::string& name, const std::string& type) {
+std::string typeName(ValueType type) {
+    switch (type) {
+        case ValueType::Integer: return "integer";
+        case ValueType::Real: return "real";
+        case ValueType::Boolean: return "boolean";
+    }
+    return "unknown";
+}
+
+bool SymbolTable::declare(std::string_view name, ValueType type, int length) {
     // Check if variable is already declared in current scope
     if (isInCurrentScope(name)) return false;
     
-    // Add to current scope
-    scopeStack.back()[name] = {type, currentAddress++};
+    // Add to current scope, an array's elements take the addresses after it
+    scopeStack.back().emplace(intern(name), Symbol{type, currentAddress, length});
+    currentAddress += length > 0 ? length : 1;
     return true;
 }
 
-bool SymbolTable::exists(const std::string& name) const {
-    // Check all scopes from innermost to outermost
-    for (auto it = scopeStack.rbegin(); it != scopeStack.rend(); ++it) {
-        if (it->count(name)) return true;
-    }
-    return false;
+std::string_view SymbolTable::intern(std::string_view name) {
+    char* copy = static_cast<char*>(memory->allocate(name.size(), 1));
+    name.copy(copy, name.size());
+    return {copy, name.size()};
 }
 
-int SymbolTable::getAddress(const std::string& name) const {
-    // Find in innermost scope first
+const Symbol* SymbolTable::find(std::string_view name) const {
+    lookups++;
+    // Innermost scope first
     for (auto it = scopeStack.rbegin(); it != scopeStack.rend(); ++it) {
-        if (it->count(name)) {
-            return it->at(name).memoryAddress;
-        }
+        auto entry = it->find(name);
+        if (entry != it->end()) return &entry->second;
     }
-    throw std::runtime_error("Variable " + name + " not found in any scope");
+    return nullptr;
 }
 
-std::string SymbolTable::getType(const std::string& name) const {
-    // Find in innermost scope first
-    for (auto it = scopeStack.rbegin(); it != scopeStack.rend(); ++it) {
-        if (it->count(name)) {
-            return it->at(name).type;
-        }
-    }
-    throw std::runtime_error("Variable " + name + " not found in any scope");
+bool SymbolTable::exists(std::string_view name) const {
+    return find(name) != nullptr;
 }
 
-void SymbolTable::print() const {
-    std::cout << "\nSymbol Table:\n";
+int SymbolTable::getAddress(std::string_view name) const {
+    if (const Symbol* symbol = find(name)) return symbol->memoryAddress;
+    throw std::runtime_error("Variable " + std::string(name) + " not found in any scope");
+}
+
+const Symbol& SymbolTable::getSymbol(std::string_view name) const {
+    if (const Symbol* symbol = find(name)) return *symbol;
+    throw std::runtime_error("Variable " + std::string(name) + " not found in any scope");
+}
+
+ValueType SymbolTable::getType(std::string_view name) const {
+    if (const Symbol* symbol = find(name)) return symbol->type;
+    throw std::runtime_error("Variable " + std::string(name) + " not found in any scope");
+}
+
+std::vector<SymbolEntry> SymbolTable::entries() const {
+    std::vector<SymbolEntry> list;
     for (size_t i = 0; i < scopeStack.size(); ++i) {
-        std::cout << "Scope " << i << ":\n";
         for (const auto& [name, sym] : scopeStack[i]) {
-            std::cout << "  " << name << " @ " << sym.memoryAddress << " : " << sym.type << "\n";
+            list.push_back({std::string(name), static_cast<int>(i), sym.type, sym.memoryAddress, sym.length});
         }
     }
+    return list;
+}
+
+void SymbolTable::print() const {
+    print(std::cout);
 }
 
 void SymbolTable::print(std::ostream& out) const {
+    OutputWriter writer(out);
+    print(writer);
+}
+
+void SymbolTable::print(OutputWriter& out) const {
     out << "\nSymbol Table:\n";
     for (size_t i = 0; i < scopeStack.size(); ++i) {
         out << "Scope " << i << ":\n";
         for (const auto& [name, sym] : scopeStack[i]) {
-            out << "  " << name << " @ " << sym.memoryAddress << " : " << sym.type << "\n";
+            out << "  " << name << " @ " << sym.memoryAddress << " : " << typeName(sym.type);
+            if (sym.length > 0) out << '[' << sym.length << ']';
+            out << '\n';
         }
     }
 }
 
 void SymbolTable::enterScope() {
-    scopeStack.push_back({});
+    scopeStack.emplace_back();
 }
 
 void SymbolTable::exitScope() {
@@ -68,6 +98,13 @@ void SymbolTable::exitScope() {
     }
 }
 
-bool SymbolTable::isInCurrentScope(const std::string& name) const {
+bool SymbolTable::isInCurrentScope(std::string_view name) const {
     return scopeStack.back().count(name) > 0;
-}
\ No newline at end of file
+}
+
+int SymbolTable::allocateTemp(ValueType type) {
+    // '$' can't start an identifier so temps never clash with user names
+    std::string name = "$t" + std::to_string(tempCount++);
+    scopeStack.front().emplace(intern(name), Symbol{type, currentAddress});
+    return currentAddress++;
+}
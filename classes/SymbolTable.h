@@ -1,34 +1,90 @@
 #pragma once
+#include <iosfwd>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+class OutputWriter;
+
+enum class ValueType {
+    Integer,
+    Real,
+    Boolean
+};
+
+std::string typeName(ValueType type);
+
 struct Symbol {
-    std::string type;
+    ValueType type;
     int memoryAddress;
+    // Elements of an array, which takes that many addresses from memoryAddress
+    // on. 0 for a scalar.
+    int length = 0;
 };
 
+// A symbol with its name, for callers outside the compiler
+struct SymbolEntry {
+    std::string name;
+    // 0 is the global scope
+    int scope;
+    ValueType type;
+    int memoryAddress;
+    int length = 0;
+};
+
+// Names come from memory, normally the compilation's arena: they are copied in
+// when declared and looked up as string_views, a lookup never builds a string.
+// Scopes and their entries come from scopes, a function's are given back when
+// it ends and the next function's reuse them.
 class SymbolTable {
 private:
+    using Scope = std::pmr::unordered_map<std::string_view, Symbol>;
+
+    std::pmr::memory_resource* memory;
     // Stack of symbol tables for different scopes
-    std::vector<std::unordered_map<std::string, Symbol>> scopeStack;
+    std::pmr::vector<Scope> scopeStack;
     int currentAddress;
+    int tempCount = 0;
+    mutable size_t lookups = 0;
+
+    // Copy of name in memory, it lives as long as the table
+    std::string_view intern(std::string_view name);
 
 public:
-    SymbolTable() : currentAddress(10000) {
+    static constexpr int firstAddress = 10000;
+
+    explicit SymbolTable(std::pmr::memory_resource* memory = std::pmr::get_default_resource(),
+                         std::pmr::memory_resource* scopes = std::pmr::get_default_resource())
+        : memory(memory), scopeStack(scopes), currentAddress(firstAddress) {
         // Initialize with global scope
-        scopeStack.push_back({});
+        scopeStack.emplace_back();
     }
 
-    bool declare(const std::string& name, const std::string& type);
-    bool exists(const std::string& name) const;
-    int getAddress(const std::string& name) const;
-    std::string getType(const std::string& name) const;
+    // An array of length elements when length is above 0
+    bool declare(std::string_view name, ValueType type, int length = 0);
+    bool exists(std::string_view name) const;
+    // The innermost declaration of name, nullptr when there is none
+    const Symbol* find(std::string_view name) const;
+    // Throws like getAddress when the name isn't declared
+    const Symbol& getSymbol(std::string_view name) const;
+    int getAddress(std::string_view name) const;
+    ValueType getType(std::string_view name) const;
+    int getNextAddress() const { return currentAddress; }
+    // Name lookups so far, for the profiler
+    size_t lookupCount() const { return lookups; }
+    // Every symbol still in scope, in the order print() lists them
+    std::vector<SymbolEntry> entries() const;
     void print() const;
     void print(std::ostream& out) const;
+    void print(OutputWriter& out) const;
 
     // New methods for scope management
     void enterScope();
     void exitScope();
-    bool isInCurrentScope(const std::string& name) const;
+    bool isInCurrentScope(std::string_view name) const;
+
+    // Compiler generated variable in the global scope, returns its address
+    int allocateTemp(ValueType type);
 };
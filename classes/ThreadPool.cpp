@@ -0,0 +1,96 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0) threads = 1;
+    for (size_t i = 0; i < threads; ++i) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([this, i] { work(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return unfinished == 0; });
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    Queue& queue = *queues[nextQueue++ % queues.size()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued++;
+        unfinished++;
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return unfinished == 0; });
+    if (failure) {
+        std::exception_ptr error = failure;
+        failure = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+bool ThreadPool::take(size_t self, std::function<void()>& task) {
+    {
+        Queue& own = *queues[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    for (size_t k = 1; k < queues.size(); ++k) {
+        Queue& victim = *queues[(self + k) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            stolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::work(size_t self) {
+    while (true) {
+        std::function<void()> task;
+        if (!take(self, task)) {
+            std::unique_lock<std::mutex> lock(mutex);
+            // queued can be ahead of the deques for a moment, take() just retries
+            wake.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0) return;
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued--;
+        }
+
+        std::exception_ptr error;
+        try {
+            task();
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error && !failure) failure = error;
+        if (--unfinished == 0) done.notify_all();
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of workers, each with its own task deque. Tasks are dealt out in
+// turn and a worker runs its own in the order they were submitted, so a batch
+// submitted biggest first starts on its biggest files. Once its deque is empty
+// a worker steals from the front of the others', so a queue that drew the big
+// jobs doesn't keep the rest waiting.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+    // Finishes the queued tasks before joining
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+    // Blocks until every submitted task has run, then rethrows the first
+    // exception a task let escape, if any
+    void wait();
+
+    size_t size() const { return workers.size(); }
+    size_t steals() const { return stolen; }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void work(size_t self);
+    bool take(size_t self, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> nextQueue{0};
+    std::atomic<size_t> stolen{0};
+
+    // Guards the counts below, and the sleeping workers and waiters
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    size_t queued = 0;
+    size_t unfinished = 0;
+    bool stopping = false;
+    std::exception_ptr failure;
+};
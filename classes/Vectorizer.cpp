@@ -0,0 +1,219 @@
+#include "Vectorizer.h"
+#include <unordered_map>
+
+namespace {
+
+bool isElementwise(const std::string& op) {
+    // Division is left out, a kernel could trap on an element the loop never got to
+    return op == "ADDI" || op == "SUBI" || op == "MULI" || op == "ADDF" || op == "SUBF" || op == "MULF";
+}
+
+// One operand of a stored value: the element y[i], or a scalar and the push for it
+struct Operand {
+    bool element;
+    int array;
+    Instruction scalar;
+};
+
+}
+
+Vectorizer::Vectorizer(CodeGen& codeGen) : codeGen(codeGen) {}
+
+void Vectorizer::run() {
+    const std::vector<Instruction>& code = codeGen.getInstructions();
+    reports.clear();
+
+    std::vector<int> jumpsTo(code.size() + 1, 0);
+    for (const auto& instr : code) {
+        if (CodeGen::isJump(instr.op) && !instr.operand.empty()) {
+            int target = std::stoi(instr.operand) - 1;
+            if (target >= 0 && target < static_cast<int>(jumpsTo.size())) jumpsTo[target]++;
+        }
+    }
+
+    // Entry of each vectorized loop -> its backward jump and what replaces the two and all between
+    std::unordered_map<int, std::pair<int, std::vector<Instruction>>> replaced;
+    int nextId = -1;
+    for (int tail = 0; tail < static_cast<int>(code.size()); ++tail) {
+        if (!CodeGen::isConditionalJump(code[tail].op) || code[tail].operand.empty()) continue;
+        // A while loop is a JUMP down to its test, the body, and the test: two
+        // pushes and the branch back to the body
+        int head = std::stoi(code[tail].operand) - 1;
+        int entry = head - 1;
+        if (entry < 0 || head >= tail - 2 || code[entry].op != "JUMP" || code[entry].operand.empty() ||
+            std::stoi(code[entry].operand) - 1 != tail - 2) {
+            continue;
+        }
+
+        bool usesArrays = false;
+        for (int i = head; i <= tail; ++i) {
+            usesArrays = usesArrays || code[i].op == "PUSHMX" || code[i].op == "POPMX";
+        }
+        if (!usesArrays) continue;
+
+        LoopReport report{code[head].address, false, {}, {}};
+        bool closed = jumpsTo[head] == 1 && jumpsTo[tail - 2] == 1;
+        for (int i = head + 1; i <= tail && closed; ++i) {
+            closed = i == tail - 2 || jumpsTo[i] == 0;
+        }
+        std::vector<Instruction> replacement;
+        if (!closed) {
+            report.reason = "other code jumps into it";
+        } else if (vectorize(code, entry, tail, replacement, report)) {
+            report.vectorized = true;
+            // The first instruction takes the entry's address, so jumps to the loop reach it
+            replacement.front().address = code[entry].address;
+            for (size_t k = 1; k < replacement.size(); ++k) replacement[k].address = nextId--;
+            replaced[entry] = {tail, std::move(replacement)};
+        }
+        reports.push_back(std::move(report));
+    }
+    if (replaced.empty()) return;
+
+    std::vector<Instruction> result;
+    result.reserve(code.size());
+    for (int i = 0; i < static_cast<int>(code.size()); ++i) {
+        auto loop = replaced.find(i);
+        if (loop == replaced.end()) {
+            result.push_back(code[i]);
+            continue;
+        }
+        result.insert(result.end(), loop->second.second.begin(), loop->second.second.end());
+        i = loop->second.first;
+    }
+    codeGen.relink(std::move(result));
+}
+
+bool Vectorizer::vectorize(const std::vector<Instruction>& code, int entry, int tail,
+                           std::vector<Instruction>& replacement, LoopReport& report) const {
+    int head = entry + 1;
+    int test = tail - 2;
+    const std::string& branch = code[tail].op;
+
+    // i < n pushes i first, n > i pushes it second
+    bool indexFirst = branch == "JLT" || branch == "JLE";
+    if (!indexFirst && branch != "JGT" && branch != "JGE") {
+        report.reason = "the test isn't i < n";
+        return false;
+    }
+    const Instruction& index = code[indexFirst ? test : test + 1];
+    const Instruction& bound = code[indexFirst ? test + 1 : test];
+    if (index.op != "PUSHM" || (bound.op != "PUSHM" && bound.op != "PUSHI") || bound.operand == index.operand) {
+        report.reason = "the test isn't i < n";
+        return false;
+    }
+    const std::string& i = index.operand;
+
+    bool increment = test - head >= 4 && code[test - 1].op == "POPM" && code[test - 1].operand == i &&
+                     code[test - 2].op == "ADDI" &&
+                     ((code[test - 4].op == "PUSHM" && code[test - 4].operand == i &&
+                       code[test - 3].op == "PUSHI" && code[test - 3].operand == "1") ||
+                      (code[test - 4].op == "PUSHI" && code[test - 4].operand == "1" &&
+                       code[test - 3].op == "PUSHM" && code[test - 3].operand == i));
+    if (!increment) {
+        report.reason = "the body doesn't end with i = i + 1";
+        return false;
+    }
+    int statements = test - 4;
+    if (statements == head) {
+        report.reason = "it only counts";
+        return false;
+    }
+
+    // The end of the range, one past n for <=
+    std::vector<Instruction> limit{{0, bound.op, bound.operand}};
+    if (branch == "JLE" || branch == "JGE") {
+        limit.push_back({0, "PUSHI", "1"});
+        limit.push_back({0, "ADDI", ""});
+    }
+
+    auto readOperand = [&](int& pos, Operand& operand) {
+        if (pos + 1 < statements && code[pos].op == "PUSHM" && code[pos].operand == i && code[pos + 1].op == "PUSHMX") {
+            operand = {true, std::stoi(code[pos + 1].operand), {}};
+            pos += 2;
+            return true;
+        }
+        if (pos < statements && ((code[pos].op == "PUSHM" && code[pos].operand != i) ||
+                                 code[pos].op == "PUSHI" || code[pos].op == "PUSHF")) {
+            operand = {false, 0, code[pos]};
+            pos++;
+            return true;
+        }
+        return false;
+    };
+
+    int pos = head;
+    while (pos < statements) {
+        // x[i] = <value>, the store's index goes first
+        Operand left, right;
+        if (code[pos].op != "PUSHM" || code[pos].operand != i || !readOperand(++pos, left)) {
+            report.reason = "a statement isn't x[i] = <element-wise value>";
+            return false;
+        }
+        std::string arithmetic;
+        bool binary = pos < statements && code[pos].op != "POPMX";
+        if (binary) {
+            if (!readOperand(pos, right) || pos >= statements || !isElementwise(code[pos].op)) {
+                report.reason = "a statement isn't x[i] = <element-wise value>";
+                return false;
+            }
+            arithmetic = code[pos++].op;
+        }
+        if (pos >= statements || code[pos].op != "POPMX") {
+            report.reason = "a statement isn't x[i] = <element-wise value>";
+            return false;
+        }
+
+        std::string op;
+        std::vector<int> arrays{std::stoi(code[pos++].operand)};
+        const Operand* scalar = nullptr;
+        if (!binary) {
+            op = left.element ? "VCOPY" : "VFILL";
+            if (left.element) arrays.push_back(left.array);
+            else scalar = &left;
+        } else if (left.element && right.element) {
+            op = "V" + arithmetic;
+            arrays.push_back(left.array);
+            arrays.push_back(right.array);
+        } else if (left.element || right.element) {
+            // The S forms put the scalar on the right, which s - y[i] can't be
+            if (right.element && arithmetic.compare(0, 3, "SUB") == 0) {
+                report.reason = "s - y[i] has no vector op";
+                return false;
+            }
+            op = "V" + arithmetic + "S";
+            arrays.push_back(left.element ? left.array : right.array);
+            scalar = left.element ? &right : &left;
+        } else {
+            report.reason = "a value is scalar arithmetic";
+            return false;
+        }
+
+        if (scalar != nullptr) replacement.push_back(scalar->scalar);
+        replacement.push_back({0, "PUSHM", i});
+        replacement.insert(replacement.end(), limit.begin(), limit.end());
+        replacement.push_back({0, op, CodeGen::addressOperand(arrays)});
+        report.ops.push_back(op);
+    }
+
+    // i ends at n, unless it started past it. The jump goes to the removed
+    // backward jump, which is to say just after the loop.
+    replacement.push_back({0, "PUSHM", i});
+    replacement.insert(replacement.end(), limit.begin(), limit.end());
+    replacement.push_back({0, "JGE", std::to_string(code[tail].address)});
+    replacement.insert(replacement.end(), limit.begin(), limit.end());
+    replacement.push_back({0, "POPM", i});
+    return true;
+}
+
+void Vectorizer::print(std::ostream& out) const {
+    for (const auto& r : reports) {
+        out << "[VECTOR] loop @" << r.head << ": ";
+        if (!r.vectorized) {
+            out << "not vectorized, " << r.reason << "\n";
+            continue;
+        }
+        for (size_t k = 0; k < r.ops.size(); ++k) out << (k ? " " : "") << r.ops[k];
+        out << "\n";
+    }
+}
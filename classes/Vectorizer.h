@@ -0,0 +1,47 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CodeGen.h"
+
+// Replaces while loops that work on arrays one element at a time with CodeGen's
+// bulk vector ops, which an executor can run as SIMD kernels. A loop qualifies
+// when it has the shape
+//
+//     while (i < n) { x[i] = <value>; ... i = i + 1; } endwhile
+//
+// (or i <= n, n > i, n >= i) where n is a literal or a variable, and every
+// statement before the increment stores an element at index i. A value is y[i],
+// a scalar, or y[i] op z[i], y[i] op s or s op y[i] with op one of + - *, and
+// s op y[i] only for + and *. Scalars are literals or variables other than i,
+// which the loop can't write since it stores nothing else. Runs after the
+// LoopOptimizer so an invariant expression is already a temp.
+//
+// Every statement only touches index i of each array, so running each one over
+// the whole range before the next leaves memory as the loop would. The loop
+// becomes one vector op per statement over [i, n) and then i = n if i was below.
+class Vectorizer {
+public:
+    struct LoopReport {
+        int head;                       // address of the loop body before the pass
+        bool vectorized;
+        std::vector<std::string> ops;   // the vector op of each statement
+        std::string reason;             // why the loop was left alone
+    };
+
+    explicit Vectorizer(CodeGen& codeGen);
+
+    void run();
+    // Only loops that use arrays are reported
+    void print(std::ostream& out) const;
+
+private:
+    // The instructions replacing the loop from its entry JUMP to its backward
+    // jump, or the reason there are none
+    bool vectorize(const std::vector<Instruction>& code, int entry, int tail,
+                   std::vector<Instruction>& replacement, LoopReport& report) const;
+
+    CodeGen& codeGen;
+    std::vector<LoopReport> reports;
+};
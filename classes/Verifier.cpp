@@ -0,0 +1,177 @@
+#include "Verifier.h"
+#include "Superinstructions.h"
+#include <algorithm>
+#include <unordered_map>
+
+Verifier::Verifier(CodeGen& codeGen, const SymbolTable& symbolTable)
+    : codeGen(codeGen), symbolTable(symbolTable) {}
+
+bool Verifier::run() {
+    const auto& code = codeGen.getInstructions();
+    const auto& functions = codeGen.getFunctions();
+    results.clear();
+
+    owner.assign(code.size(), -1);
+    for (size_t f = 0; f < functions.size(); ++f) {
+        for (int addr = functions[f].entry; addr < functions[f].end; ++addr) {
+            owner[addr - 1] = f;
+        }
+    }
+
+    // Top-level statements can be split up by functions, they run in address order
+    std::vector<int> topLevel;
+    for (size_t i = 0; i < code.size(); ++i) {
+        if (owner[i] < 0) topLevel.push_back(i);
+    }
+    results.push_back(verifyUnit("", topLevel, 0));
+
+    // A function starts with its arguments on the stack
+    std::vector<std::pair<std::string, int>> verified;
+    for (const auto& fn : functions) {
+        std::vector<int> members;
+        for (int addr = fn.entry; addr < fn.end; ++addr) members.push_back(addr - 1);
+        results.push_back(verifyUnit(fn.name, members, fn.params));
+        if (results.back().verified) verified.push_back({fn.name, results.back().maxStack});
+    }
+    for (const auto& [name, maxStack] : verified) {
+        codeGen.markVerified(name, maxStack);
+    }
+
+    return std::all_of(results.begin(), results.end(), [](const Result& r) { return r.verified; });
+}
+
+Verifier::Result Verifier::verifyUnit(const std::string& name, const std::vector<int>& members, int initialDepth) {
+    const auto& code = codeGen.getInstructions();
+    const auto& constants = codeGen.getConstants();
+    Result result{name, false, initialDepth, {}};
+    if (members.empty()) {
+        result.verified = true;
+        return result;
+    }
+    bool inFunction = owner[members.front()] >= 0;
+
+    std::unordered_map<int, size_t> position;
+    for (size_t k = 0; k < members.size(); ++k) position[members[k]] = k;
+
+    // Depth on entry to each instruction, -1 until some path reaches it
+    std::vector<int> depth(members.size(), -1);
+    std::vector<size_t> work;
+
+    auto fail = [&](size_t k, const std::string& message) {
+        result.errors.push_back(std::to_string(code[members[k]].address) + ": " + message);
+    };
+    auto flow = [&](size_t from, size_t to, int d) {
+        if (depth[to] < 0) {
+            depth[to] = d;
+            work.push_back(to);
+        } else if (depth[to] != d) {
+            fail(to, "stack depth " + std::to_string(d) + " coming from " +
+                     std::to_string(code[members[from]].address) + " but " +
+                     std::to_string(depth[to]) + " on another path");
+        }
+    };
+    auto leave = [&](size_t k, int d) {
+        if (d != 0) fail(k, "leaves " + std::to_string(d) + " values on the stack");
+    };
+
+    depth[0] = initialDepth;
+    work.push_back(0);
+    while (!work.empty()) {
+        size_t k = work.back();
+        work.pop_back();
+        const Instruction& instr = code[members[k]];
+        int d = depth[k];
+
+        int pops, pushes;
+        if (instr.op == "CALL") {
+            // An import's code comes at link time, its parameter count is known now
+            pops = codeGen.paramsOf(instr.operand);
+            if (pops < 0) {
+                fail(k, "CALL to unknown label " + instr.operand);
+                continue;
+            }
+            pushes = 0;
+        } else if (!CodeGen::stackEffect(instr.op, pops, pushes)) {
+            fail(k, "unknown instruction " + instr.op);
+            continue;
+        }
+
+        if (d < pops) {
+            fail(k, "stack underflow in " + instr.op);
+            continue;
+        }
+        d += pushes - pops;
+        result.maxStack = std::max(result.maxStack, d);
+
+        auto checkOperand = [&](const Instruction& piece) {
+            if (piece.op == "PUSHM" || piece.op == "POPM" || piece.op == "PUSHMX" || piece.op == "POPMX" ||
+                CodeGen::isVectorOp(piece.op)) {
+                for (int addr : CodeGen::addresses(piece.operand)) {
+                    if (addr < SymbolTable::firstAddress || addr >= symbolTable.getNextAddress()) {
+                        fail(k, "address " + std::to_string(addr) + " is not in the symbol table");
+                    }
+                }
+            } else if (piece.op == "PUSHF") {
+                if (std::stoul(piece.operand) >= constants.size()) {
+                    fail(k, "constant " + piece.operand + " is not in the pool");
+                }
+            } else if ((piece.op == "PUSH" || piece.op == "POP") && piece.operand != "R1") {
+                fail(k, "unknown register " + piece.operand);
+            }
+        };
+        if (Superinstructions::isFused(instr.op)) {
+            // Checked piece by piece, as the sequence it stands for
+            for (const auto& piece : Superinstructions::expand(instr)) checkOperand(piece);
+        } else {
+            checkOperand(instr);
+        }
+
+        if (instr.op == "RET" || Superinstructions::returns(instr.op)) {
+            leave(k, d);
+            continue;
+        }
+        if (CodeGen::isJump(instr.op)) {
+            size_t target = std::stoi(instr.operand) - 1;
+            auto found = position.find(target);
+            if (target == code.size()) {
+                leave(k, d);
+            } else if (found != position.end()) {
+                flow(k, found->second, d);
+            } else if (instr.op == "JUMP" && target < code.size() && code[target].op == "LABEL" &&
+                       codeGen.findFunction(code[target].operand) != nullptr) {
+                // Tail call, the callee gets our stack as its arguments
+                int params = codeGen.findFunction(code[target].operand)->params;
+                if (d != params) {
+                    fail(k, "tail call to " + code[target].operand + " with " + std::to_string(d) +
+                            " values on the stack, it takes " + std::to_string(params));
+                }
+            } else {
+                fail(k, "jump to " + instr.operand + " leaves the function");
+            }
+            if (instr.op == "JUMP") continue;
+        }
+
+        if (k + 1 < members.size()) {
+            flow(k, k + 1, d);
+        } else if (inFunction) {
+            fail(k, "falls off the end of the function");
+        } else {
+            leave(k, d);
+        }
+    }
+
+    result.verified = result.errors.empty();
+    return result;
+}
+
+void Verifier::print(std::ostream& out) const {
+    for (const auto& r : results) {
+        out << "[VERIFY] " << (r.name.empty() ? "<top-level>" : r.name) << ": ";
+        if (r.verified) {
+            out << "verified, max stack " << r.maxStack << "\n";
+            continue;
+        }
+        out << "FAILED\n";
+        for (const auto& e : r.errors) out << "[VERIFY]   " << e << "\n";
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CodeGen.h"
+#include "SymbolTable.h"
+
+// Checks the final code before anything runs it. For each function, and for the
+// top-level statements, it follows every path to prove the operand stack never
+// underflows and has the same depth wherever paths meet, and records the deepest
+// the stack gets. Memory operands must be addresses SymbolTable handed out and
+// every CALL must name a LABEL or an import. Functions that pass are marked
+// verified in CodeGen with their stack size, so a runtime can skip
+// per-instruction checks.
+class Verifier {
+public:
+    struct Result {
+        std::string name;   // "" for the top-level statements
+        bool verified;
+        int maxStack;
+        std::vector<std::string> errors;
+    };
+
+    Verifier(CodeGen& codeGen, const SymbolTable& symbolTable);
+
+    // True when every unit verified
+    bool run();
+    const std::vector<Result>& getResults() const { return results; }
+    void print(std::ostream& out) const;
+
+private:
+    // members are the unit's instruction indices in fall-through order
+    Result verifyUnit(const std::string& name, const std::vector<int>& members, int initialDepth);
+
+    CodeGen& codeGen;
+    const SymbolTable& symbolTable;
+    std::vector<int> owner;
+    std::vector<Result> results;
+};
@@ -1,23 +1,22 @@
 #include "parser.h"
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <string_view>
 
-// Output file stream for production rules
-std::ofstream* ruleOutputFile = nullptr;
-bool printRules = false; //Switch to turn rule printing on/off
-bool printTokenInfoEnabled = false; // Toggle token print output HERE
-
 // Helper function to print production rules
-void printProductionRule(const std::string& rule) {
-    if (printRules) {
-        std::cout << "Production Rule: " << rule << std::endl;
+template <typename Sink>
+void BasicParser<Sink>::printProductionRule(std::string_view rule) {
+    productions++;
+    if (printRules && trace != nullptr) {
+        *trace << "Production Rule: " << rule << "\n";
     }
 }
 
 // Helper function to print token and lexeme information
-void printTokenInfo(const Token& token) {
-    if (!printTokenInfoEnabled) return;
+template <typename Sink>
+void BasicParser<Sink>::printTokenInfo(const Token& token) const {
+    if (!printTokenInfoEnabled || trace == nullptr) return;
 
     std::string tokenStr;
     switch(token.type) {
@@ -32,10 +31,11 @@ void printTokenInfo(const Token& token) {
         case TokenType::END: tokenStr = "End"; break;
         default: tokenStr = "Unrecognized"; break;
     }
-    std::cout << "Token: " << tokenStr << "          Lexeme: " << token.lexeme << std::endl;
+    *trace << "Token: " << tokenStr << "          Lexeme: " << token.lexeme << "\n";
 }
 
-void Parser::advanceToken(){
+template <typename Sink>
+void BasicParser<Sink>::advanceToken(){
     if (currentToken.type != TokenType::END){
         // Print token information before advancing
         printTokenInfo(currentToken);
@@ -46,23 +46,49 @@ void Parser::advanceToken(){
     }
 }
 
-bool Parser::match(TokenType expectedType) const{
+template <typename Sink>
+bool BasicParser<Sink>::match(TokenType expectedType) const{
     return currentToken.type == expectedType;
 }
 
-bool Parser::matchLexeme(const std::string& expectedLexeme) const{
+template <typename Sink>
+bool BasicParser<Sink>::matchLexeme(const std::string& expectedLexeme) const{
     return currentToken.lexeme == expectedLexeme;
 }
 
-void Parser::error(const std::string& message) const {
+template <typename Sink>
+void BasicParser<Sink>::error(const std::string& message) const {
+    fail(Diagnostic::Kind::Syntax, message);
+}
+
+template <typename Sink>
+void BasicParser<Sink>::typeError(const std::string& message) const {
+    fail(Diagnostic::Kind::Type, message);
+}
+
+template <typename Sink>
+void BasicParser<Sink>::fail(Diagnostic::Kind kind, const std::string& message) const {
+    const std::string prefix = kind == Diagnostic::Kind::Syntax ? "Syntax error: " : "Type error: ";
     if (ruleOutputFile != nullptr) {
-        *ruleOutputFile << "Syntax error: " << message << " at token " << std::string(currentToken.lexeme) << std::endl;
+        *ruleOutputFile << prefix << message << " at token " << currentToken.lexeme << '\n';
     }
-    std::cerr << "Syntax error: " << message << " at token " << std::string(currentToken.lexeme) << std::endl;
-    throw std::runtime_error("Syntax error: " + message);
+    if (diagnostics != nullptr) {
+        *diagnostics << prefix << message << " at token " << currentToken.lexeme << "\n";
+    }
+    if (diagnosticList != nullptr) {
+        Diagnostic diagnostic;
+        diagnostic.kind = kind;
+        diagnostic.message = message;
+        diagnostic.lexeme = std::string(currentToken.lexeme);
+        diagnostic.offset = lexer.offsetOf(currentToken);
+        lexer.position(diagnostic.offset, diagnostic.line, diagnostic.column);
+        diagnosticList->push_back(std::move(diagnostic));
+    }
+    throw std::runtime_error(prefix + message);
 }
 
-void Parser::initializeParserStack(){
+template <typename Sink>
+void BasicParser<Sink>::initializeParserStack(){
     std::vector<std::string> keywords = {"function", "if", "else", "endif", "return", "print", "scan", "while", "endwhile", "true", "false", "integer", "boolean", "real"};
     std::vector<std::string> separators = {"(", ")", "{", "}", ";", ","};
 
@@ -78,14 +104,16 @@ void Parser::initializeParserStack(){
 // Add this function implementation to parser.cpp
 
 // Helper method to skip comments
-void Parser::skipComments() {
+template <typename Sink>
+void BasicParser<Sink>::skipComments() {
     while (match(TokenType::COMM)) {
         printTokenInfo(currentToken);
         advanceToken();
     }
 }
 
-void Parser::parseRat25s(){
+template <typename Sink>
+void BasicParser<Sink>::parseRat25s(){
     printProductionRule("<Rat25S> ::= $$ <Program> $$");
 
     // Skip any comments that appear before the opening $$
@@ -99,13 +127,24 @@ void Parser::parseRat25s(){
         } else {
             error("Expected $$ at end of Rat25s");
         }
+
+        // Sections after the first one (declarations, then statements) each end with $$
+        while (!match(TokenType::END)) {
+            parseProgram();
+            if (match(TokenType::SEPA) && currentToken.lexeme == "$$"){
+                advanceToken();
+            } else {
+                error("Expected $$ at end of section");
+            }
+        }
     } else {
         error("Expected $$ at start of Rat25s");
     }
 }
 
 
-void Parser::parseProgram() {
+template <typename Sink>
+void BasicParser<Sink>::parseProgram() {
     printProductionRule("<Program> ::= <Functions and Declarations and Statements>");
 
     // Continue parsing until we hit the closing $$ or end of file
@@ -119,7 +158,7 @@ void Parser::parseProgram() {
         }
         else if (match(TokenType::KEYW)) {
             if (currentToken.lexeme == "function") {
-                parseFunction();
+                if (!skipDeadFunction()) parseFunction();
             }
             else if (currentToken.lexeme == "integer" ||
                      currentToken.lexeme == "boolean" ||
@@ -145,7 +184,8 @@ void Parser::parseProgram() {
 }
 
 // R2. <Opt Function Definitions> ::= <Function Definitions> | <Empty>
-void Parser::parseOptFunctionDefinitions(){
+template <typename Sink>
+void BasicParser<Sink>::parseOptFunctionDefinitions(){
     printProductionRule("<Opt Function Definitions> ::= <Function Definitions> | <Empty>");
 
     if (currentToken.type == TokenType::KEYW && currentToken.lexeme == "function"){
@@ -154,7 +194,8 @@ void Parser::parseOptFunctionDefinitions(){
     // Empty production - do nothing
 }
 // R3. <Function Definitions> ::= <Function> | <Function> <Function Definitions>
-void Parser::parseFunctionDefinitions(){
+template <typename Sink>
+void BasicParser<Sink>::parseFunctionDefinitions(){
     printProductionRule("<Function Definitions> ::= <Function> | <Function> <Function Definitions>");
 
     parseFunction();
@@ -165,35 +206,58 @@ void Parser::parseFunctionDefinitions(){
 
 
 // R4. <Function> ::= function <Identifier> ( <Opt Parameter List> ) <Opt Declaration List> <Body>
-void Parser::parseFunction() {
+template <typename Sink>
+void BasicParser<Sink>::parseFunction() {
     printProductionRule("<Function> ::= function <Identifier> ( <Opt Parameter List> ) <Opt Declaration List> <Body>");
 
     if (match(TokenType::KEYW) && currentToken.lexeme == "function") {
         advanceToken();
         if (match(TokenType::IDENT)) {
-            std::string functionName = std::string(currentToken.lexeme);
+            std::string_view functionName = currentToken.lexeme;
             advanceToken();
-            codeGen.emit("LABEL", functionName);
+            int entry = sink.emit("LABEL", functionName);
             
             // Enter new scope for function
-            symbolTable.enterScope();
+            sink.enterScope();
             
             if (match(TokenType::SEPA) && currentToken.lexeme == "(") {
                 advanceToken();
+                int firstParam = sink.nextMemoryAddress();
+                paramTypes.clear();
                 parseOptParameterList();
+                int paramCount = sink.nextMemoryAddress() - firstParam;
+
+                // Known before the body so recursive calls can be checked
+                auto signature = functions.try_emplace(functionName, FunctionSignature{std::pmr::vector<ValueType>(memory)});
+                signature.first->second.params = paramTypes;
+                currentFunction = functionName;
+
+                // Arguments were pushed left to right, so the last parameter is on top
+                for (int addr = firstParam + paramCount - 1; addr >= firstParam; --addr) {
+                    sink.emit("POPM", std::to_string(addr));
+                }
+
                 if (match(TokenType::SEPA) && currentToken.lexeme == ")") {
                     advanceToken();
                     parseOptDeclarationList();
                     parseBody();
+
+                    // Falling off the end of a function returns. A trailing return
+                    // is enough unless some jump lands past it.
+                    if (sink.lastOp() != "RET" || sink.jumpsToEnd()) {
+                        sink.emit("RET");
+                    }
+                    sink.addFunction(functionName, entry, paramCount);
+                    currentFunction = {};
                     
                     // Exit function scope
-                    symbolTable.exitScope();
+                    sink.exitScope();
                 } else {
-                    symbolTable.exitScope();  // Clean up scope on error
+                    sink.exitScope();  // Clean up scope on error
                     error("Expected ')' after parameter list");
                 }
             } else {
-                symbolTable.exitScope();  // Clean up scope on error
+                sink.exitScope();  // Clean up scope on error
                 error("Expected '(' after function identifier");
             }
         } else {
@@ -204,8 +268,34 @@ void Parser::parseFunction() {
     }
 }
 
+// A dead function's tokens are jumped over without being parsed. In strict mode
+// they go through a parser that checks the grammar and makes nothing first.
+template <typename Sink>
+bool BasicParser<Sink>::skipDeadFunction() {
+    if (functionIndex == nullptr) return false;
+    const FunctionIndex::Span* span = functionIndex->skippable(lexer.offsetOf(currentToken));
+    if (span == nullptr) return false;
+
+    if (strict) {
+        lexer.seek(span->begin);
+        SyntaxParser checker(lexer, SyntaxSink(), scratch, scratch);
+        checker.trace = nullptr;
+        checker.diagnostics = diagnostics;
+        checker.diagnosticList = diagnosticList;
+        checker.ruleOutputFile = ruleOutputFile;
+        checker.parseFunction();
+        productions += checker.productions;
+    }
+    lexer.seek(span->end);
+    currentToken = lexer.getNextToken();
+    skipComments();
+    skipped++;
+    return true;
+}
+
 // R5. <Opt Parameter List> ::= <Parameter List> | <Empty>
-void Parser::parseOptParameterList(){
+template <typename Sink>
+void BasicParser<Sink>::parseOptParameterList(){
     printProductionRule("<Opt Parameter List> ::= <Parameter List> | <Empty>");
 
     if (currentToken.type == TokenType::IDENT) {
@@ -215,7 +305,8 @@ void Parser::parseOptParameterList(){
 }
 
 // R6. <Parameter List> ::= <Parameter> | <Parameter> , <Parameter List>
-void Parser::parseParameterList(){
+template <typename Sink>
+void BasicParser<Sink>::parseParameterList(){
     printProductionRule("<Parameter List> ::= <Parameter> | <Parameter> , <Parameter List>");
 
     parseParameter();
@@ -226,26 +317,35 @@ void Parser::parseParameterList(){
 }
 
 // R7. <Parameter> ::= <IDs > <Qualifier>
-void Parser::parseParameter(){
+template <typename Sink>
+void BasicParser<Sink>::parseParameter(){
     printProductionRule("<Parameter> ::= <IDs> <Qualifier>");
 
-    parseIDs();
-    parseQualifier();
+    std::pmr::vector<std::string_view> names = parseIDs();
+    ValueType type = parseQualifier();
+    declareIDs(names, type);
+    paramTypes.insert(paramTypes.end(), names.size(), type);
 }
 
 // R8. <Qualifier> ::= integer | boolean | real
-void Parser::parseQualifier() {
+template <typename Sink>
+ValueType BasicParser<Sink>::parseQualifier() {
     printProductionRule("<Qualifier> ::= integer | boolean | real");
 
     if (match(TokenType::KEYW) && (currentToken.lexeme == "integer" || currentToken.lexeme == "boolean" || currentToken.lexeme == "real")) {
+        ValueType type = currentToken.lexeme == "integer" ? ValueType::Integer
+                       : currentToken.lexeme == "real" ? ValueType::Real
+                       : ValueType::Boolean;
         advanceToken();
-    } else {
-        error("Expected type qualifier (integer, boolean, real)");
+        return type;
     }
+    error("Expected type qualifier (integer, boolean, real)");
+    return ValueType::Integer;
 }
 
 // R9. <Body> ::= { < Statement List> }
-void Parser::parseBody() {
+template <typename Sink>
+void BasicParser<Sink>::parseBody() {
     printProductionRule("<Body> ::= { <Statement List> }");
 
     if (match(TokenType::SEPA) && currentToken.lexeme == "{") {
@@ -263,7 +363,8 @@ void Parser::parseBody() {
 
 // Back to declarations
 // R10. <Opt Declaration List> ::= <Declaration List> | <Empty>
-void Parser::parseOptDeclarationList(){
+template <typename Sink>
+void BasicParser<Sink>::parseOptDeclarationList(){
     printProductionRule("<Opt Declaration List> ::= <Declaration List> | <Empty>");
 
     if (currentToken.type == TokenType::KEYW && (currentToken.lexeme == "integer" || currentToken.lexeme == "boolean" || currentToken.lexeme == "real")){
@@ -273,7 +374,8 @@ void Parser::parseOptDeclarationList(){
 }
 
 // R11. <Declaration List> := <Declaration> ; | <Declaration> ; <Declaration List>
-void Parser::parseDeclarationList(){
+template <typename Sink>
+void BasicParser<Sink>::parseDeclarationList(){
     printProductionRule("<Declaration List> ::= <Declaration> ; | <Declaration> ; <Declaration List>");
 
     parseDeclaration();
@@ -294,33 +396,35 @@ void Parser::parseDeclarationList(){
 }
 
 // R12. <Declaration> ::= <Qualifier > <IDs>
-void Parser::parseDeclaration(){
+// Each identifier may be followed by [ <Integer> ] to declare an array
+template <typename Sink>
+void BasicParser<Sink>::parseDeclaration(){
     printProductionRule("<Declaration> ::= <Qualifier> <IDs>");
 
-    parseQualifier();
-    parseIDs();
+    ValueType type = parseQualifier();
+    std::pmr::vector<int> lengths(scratch);
+    std::pmr::vector<std::string_view> names = parseIDs(&lengths);
+    declareIDs(names, type, &lengths);
 }
 
 // R13. <IDs> ::= <Identifier> | <Identifier>, <IDs>
-void Parser::parseIDs(){
+// With lengths, an identifier may have an array length, 0 going in for one without
+template <typename Sink>
+std::pmr::vector<std::string_view> BasicParser<Sink>::parseIDs(std::pmr::vector<int>* lengths){
     printProductionRule("<IDs> ::= <Identifier> | <Identifier>, <IDs>");
 
+    std::pmr::vector<std::string_view> names(scratch);
     if (match(TokenType::IDENT)) {
-        std::string name = std::string(currentToken.lexeme);
+        names.push_back(currentToken.lexeme);
         advanceToken();
-
-        if (!symbolTable.declare(name, "integer")){
-            error("Identifier '" + name + "' already declared");
-        }
+        if (lengths != nullptr) lengths->push_back(parseArrayLength());
 
         while(match(TokenType::SEPA) && currentToken.lexeme == ","){
             advanceToken();
             if (match(TokenType::IDENT)){
-                name = std::string(currentToken.lexeme);  // Get the new identifier
+                names.push_back(currentToken.lexeme);  // Get the new identifier
                 advanceToken();
-                if (!symbolTable.declare(name, "integer")){
-                    error("Identifier '" + name + "' already declared");
-                }
+                if (lengths != nullptr) lengths->push_back(parseArrayLength());
             } else {
                 error("Expected an identifier after ',' in ID list");
             }
@@ -328,11 +432,43 @@ void Parser::parseIDs(){
     } else {
         error("Expected an Identifier");
     }
+    return names;
+}
+
+// [ <Integer> ] after a declared identifier, 0 when there is none
+template <typename Sink>
+int BasicParser<Sink>::parseArrayLength() {
+    if (!match(TokenType::SEPA) || currentToken.lexeme != "[") return 0;
+    advanceToken();
+    // Nine digits can't overflow an int, and no array gets near that
+    if (!match(TokenType::INT) || currentToken.lexeme.size() > 9 || std::stoi(std::string(currentToken.lexeme)) == 0) {
+        error("Expected a positive integer array length");
+    }
+    int length = std::stoi(std::string(currentToken.lexeme));
+    advanceToken();
+    if (match(TokenType::SEPA) && currentToken.lexeme == "]") {
+        advanceToken();
+    } else {
+        error("Expected ']' after array length");
+    }
+    return length;
+}
+
+// Declarations learn their type from the qualifier, which parameters only give after the IDs
+template <typename Sink>
+void BasicParser<Sink>::declareIDs(const std::pmr::vector<std::string_view>& names, ValueType type,
+                                   const std::pmr::vector<int>* lengths) {
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (!sink.declare(names[i], type, lengths != nullptr ? (*lengths)[i] : 0)){
+            typeError("Identifier '" + std::string(names[i]) + "' already declared");
+        }
+    }
 }
 
 //Statements, body of code
 // R14. <Statement List> ::= <Statement> | <Statement> <Statement List>
-void Parser::parseStatementList(){
+template <typename Sink>
+void BasicParser<Sink>::parseStatementList(){
     printProductionRule("<Statement List> ::= <Statement> | <Statement> <Statement List>");
 
     parseStatement();
@@ -344,13 +480,19 @@ void Parser::parseStatementList(){
 
 // R15. <Statement> ::= <Compound> | <Assign> | <If> | <Return> | <Print> | <Scan> | <While>
 // Modified to also accept declarations inside function bodies
-void Parser::parseStatement(){
+template <typename Sink>
+void BasicParser<Sink>::parseStatement(){
     printProductionRule("<Statement> ::= <Compound> | <Assign> | <If> | <Return> | <Print> | <Scan> | <While> | <Declaration>");
 
     if (match(TokenType::SEPA) && currentToken.lexeme == "{") {
         parseCompound();
     } else if (match(TokenType::IDENT)){
-        parseAssign();
+        Token next = lexer.peekToken();
+        if (next.type == TokenType::SEPA && next.lexeme == "(") {
+            parseCallStatement();
+        } else {
+            parseAssign();
+        }
     } else if (match(TokenType::KEYW)){
         if (currentToken.lexeme == "if"){
             parseIf();
@@ -379,7 +521,8 @@ void Parser::parseStatement(){
 }
 
 // R16. <Compound> ::= { <Statement List> }
-void Parser::parseCompound() {
+template <typename Sink>
+void BasicParser<Sink>::parseCompound() {
     printProductionRule("<Compound> ::= { <Statement List> }");
 
     if (match(TokenType::SEPA) && currentToken.lexeme == "{") {
@@ -395,19 +538,40 @@ void Parser::parseCompound() {
     }
 }
 
-// R17. <Assign> ::= <Identifier> = <Expression> ;
-void Parser::parseAssign(){
+// R17. <Assign> ::= <Identifier> = <Expression> ; | <Identifier> <Index> = <Expression> ;
+template <typename Sink>
+void BasicParser<Sink>::parseAssign(){
     printProductionRule("<Assign> ::= <Identifier> = <Expression> ;");
 
     if (match(TokenType::IDENT)){
-        std::string target = std::string(currentToken.lexeme);
+        std::string_view target = currentToken.lexeme;
         advanceToken();
+        // An element's index goes on the stack under the value
+        bool element = match(TokenType::SEPA) && currentToken.lexeme == "[";
+        Symbol symbol{};
+        if (element) {
+            symbol = lookupVariable(target);
+            checkIndexed(target, symbol, true);
+            parseIndex(symbol);
+        }
 
         if (match(TokenType::OPER) && currentToken.lexeme == "="){
             advanceToken();
-            parseExpression();
-            std::cout << "[Assign] target = " << target << std::endl;
-            codeGen.emit("POPM", std::to_string(symbolTable.getAddress(target)));
+            ValueType valueType = parseExpression();
+            if (!element) {
+                symbol = lookupVariable(target);
+                checkIndexed(target, symbol, false);
+            }
+            if (Sink::checksTypes && valueType != symbol.type) {
+                typeError("cannot assign " + typeName(valueType) + " to " +
+                      typeName(symbol.type) + " '" + std::string(target) + "'");
+            }
+            if (trace != nullptr) *trace << "[Assign] target = " << target << "\n";
+            if (element) {
+                sink.storeElement(symbol);
+            } else {
+                sink.store(symbol);
+            }
             if (match(TokenType::SEPA) && currentToken.lexeme == ";"){
                 advanceToken();
             } else {
@@ -419,22 +583,135 @@ void Parser::parseAssign(){
     }
 }
 
+// Call statement: <Identifier> ( <Arguments> ) ;
+// The return value left in R1 is ignored
+template <typename Sink>
+void BasicParser<Sink>::parseCallStatement() {
+    printProductionRule("<Call Statement> ::= <Identifier> ( <Arguments> ) ;");
+
+    std::string_view callee = currentToken.lexeme;
+    advanceToken();
+    parseCall(callee, false);
+    if (match(TokenType::SEPA) && currentToken.lexeme == ";") {
+        advanceToken();
+    } else {
+        error("Expected ';' after function call");
+    }
+}
+
+// <Arguments> after the callee name: ( <Expression> {, <Expression>} ) pushed left to right
+// Returns the type the callee returns in R1
+template <typename Sink>
+ValueType BasicParser<Sink>::parseCall(std::string_view callee, bool resultUsed) {
+    auto fn = functions.find(callee);
+
+    std::pmr::vector<ValueType> args(scratch);
+    if (match(TokenType::SEPA) && currentToken.lexeme == "(") {
+        advanceToken();
+        if (!(match(TokenType::SEPA) && currentToken.lexeme == ")")) {
+            args.push_back(parseExpression());
+            while (match(TokenType::SEPA) && currentToken.lexeme == ","){
+                advanceToken();
+                args.push_back(parseExpression());
+            }
+        }
+        if (match(TokenType::SEPA) && currentToken.lexeme == ")"){
+            advanceToken();
+            sink.emit("CALL", callee);
+        } else {
+            error("Expected ')' after function arguments");
+        }
+    } else {
+        error("Expected '(' after function name");
+    }
+
+    if (!Sink::checksTypes) return ValueType::Integer;
+    if (fn == functions.end()) return importCall(callee, args, resultUsed);
+    const auto& params = fn->second.params;
+    if (args.size() != params.size()) {
+        typeError("Function '" + std::string(callee) + "' takes " + std::to_string(params.size()) +
+              " arguments, got " + std::to_string(args.size()));
+    }
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] != params[i]) {
+            typeError("argument " + std::to_string(i + 1) + " of '" + std::string(callee) + "' is " +
+                  typeName(args[i]) + ", expected " + typeName(params[i]));
+        }
+    }
+    // A recursive call can come before the first return, assume integer until one shows up
+    fn->second.returnTypeKnown = true;
+    return fn->second.returnType;
+}
+
+// A call to a function nothing before it defines: one defined further down,
+// or in a module one another module defines. The calls only have to agree with
+// each other here, the definition is checked by resolveImports or the linker.
+// The result is assumed to be an integer.
+template <typename Sink>
+ValueType BasicParser<Sink>::importCall(std::string_view callee, const std::pmr::vector<ValueType>& args, bool resultUsed) {
+    auto [it, added] = imports.try_emplace(callee, Import{std::pmr::vector<ValueType>(args, memory)});
+    if (added) {
+        sink.addImport(callee, static_cast<int>(args.size()));
+    } else if (it->second.params != args) {
+        typeError("Calls to '" + std::string(callee) + "' pass different arguments");
+    }
+    it->second.resultUsed = it->second.resultUsed || resultUsed;
+    return ValueType::Integer;
+}
+
+template <typename Sink>
+void BasicParser<Sink>::resolveImports() {
+    for (auto it = imports.begin(); it != imports.end();) {
+        auto fn = functions.find(it->first);
+        if (fn == functions.end()) {
+            ++it;
+            continue;
+        }
+        if (fn->second.params != it->second.params) {
+            typeError("Function '" + std::string(it->first) + "' is defined with other parameters than it is called with");
+        }
+        if (it->second.resultUsed && fn->second.returnType != ValueType::Integer) {
+            typeError("'" + std::string(it->first) + "' returns " + typeName(fn->second.returnType) +
+                  ", its result was used as integer before it was defined");
+        }
+        it = imports.erase(it);
+    }
+    if (moduleMode || imports.empty()) return;
+
+    // Outside a module every call needs a definition, the first call to one
+    // that never came is reported where it was made
+    auto first = imports.begin();
+    for (auto it = imports.begin(); it != imports.end(); ++it) {
+        if (it->first.data() < first->first.data()) first = it;
+    }
+    currentToken = {first->first, TokenType::IDENT};
+    typeError("Undeclared function '" + std::string(first->first) + "'");
+}
+
 // R18. <If> ::= if ( <Condition> ) <Statement> endif |
 // if ( <Condition> ) <Statement> else <Statement> endif
-void Parser::parseIf(){
+template <typename Sink>
+void BasicParser<Sink>::parseIf(){
     printProductionRule("<If> ::= if ( <Condition> ) <Statement> endif | if ( <Condition> ) <Statement> else <Statement> endif");
 
     if (match(TokenType::KEYW) && currentToken.lexeme == "if") {
         advanceToken();
         if (match(TokenType::SEPA) && currentToken.lexeme == "("){
             advanceToken();
-            parseCondition();
+            // Jump away when the condition fails so the then branch is the fall-through
+            Condition condition = parseCondition();
+            CodeGen::BackpatchList falseList({sink.emit(branchOp(condition, true))}, scratch);
             if (match(TokenType::SEPA) && currentToken.lexeme == ")"){
                 advanceToken();
                 parseStatement();
                 if (match(TokenType::KEYW) && currentToken.lexeme == "else"){
                     advanceToken();
+                    CodeGen::BackpatchList endList({sink.emit("JUMP")}, scratch);
+                    sink.backpatch(falseList, sink.getNextAddress());
                     parseStatement();
+                    sink.backpatch(endList, sink.getNextAddress());
+                } else {
+                    sink.backpatch(falseList, sink.getNextAddress());
                 }
                 if (match(TokenType::KEYW) && currentToken.lexeme == "endif"){
                     advanceToken();
@@ -451,18 +728,28 @@ void Parser::parseIf(){
 }
 
 // R19. <Return> ::= return ; | return <Expression> ;
-void Parser::parseReturn(){
+template <typename Sink>
+void BasicParser<Sink>::parseReturn(){
     printProductionRule("<Return> ::= return ; | return <Expression> ;");
 
     if (match(TokenType::KEYW) && currentToken.lexeme == "return") {
         advanceToken();
         if (match(TokenType::SEPA) && currentToken.lexeme == ";") {
             advanceToken();
-            codeGen.emit("RET");
+            sink.emit("RET");
         } else {
-            parseExpression();
-            codeGen.emit("POP", "R1");
-            codeGen.emit("RET");
+            ValueType type = parseExpression();
+            if (Sink::checksTypes && !currentFunction.empty()) {
+                FunctionSignature& fn = functions.at(currentFunction);
+                if (fn.returnTypeKnown && fn.returnType != type) {
+                    typeError("'" + std::string(currentFunction) + "' returns " + typeName(fn.returnType) +
+                          ", not " + typeName(type));
+                }
+                fn.returnType = type;
+                fn.returnTypeKnown = true;
+            }
+            sink.emit("POP", "R1");
+            sink.emit("RET");
             if (match(TokenType::SEPA) && currentToken.lexeme == ";") {
                 advanceToken();
             } else {
@@ -473,7 +760,8 @@ void Parser::parseReturn(){
 }
 
 // R20. <Print> ::= print ( <Expression> );
-void Parser::parsePrint() {
+template <typename Sink>
+void BasicParser<Sink>::parsePrint() {
     printProductionRule("<Print> ::= print ( <Expression> );");
 
     if (match(TokenType::KEYW) && currentToken.lexeme == "print") {
@@ -481,7 +769,7 @@ void Parser::parsePrint() {
         if (match(TokenType::SEPA) && currentToken.lexeme == "(") {
             advanceToken();
             parseExpression();
-            codeGen.emit("OUT");
+            sink.emit("OUT");
             if (match(TokenType::SEPA) && currentToken.lexeme == ")") {
                 advanceToken();
                 if (match(TokenType::SEPA) && currentToken.lexeme == ";") {
@@ -499,14 +787,20 @@ void Parser::parsePrint() {
 }
 
 // R21. <Scan> ::= scan ( <IDs> );
-void Parser::parseScan() {
+template <typename Sink>
+void BasicParser<Sink>::parseScan() {
     printProductionRule("<Scan> ::= scan ( <IDs> );");
 
     if (match(TokenType::KEYW) && currentToken.lexeme == "scan") {
         advanceToken();
         if (match(TokenType::SEPA) && currentToken.lexeme == "(") {
             advanceToken();
-            parseIDs();
+            for (const auto& name : parseIDs()) {
+                Symbol symbol = lookupVariable(name);
+                checkIndexed(name, symbol, false);
+                sink.emit("IN");
+                sink.store(symbol);
+            }
             if (match(TokenType::SEPA) && currentToken.lexeme == ")") {
                 advanceToken();
                 if (match(TokenType::SEPA) && currentToken.lexeme == ";") {
@@ -525,17 +819,27 @@ void Parser::parseScan() {
 
 // R22. <While> ::= while ( <Condition> ) <Statement> endwhile [;]
 // Modified to handle optional semicolon after endwhile
-void Parser::parseWhile() {
+template <typename Sink>
+void BasicParser<Sink>::parseWhile() {
     printProductionRule("<While> ::= while ( <Condition> ) <Statement> endwhile [;]");
 
     if (match(TokenType::KEYW) && currentToken.lexeme == "while") {
         advanceToken();
         if (match(TokenType::SEPA) && currentToken.lexeme == "(") {
             advanceToken();
-            parseCondition();
+            // The test goes at the bottom of the loop so each iteration runs one
+            // compare-and-branch. Hold its code back until the body is emitted.
+            sink.beginCapture();
+            Condition condition = parseCondition();
+            auto test = sink.endCapture();
+            CodeGen::BackpatchList entryList({sink.emit("JUMP")}, scratch);
+            int bodyStart = sink.getNextAddress();
             if (match(TokenType::SEPA) && currentToken.lexeme == ")") {
                 advanceToken();
                 parseStatement();
+                sink.backpatch(entryList, sink.getNextAddress());
+                sink.append(test);
+                sink.emit(branchOp(condition, false), std::to_string(bodyStart));
                 if (match(TokenType::KEYW) && currentToken.lexeme == "endwhile") {
                     advanceToken();
                     // Handle optional semicolon after endwhile
@@ -555,149 +859,260 @@ void Parser::parseWhile() {
 }
 
 // R23. <Condition> ::= <Expression> <Relop> <Expression>
-void Parser::parseCondition() {
+// Leaves both operands on the stack and returns the relop, the caller emits the branch
+template <typename Sink>
+typename BasicParser<Sink>::Condition BasicParser<Sink>::parseCondition() {
     printProductionRule("<Condition> ::= <Expression> <Relop> <Expression>");
 
-    parseExpression(); // Left side of the condition
+    ValueType left = parseExpression(); // Left side of the condition
     if (match(TokenType::OPER) && (currentToken.lexeme == "==" || currentToken.lexeme == "!=" ||
         currentToken.lexeme == ">" || currentToken.lexeme == "<" ||
         currentToken.lexeme == "<=" || currentToken.lexeme == ">=")) {
+        std::string_view relop = currentToken.lexeme;
         advanceToken();
-        parseExpression(); // Right side of the condition
-    } else {
-        error("Expected relational operator in condition");
+        ValueType right = parseExpression(); // Right side of the condition
+
+        if (Sink::checksTypes && left != right) {
+            typeError("cannot compare " + typeName(left) + " with " + typeName(right));
+        }
+        if (Sink::checksTypes && left == ValueType::Boolean && relop != "==" && relop != "!=") {
+            typeError("Booleans can only be compared with == and !=");
+        }
+        return {relop, left};
     }
+    error("Expected relational operator in condition");
+    return {"", left};
+}
+
+// Fused compare-and-branch for a relop, or for its inverse when negate is set.
+// Booleans are 0/1 so they share the integer branches.
+template <typename Sink>
+std::string BasicParser<Sink>::branchOp(const Condition& condition, bool negate) {
+    std::string_view relop = condition.relop;
+    std::string op;
+    if (relop == "==") op = negate ? "JNE" : "JEQ";
+    else if (relop == "!=") op = negate ? "JEQ" : "JNE";
+    else if (relop == ">") op = negate ? "JLE" : "JGT";
+    else if (relop == "<") op = negate ? "JGE" : "JLT";
+    else if (relop == "<=") op = negate ? "JGT" : "JLE";
+    else op = negate ? "JLT" : "JGE";
+    return condition.type == ValueType::Real ? op + "F" : op;
 }
 
 // R24. <Relop> ::= == | != | > | < | <= | >=
 // Note: This is handled in parseCondition()
 
+// <Index> ::= [ <Expression> ], leaves the integer index on the stack. A literal
+// index is checked against the array's length.
+template <typename Sink>
+void BasicParser<Sink>::parseIndex(const Symbol& array) {
+    printProductionRule("<Index> ::= [ <Expression> ]");
+
+    advanceToken();
+    if (Sink::checksTypes && match(TokenType::INT)) {
+        Token next = lexer.peekToken();
+        if (next.type == TokenType::SEPA && next.lexeme == "]" &&
+            (currentToken.lexeme.size() > 9 || std::stoi(std::string(currentToken.lexeme)) >= array.length)) {
+            typeError("Array index " + std::string(currentToken.lexeme) + " is out of bounds");
+        }
+    }
+    ValueType type = parseExpression();
+    if (Sink::checksTypes && type != ValueType::Integer) {
+        typeError("Array index must be an integer, not " + typeName(type));
+    }
+    if (match(TokenType::SEPA) && currentToken.lexeme == "]") {
+        advanceToken();
+    } else {
+        error("Expected ']' after array index");
+    }
+}
+
+// An array is only ever used an element at a time, and only an array has elements
+template <typename Sink>
+void BasicParser<Sink>::checkIndexed(std::string_view name, const Symbol& symbol, bool indexed) const {
+    if (!Sink::checksTypes || indexed == (symbol.length > 0)) return;
+    if (indexed) {
+        typeError("'" + std::string(name) + "' is not an array");
+    } else {
+        typeError("Array '" + std::string(name) + "' needs an index");
+    }
+}
+
+template <typename Sink>
+Symbol BasicParser<Sink>::lookupVariable(std::string_view name) {
+    if (const Symbol* symbol = sink.lookup(name)) return *symbol;
+    // The name has been read already, the error points back at it
+    currentToken = {name, TokenType::IDENT};
+    typeError("Variable " + std::string(name) + " not found in any scope");
+}
+
+// Integer and real operands can't be mixed and booleans don't do arithmetic
+template <typename Sink>
+ValueType BasicParser<Sink>::arithmeticType(ValueType left, ValueType right, std::string_view op) const {
+    if (!Sink::checksTypes) return left;
+    if (left == ValueType::Boolean || right == ValueType::Boolean) {
+        typeError("boolean operand to '" + std::string(op) + "'");
+    }
+    if (left != right) {
+        typeError("cannot mix " + typeName(left) + " and " + typeName(right) + " in '" + std::string(op) + "'");
+    }
+    return left;
+}
+
+// Type-specialized opcode, ADD -> ADDI / ADDF
+template <typename Sink>
+std::string BasicParser<Sink>::typedOp(const std::string& op, ValueType type) {
+    return op + (type == ValueType::Real ? "F" : "I");
+}
+
 // Removing left recursion from the Expression grammar
 // Original: R25. <Expression> ::= <Expression> + <Term> | <Expression> - <Term> | <Term>
 // Modified: R25. <Expression> ::= <Term> <Expression'>
-void Parser::parseExpression() {
+template <typename Sink>
+ValueType BasicParser<Sink>::parseExpression() {
     printProductionRule("<Expression> ::= <Term> <Expression'>");
-    parseTerm();
-    parseExpressionPrime();
+    ValueType left = parseTerm();
+    return parseExpressionPrime(left);
 }
 
 // R25a. <Expression'> ::= + <Term> <Expression'> | - <Term> <Expression'> | ε
-void Parser::parseExpressionPrime() {
+template <typename Sink>
+ValueType BasicParser<Sink>::parseExpressionPrime(ValueType left) {
     printProductionRule("<Expression'> ::= + <Term> <Expression'> | - <Term> <Expression'> | ε");
 
     if (match(TokenType::OPER) && (currentToken.lexeme == "+" || currentToken.lexeme == "-")) {
         if (currentToken.lexeme == "+") {
             advanceToken();
-            parseTerm();
-            codeGen.emit("A");
-            parseExpressionPrime();
+            ValueType type = arithmeticType(left, parseTerm(), "+");
+            sink.emit(typedOp("ADD", type));
+            return parseExpressionPrime(type);
         }
         else if (currentToken.lexeme == "-") {
             advanceToken();
-            parseTerm();
-            codeGen.emit("S");
-            parseExpressionPrime();
+            ValueType type = arithmeticType(left, parseTerm(), "-");
+            sink.emit(typedOp("SUB", type));
+            return parseExpressionPrime(type);
         }        
     }
     // ε case - do nothing
+    return left;
 }
 
 // Removing left recursion from the Term grammar
 // Original: R26. <Term> ::= <Term> * <Factor> | <Term> / <Factor> | <Factor>
 // Modified: R26. <Term> ::= <Factor> <Term'>
-void Parser::parseTerm() {
+template <typename Sink>
+ValueType BasicParser<Sink>::parseTerm() {
     printProductionRule("<Term> ::= <Factor> <Term'>");
 
-    parseFactor();
-    parseTermPrime();
+    ValueType left = parseFactor();
+    return parseTermPrime(left);
 }
 
 // R26a. <Term'> ::= * <Factor> <Term'> | / <Factor> <Term'> | ε
-void Parser::parseTermPrime() {
+template <typename Sink>
+ValueType BasicParser<Sink>::parseTermPrime(ValueType left) {
     printProductionRule("<Term'> ::= * <Factor> <Term'> | / <Factor> <Term'> | ε");
 
     if (match(TokenType::OPER) && (currentToken.lexeme == "*" || currentToken.lexeme == "/")) {
-        std::string op = std::string(currentToken.lexeme);
+        std::string_view op = currentToken.lexeme;
         advanceToken();
-        parseFactor();
+        ValueType type = arithmeticType(left, parseFactor(), op);
 
         if (op == "*")
-            codeGen.emit("M");
+            sink.emit(typedOp("MUL", type));
         else if (op == "/")
-            codeGen.emit("D");
+            sink.emit(typedOp("DIV", type));
 
-        parseTermPrime();
+        return parseTermPrime(type);
     }
     // ε production – do nothing
+    return left;
 }
 
 
 // R27. <Factor> ::= - <Primary> | <Primary>
-void Parser::parseFactor() {
+template <typename Sink>
+ValueType BasicParser<Sink>::parseFactor() {
     printProductionRule("<Factor> ::= - <Primary> | <Primary>");
 
     if (match(TokenType::OPER) && currentToken.lexeme == "-") {
         advanceToken();
-        parsePrimary();
-    } else {
-        parsePrimary();
+        ValueType type = parsePrimary();
+        if (Sink::checksTypes && type == ValueType::Boolean) {
+            typeError("cannot negate a boolean");
+        }
+        sink.emit(typedOp("NEG", type));
+        return type;
     }
+    return parsePrimary();
 }
 
 // R28. <Primary> ::= <Identifier> | <Integer> | <Identifier> ( <IDs> ) | ( <Expression> ) | <Real> | true | false
-void Parser::parsePrimary() {
-    std::cout << "[Primary] found identifier(1): " << currentToken.lexeme << std::endl;
+// plus <Identifier> <Index> for an array element
+template <typename Sink>
+ValueType BasicParser<Sink>::parsePrimary() {
+    if (trace != nullptr) *trace << "[Primary] found identifier(1): " << currentToken.lexeme << "\n";
 
     printProductionRule("<Primary> ::= <Identifier> | <Integer> | <Identifier> ( <IDs> ) | ( <Expression> ) | <Real> | true | false");
 
     if (match(TokenType::IDENT)) {
-        std::string ident = std::string(currentToken.lexeme);
-        std::cout << "[Primary] found identifier(2): " << currentToken.lexeme << std::endl;
+        std::string_view ident = currentToken.lexeme;
+        if (trace != nullptr) *trace << "[Primary] found identifier(2): " << currentToken.lexeme << "\n";
         //codeGen.emit("PUSHM", std::to_string(symbolTable.getAddress(std::string(currentToken.lexeme))));
         advanceToken();
-        // Check for function call syntax
+        // Check for function call syntax, the result comes back in R1
         if (match(TokenType::SEPA) && currentToken.lexeme == "(") {
-            advanceToken();
-            //parseIDs(); // Function call arguments
-            if (!(match(TokenType::SEPA) && currentToken.lexeme == ")")) {
-                parseExpression();
-                while (match(TokenType::SEPA) && currentToken.lexeme == ","){
-                    advanceToken();
-                    parseExpression();
-                }
-            }
-            if (match(TokenType::SEPA) && currentToken.lexeme == ")"){
-                advanceToken();
-                codeGen.emit("CALL", ident);
-            } else {
-                error("Expected ')' after function arguments");
-            }
+            ValueType type = parseCall(ident);
+            sink.emit("PUSH", "R1");
+            return type;
+        }
+        Symbol symbol = lookupVariable(ident);
+        bool element = match(TokenType::SEPA) && currentToken.lexeme == "[";
+        checkIndexed(ident, symbol, element);
+        if (element) {
+            parseIndex(symbol);
+            sink.loadElement(symbol);
         } else {
-            codeGen.emit("PUSHM", std::to_string(symbolTable.getAddress(ident)));
+            sink.load(symbol);
         }
-    } else if (match(TokenType::INT) || match(TokenType::REAL)) {
-        codeGen.emit("PUSHI", std::string(currentToken.lexeme));
+        return symbol.type;
+    } else if (match(TokenType::INT)) {
+        sink.emit("PUSHI", currentToken.lexeme);
+        advanceToken();
+        return ValueType::Integer;
+    } else if (match(TokenType::REAL)) {
+        // Reals live in the constant pool, PUSHF takes the pool index
+        int index = sink.addConstant(currentToken.lexeme);
+        sink.emit("PUSHF", std::to_string(index));
         advanceToken();
+        return ValueType::Real;
     } else if (match(TokenType::SEPA) && currentToken.lexeme == "(") {
         advanceToken();
-        parseExpression();
+        ValueType type = parseExpression();
         if (match(TokenType::SEPA) && currentToken.lexeme == ")") {
             advanceToken();
         } else {
             error("Expected a matching ')' after sub-expression");
         }
+        return type;
     } else if (match(TokenType::KEYW) && (currentToken.lexeme == "true" || currentToken.lexeme == "false")) {
-        codeGen.emit("PUSHI", currentToken.lexeme == "true" ? "1" : "0");
+        sink.emit("PUSHI", currentToken.lexeme == "true" ? "1" : "0");
         advanceToken();
-    } else {
-        error("Expected an identifier, number, or sub-expression");
+        return ValueType::Boolean;
     }
+    error("Expected an identifier, number, or sub-expression");
+    return ValueType::Integer;
 }
 
-Parser::Parser(Lexer& lexer, SymbolTable& symbolTable, CodeGen& codeGen)
-    : lexer(lexer), symbolTable(symbolTable), codeGen(codeGen), currentToken(lexer.getNextToken()) {}
+template <typename Sink>
+BasicParser<Sink>::BasicParser(Lexer& lexer, Sink sink, std::pmr::memory_resource* memory,
+                               std::pmr::memory_resource* scratch)
+    : lexer(lexer), sink(sink), memory(memory), scratch(scratch), functions(memory),
+      paramTypes(memory), imports(memory), currentToken(lexer.getNextToken()) {}
 
-void Parser::fillParserStack(std::vector<std::string> tokens) {
+template <typename Sink>
+void BasicParser<Sink>::fillParserStack(std::vector<std::string> tokens) {
     // Clear the stack first (in case it already has elements)
     while (!parserStack.empty()) {
         parserStack.pop();
@@ -709,38 +1124,100 @@ void Parser::fillParserStack(std::vector<std::string> tokens) {
     }
 
     // Debug output to check stack content
-    std::cout << "Parser stack filled with " << tokens.size() << " tokens." << std::endl;
+    if (trace != nullptr) *trace << "Parser stack filled with " << tokens.size() << " tokens." << "\n";
 }
 
-void Parser::setOutputFile(std::ofstream& outFile) {
+template <typename Sink>
+void BasicParser<Sink>::setOutputFile(OutputWriter& outFile) {
     ruleOutputFile = &outFile;
 }
 
-void Parser::setRulePrinting(bool enabled) {
+template <typename Sink>
+void BasicParser<Sink>::setTrace(std::ostream* out) {
+    trace = out;
+}
+
+template <typename Sink>
+void BasicParser<Sink>::setDiagnostics(std::ostream* out) {
+    diagnostics = out;
+}
+
+template <typename Sink>
+void BasicParser<Sink>::setDiagnosticList(std::vector<Diagnostic>* list) {
+    diagnosticList = list;
+}
+
+template <typename Sink>
+void BasicParser<Sink>::setTokenPrinting(bool enabled) {
+    printTokenInfoEnabled = enabled;
+}
+
+template <typename Sink>
+void BasicParser<Sink>::setRulePrinting(bool enabled) {
     printRules = enabled;
 }
 
-void Parser::parse() {
+template <typename Sink>
+void BasicParser<Sink>::setModuleMode(bool enabled) {
+    moduleMode = enabled;
+}
+
+template <typename Sink>
+void BasicParser<Sink>::setFunctionIndex(const FunctionIndex* index, bool strict) {
+    functionIndex = index;
+    this->strict = strict;
+}
+
+template <typename Sink>
+void BasicParser<Sink>::parse() {
     try {
         parseRat25s();
+        resolveImports();
         if (ruleOutputFile != nullptr) {
-            *ruleOutputFile << "Parsing completed successfully!" << std::endl;
+            *ruleOutputFile << "Parsing completed successfully!\n";
         }
     } catch (const std::exception& e) {
         if (ruleOutputFile != nullptr) {
-            *ruleOutputFile << "Parsing failed: " << e.what() << std::endl;
+            *ruleOutputFile << "Parsing failed: " << e.what() << '\n';
         }
         throw; // Re-throw the exception to be caught by the main program
     }
 }
 
-void Parser::outputParseTree(std::ofstream& outFile) const {
-    outFile << "\nParse Tree Summary:" << std::endl;
-    outFile << "===================" << std::endl;
-    outFile << "The parser applied a recursive descent parsing algorithm" << std::endl;
-    outFile << "following the Rat25S grammar (with left recursion removed)" << std::endl;
-    outFile << "to analyze the input program." << std::endl;
+template <typename Sink>
+std::vector<FunctionType> BasicParser<Sink>::definedFunctions() const {
+    std::vector<FunctionType> types;
+    for (const auto& [name, fn] : functions) {
+        types.push_back({std::string(name), {fn.params.begin(), fn.params.end()}, fn.returnType});
+    }
+    std::sort(types.begin(), types.end(), [](const auto& a, const auto& b) { return a.name < b.name; });
+    return types;
+}
+
+template <typename Sink>
+std::vector<FunctionType> BasicParser<Sink>::importedFunctions() const {
+    std::vector<FunctionType> types;
+    for (const auto& [name, call] : imports) {
+        // Until the linker sees the definition a result is taken to be an integer
+        types.push_back({std::string(name), {call.params.begin(), call.params.end()}, ValueType::Integer,
+                         call.resultUsed});
+    }
+    std::sort(types.begin(), types.end(), [](const auto& a, const auto& b) { return a.name < b.name; });
+    return types;
+}
+
+template <typename Sink>
+void BasicParser<Sink>::outputParseTree(OutputWriter& outFile) const {
+    outFile << "\nParse Tree Summary:\n"
+               "===================\n"
+               "The parser applied a recursive descent parsing algorithm\n"
+               "following the Rat25S grammar (with left recursion removed)\n"
+               "to analyze the input program.\n";
 
     // Output information about remaining tokens in the parser stack
-    outFile << "\nRemaining items in parser stack: " << parserStack.size() << std::endl;
-}
\ No newline at end of file
+    outFile << "\nRemaining items in parser stack: " << parserStack.size() << '\n';
+}
+
+template class BasicParser<SyntaxSink>;
+template class BasicParser<SymbolSink>;
+template class BasicParser<CodeSink>;
@@ -3,28 +3,101 @@
 
 #include <vector>
 #include <iostream>
+#include <memory_resource>
 #include <stack>
 #include <variant>
 #include <string>
 #include <fstream>
+#include <unordered_map>
 
 #include "Lexer.h"
 #include "CodeGen.h"
 #include "SymbolTable.h"
+#include "OutputWriter.h"
+#include "Diagnostic.h"
+#include "ObjectModule.h"
+#include "ParseSink.h"
+#include "FunctionIndex.h"
+
+// Recursive descent parser for Rat25S that type checks as it goes and hands
+// declarations and code to its sink (ParseSink.h). The member functions are in
+// parser.cpp, instantiated there for the three sinks.
+template <typename Sink>
+class BasicParser {
+    // A strict lazy parse checks the functions it skips with a SyntaxParser
+    template <typename> friend class BasicParser;
 
-class Parser {
 private:
+    struct FunctionSignature {
+        std::pmr::vector<ValueType> params;
+        ValueType returnType = ValueType::Integer;
+        bool returnTypeKnown = false;
+    };
+
+    struct Condition {
+        std::string_view relop;
+        ValueType type;
+    };
+
     Lexer& lexer;
-    Token currentToken;
     std::stack<std::variant<std::string, TokenType>> parserStack;
 
-    CodeGen& codeGen;
-    SymbolTable& symbolTable;
+    Sink sink;
+
+    // What the parser keeps for the whole compilation, the signatures, comes
+    // from memory, normally the compilation's arena. Lists that only live for a
+    // statement come from scratch, which takes them back for the next one.
+    // Names are views into the Lexer's buffer, which outlives the Parser, so
+    // identifiers are never copied.
+    std::pmr::memory_resource* memory;
+    std::pmr::memory_resource* scratch;
+
+    // Type information for calls, and the function whose body is being parsed
+    std::pmr::unordered_map<std::string_view, FunctionSignature> functions;
+    std::pmr::vector<ValueType> paramTypes;
+    std::string_view currentFunction;
+
+    // Calls to functions not defined yet. Compiling an object module, the ones
+    // the module never defines are its imports.
+    struct Import {
+        std::pmr::vector<ValueType> params;
+        bool resultUsed = false;
+    };
+    bool moduleMode = false;
+    std::pmr::unordered_map<std::string_view, Import> imports;
+
+    // Read in the constructor, after everything above is set up
+    Token currentToken;
+
+    // Lazy compiles skip the functions the index found dead
+    const FunctionIndex* functionIndex = nullptr;
+    bool strict = false;
+    size_t skipped = 0;
+
+    // Where this compilation's messages go. The trace gets debug output and the
+    // rule/token listings when they are switched on, diagnostics gets syntax
+    // errors. nullptr silences either.
+    OutputWriter* ruleOutputFile = nullptr;
+    std::ostream* trace = &std::cout;
+    std::ostream* diagnostics = &std::cerr;
+    std::vector<Diagnostic>* diagnosticList = nullptr;
+    bool printRules = false;
+    bool printTokenInfoEnabled = false;
+
+    size_t productions = 0;
+
+    // Called at the start of every production, which is also where they are counted
+    void printProductionRule(std::string_view rule);
+    void printTokenInfo(const Token& token) const;
 
     void advanceToken();
     bool match(TokenType expectedType) const;
     bool matchLexeme(const std::string& expectedLexeme) const;
-    void error(const std::string& message) const;
+    // A program that doesn't follow the grammar
+    [[noreturn]] void error(const std::string& message) const;
+    // One that does but breaks a rule on names or types
+    [[noreturn]] void typeError(const std::string& message) const;
+    [[noreturn]] void fail(Diagnostic::Kind kind, const std::string& message) const;
     void initializeParserStack();
     void skipComments();
 
@@ -34,42 +107,88 @@ private:
     void parseOptFunctionDefinitions();
     void parseFunctionDefinitions();
     void parseFunction();
+    bool skipDeadFunction();
     void parseOptParameterList();
     void parseParameterList();
     void parseParameter();
-    void parseQualifier();
+    ValueType parseQualifier();
     void parseBody();
     void parseOptDeclarationList();
     void parseDeclarationList();
     void parseDeclaration();
-    void parseIDs();
+    std::pmr::vector<std::string_view> parseIDs(std::pmr::vector<int>* lengths = nullptr);
+    int parseArrayLength();
+    void declareIDs(const std::pmr::vector<std::string_view>& names, ValueType type,
+                    const std::pmr::vector<int>* lengths = nullptr);
     void parseStatementList();
     void parseStatement();
     void parseCompound();
     void parseAssign();
+    void parseCallStatement();
+    ValueType parseCall(std::string_view callee, bool resultUsed = true);
+    ValueType importCall(std::string_view callee, const std::pmr::vector<ValueType>& args, bool resultUsed);
+    // Calls to functions defined after them, checked against the definition.
+    // Outside a module a call nothing defines is an error.
+    void resolveImports();
     void parseIf();
     void parseReturn();
     void parsePrint();
     void parseScan();
     void parseWhile();
-    void parseCondition();
+    Condition parseCondition();
+    static std::string branchOp(const Condition& condition, bool negate);
+
+    ValueType parseExpression();
+    ValueType parseExpressionPrime(ValueType left);
+    ValueType parseTerm();
+    ValueType parseTermPrime(ValueType left);
+    ValueType parseFactor();
+    ValueType parsePrimary();
+    void parseIndex(const Symbol& array);
+    void checkIndexed(std::string_view name, const Symbol& symbol, bool indexed) const;
+    // The variable name refers to, an undeclared one is an error at name
+    Symbol lookupVariable(std::string_view name);
 
-    void parseExpression();
-    void parseExpressionPrime();
-    void parseTerm();
-    void parseTermPrime();
-    void parseFactor();
-    void parsePrimary();
+    // Checks an arithmetic operand pair and returns the result type
+    ValueType arithmeticType(ValueType left, ValueType right, std::string_view op) const;
+    static std::string typedOp(const std::string& op, ValueType type);
 
 public:
-    explicit Parser(Lexer& lexer, SymbolTable& symbolTable, CodeGen& codeGen);
+    BasicParser(Lexer& lexer, Sink sink, std::pmr::memory_resource* memory = std::pmr::get_default_resource(),
+                std::pmr::memory_resource* scratch = std::pmr::get_default_resource());
 
-    static void setOutputFile(std::ofstream& outFile);
-    static void setRulePrinting(bool enabled);
+    void setOutputFile(OutputWriter& outFile);
+    void setTrace(std::ostream* out);
+    void setDiagnostics(std::ostream* out);
+    // Errors are also added here as data, nullptr for not
+    void setDiagnosticList(std::vector<Diagnostic>* list);
+    void setRulePrinting(bool enabled);
+    void setTokenPrinting(bool enabled);
+    // Compile an object module: a call may name a function no earlier code
+    // defines, the linker or a later definition resolves it
+    void setModuleMode(bool enabled);
+    // Skip the functions index says nothing reachable calls. strict still runs
+    // their tokens through the grammar, without compiling them.
+    void setFunctionIndex(const FunctionIndex* index, bool strict);
     void fillParserStack(std::vector<std::string> tokens);
 
     void parse();
-    void outputParseTree(std::ofstream& outFile) const;
+    size_t productionCount() const { return productions; }
+    size_t skippedFunctions() const { return skipped; }
+    // Types of the functions this program defines and, in module mode, of the
+    // ones it calls without defining. Sorted by name.
+    std::vector<FunctionType> definedFunctions() const;
+    std::vector<FunctionType> importedFunctions() const;
+    void outputParseTree(OutputWriter& outFile) const;
 };
 
+extern template class BasicParser<SyntaxSink>;
+extern template class BasicParser<SymbolSink>;
+extern template class BasicParser<CodeSink>;
+
+// The compiler's parser, and the cheaper ones that only check a program
+using Parser = BasicParser<CodeSink>;
+using SymbolParser = BasicParser<SymbolSink>;
+using SyntaxParser = BasicParser<SyntaxSink>;
+
 #endif // PARSER_H
@@ -0,0 +1,98 @@
+// Thin front end for a compiler started with --serve. Takes the same arguments
+// as the compiler and leaves the same output file, trace and exit status, but
+// the work happens in the running server.
+#include "classes/OutputWriter.h"
+#include "classes/Protocol.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> args;
+    std::string socketPath = defaultSocketPath();
+    RequestOptions options;
+    options.flags = RequestOptions::traceFlag;
+    bool sendSource = false;
+    bool stopServer = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--socket=", 0) == 0) {
+            socketPath = arg.substr(9);
+        } else if (arg == "--stream") {
+            options.flags |= RequestOptions::streamFlag;
+        } else if (arg.rfind("--stream=", 0) == 0) {
+            options.flags |= RequestOptions::streamFlag;
+            options.window = std::stoul(arg.substr(9));
+        } else if (arg == "--quiet") {
+            options.flags &= ~RequestOptions::traceFlag;
+        } else if (arg == "--send-source") {
+            sendSource = true;
+        } else if (arg == "--stop") {
+            stopServer = true;
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (args.size() != 2 && !stopServer) {
+        std::cerr << "Usage: " << argv[0] << " [--socket=path|tcp:[host:]port] [--stream[=window]] [--quiet] [--send-source]"
+                  << " <input_file> <output_file>\n"
+                  << "       " << argv[0] << " [--socket=path] --stop\n";
+        return 1;
+    }
+
+    int server = connectTo(socketPath);
+    if (server < 0) {
+        std::cerr << "Could not connect to the compile server at " << socketPath << "\n";
+        return 1;
+    }
+    struct FdCloser { int fd; ~FdCloser() { close(fd); } } serverCloser{server};
+    if (stopServer) {
+        return writeFrame(server, 'Q', "") ? 0 : 1;
+    }
+
+    int fd = open(args[1].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Could not open output file.\n";
+        return 1;
+    }
+    FdCloser outputCloser{fd};
+    OutputWriter outFile(fd);
+
+    // The server may run in another directory, a path has to be absolute. With
+    // --send-source the server never touches the input at all.
+    std::string request = encodeOptions(options);
+    if (sendSource) {
+        int in = open(args[0].c_str(), O_RDONLY);
+        if (in < 0) {
+            outFile << "Exception: Could not open input.txt file\n";
+            return 1;
+        }
+        char block[1 << 16];
+        ssize_t n;
+        while ((n = read(in, block, sizeof(block))) > 0) request.append(block, n);
+        close(in);
+    } else {
+        request += std::filesystem::absolute(args[0]).string();
+    }
+    if (!writeFrame(server, sendSource ? 'S' : 'P', request)) {
+        std::cerr << "Lost the connection to the compile server\n";
+        return 1;
+    }
+
+    Frame reply;
+    while (readFrame(server, reply)) {
+        switch (reply.type) {
+            case 'T': std::cout << reply.payload; break;
+            case 'D': std::cerr << reply.payload; break;
+            case 'O': outFile << reply.payload; break;
+            case 'R': return !reply.payload.empty() && reply.payload[0] == '\0' ? 0 : 1;
+            default: break;
+        }
+    }
+    std::cerr << "Lost the connection to the compile server\n";
+    return 1;
+}
@@ -0,0 +1,81 @@
+// Writes a synthetic Rat25S program, for benchmarks and scaling tests. The same
+// flags always give the same program.
+#include "classes/OutputWriter.h"
+#include "classes/ProgramGenerator.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+
+// 64K, 10M, 2G
+static uint64_t parseSize(const std::string& text) {
+    size_t end;
+    uint64_t value = std::stoull(text, &end);
+    if (end < text.size()) {
+        switch (text[end]) {
+            case 'k': case 'K': value <<= 10; break;
+            case 'm': case 'M': value <<= 20; break;
+            case 'g': case 'G': value <<= 30; break;
+            default: throw std::invalid_argument("bad size " + text);
+        }
+    }
+    return value;
+}
+
+int main(int argc, char* argv[]) {
+    GeneratorOptions options;
+    std::string outputFile;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.rfind("--seed=", 0) == 0) {
+                options.seed = std::stoull(arg.substr(7));
+            } else if (arg.rfind("--size=", 0) == 0) {
+                options.bytes = parseSize(arg.substr(7));
+            } else if (arg.rfind("--functions=", 0) == 0) {
+                options.functions = std::stoi(arg.substr(12));
+            } else if (arg.rfind("--depth=", 0) == 0) {
+                options.depth = std::stoi(arg.substr(8));
+            } else if (arg.rfind("--expr=", 0) == 0) {
+                options.expressionLength = std::stoi(arg.substr(7));
+            } else if (arg.rfind("--idents=", 0) == 0) {
+                options.identifiers = std::stoi(arg.substr(9));
+            } else if (arg.rfind("--comments=", 0) == 0) {
+                options.commentPercent = std::stoi(arg.substr(11));
+            } else if (outputFile.empty() && arg[0] != '-') {
+                outputFile = arg;
+            } else {
+                throw std::invalid_argument("unknown argument " + arg);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n"
+                  << "Usage: " << argv[0] << " [--seed=N] [--size=BYTES[K|M|G]] [--functions=N] [--depth=N]"
+                  << " [--expr=N] [--idents=N] [--comments=PERCENT] [output_file]\n";
+        return 1;
+    }
+
+    int fd = 1;
+    if (!outputFile.empty()) {
+        fd = open(outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            std::cerr << "Could not open output file.\n";
+            return 1;
+        }
+    }
+    // Written as it is made, a program of several GB never sits in memory
+    bool ok;
+    {
+        OutputWriter out(fd, 1 << 20);
+        ProgramGenerator(options).write(out);
+        out.flush();
+        ok = out.good();
+    }
+    if (fd != 1) close(fd);
+    if (!ok) {
+        std::cerr << "Could not write the program\n";
+        return 1;
+    }
+    return 0;
+}
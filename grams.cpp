@@ -0,0 +1,199 @@
+// Counts the instruction sequences the compiler makes over a corpus, the
+// candidates for superinstructions, e.g. rat25sgrams --generate=20 prog.txt
+// Operands are shown by kind: a, b, ... for memory, the same letter for the
+// same address, k for an integer literal, f for a real constant and L for a
+// jump target. A sequence never crosses a jump target or goes past a jump or
+// RET, where an executor couldn't run it as one instruction.
+#include "classes/Driver.h"
+#include "classes/ProgramGenerator.h"
+#include "classes/Superinstructions.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct GramOptions {
+    size_t longest = 4;
+    size_t top = 10;
+    // Mine what is left after fusing. Each program is also compiled unfused, a
+    // fused one that doesn't expand back to it is an error.
+    bool fused = false;
+};
+
+struct Corpus {
+    size_t programs = 0;
+    size_t instructions = 0;
+    size_t fusedInstructions = 0;
+    // By length, sequence -> times seen
+    std::vector<std::unordered_map<std::string, size_t>> grams;
+};
+
+static std::string shape(const std::vector<Instruction>& code, size_t start, size_t length) {
+    std::unordered_map<std::string, char> letters;
+    std::string text;
+    for (size_t i = start; i < start + length; ++i) {
+        const Instruction& instr = code[i];
+        if (!text.empty()) text += "; ";
+        text += instr.op;
+        if (instr.operand.empty()) continue;
+        text += ' ';
+        if (CodeGen::isJump(instr.op)) {
+            text += 'L';
+        } else if (instr.op == "PUSHI") {
+            text += 'k';
+        } else if (instr.op == "PUSHF") {
+            text += 'f';
+        } else if (instr.op == "PUSHM" || instr.op == "POPM" || instr.op == "PUSHMX" || instr.op == "POPMX" ||
+                   CodeGen::isVectorOp(instr.op)) {
+            std::vector<int> addresses = CodeGen::addresses(instr.operand);
+            for (size_t k = 0; k < addresses.size(); ++k) {
+                auto letter = letters.emplace(std::to_string(addresses[k]), char('a' + letters.size())).first;
+                if (k > 0) text += ',';
+                text += letter->second;
+            }
+        } else {
+            text += instr.operand;
+        }
+    }
+    return text;
+}
+
+static void mine(const std::vector<Instruction>& code, const GramOptions& options, Corpus& corpus) {
+    std::vector<bool> target(code.size() + 1, false);
+    for (const auto& instr : code) {
+        if (CodeGen::isJump(instr.op) && !instr.operand.empty()) {
+            size_t addr = std::stoul(instr.operand);
+            if (addr >= 1 && addr <= code.size()) target[addr - 1] = true;
+        }
+    }
+    // Straight-line runs [start, end)
+    size_t start = 0;
+    for (size_t i = 0; i <= code.size(); ++i) {
+        bool ends = i == code.size() || (i > start && (target[i] || code[i].op == "LABEL"));
+        if (!ends && !(CodeGen::isJump(code[i].op) || code[i].op == "RET" || Superinstructions::returns(code[i].op))) {
+            continue;
+        }
+        size_t end = ends ? i : i + 1;
+        for (size_t n = 2; n <= options.longest; ++n) {
+            for (size_t k = start; k + n <= end; ++k) corpus.grams[n][shape(code, k, n)]++;
+        }
+        start = end;
+        if (ends && i < code.size()) --i;
+    }
+}
+
+static bool compileInto(const std::string& name, const std::string& source, const GramOptions& options,
+                        Corpus& corpus) {
+    CompileResult plain = compile(source);
+    if (!plain.ok) {
+        std::cerr << name << ": " << plain.error << "\n";
+        return false;
+    }
+    if (!options.fused) {
+        corpus.programs++;
+        corpus.instructions += plain.instructions.size();
+        mine(plain.instructions, options, corpus);
+        return true;
+    }
+
+    CompileOptions fuse;
+    fuse.fuse = true;
+    CompileResult fused = compile(source, fuse);
+    if (!fused.ok) {
+        std::cerr << name << ": " << fused.error << "\n";
+        return false;
+    }
+    std::vector<Instruction> expanded = Superinstructions::expand(fused.instructions);
+    bool same = expanded.size() == plain.instructions.size();
+    for (size_t i = 0; same && i < expanded.size(); ++i) {
+        same = expanded[i].op == plain.instructions[i].op && expanded[i].operand == plain.instructions[i].operand;
+    }
+    if (!same) {
+        std::cerr << name << ": the fused program doesn't expand back to the unfused one\n";
+        return false;
+    }
+    corpus.programs++;
+    corpus.instructions += plain.instructions.size();
+    corpus.fusedInstructions += fused.instructions.size();
+    mine(fused.instructions, options, corpus);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    GramOptions options;
+    GeneratorOptions generator;
+    size_t generated = 0;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--longest=", 0) == 0) {
+            options.longest = std::max<size_t>(2, std::stoul(arg.substr(10)));
+        } else if (arg.rfind("--top=", 0) == 0) {
+            options.top = std::stoul(arg.substr(6));
+        } else if (arg == "--fused") {
+            options.fused = true;
+        } else if (arg.rfind("--generate=", 0) == 0) {
+            generated = std::stoul(arg.substr(11));
+        } else if (arg.rfind("--size=", 0) == 0) {
+            generator.bytes = std::stoull(arg.substr(7)) << 10;
+        } else if (arg[0] != '-') {
+            files.push_back(arg);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--longest=N] [--top=N] [--fused]"
+                      << " [--generate=N [--size=KB]] [source_file ...]\n";
+            return 1;
+        }
+    }
+    if (files.empty() && generated == 0) generated = 10;
+
+    Corpus corpus;
+    corpus.grams.resize(options.longest + 1);
+    bool ok = true;
+    for (const auto& file : files) {
+        std::ifstream in(file, std::ios::binary);
+        if (!in) {
+            std::cerr << "Could not open " << file << "\n";
+            ok = false;
+            continue;
+        }
+        std::ostringstream source;
+        source << in.rdbuf();
+        ok = compileInto(file, source.str(), options, corpus) && ok;
+    }
+    // Seeds 1 to N, so a corpus can be mined again
+    for (size_t seed = 1; seed <= generated; ++seed) {
+        generator.seed = seed;
+        ok = compileInto("generated " + std::to_string(seed), ProgramGenerator(generator).generate(), options, corpus) &&
+             ok;
+    }
+
+    std::cout << "[GRAMS] " << corpus.programs << " programs, " << corpus.instructions << " instructions";
+    char line[256];
+    if (options.fused) {
+        std::snprintf(line, sizeof(line), ", %zu fused, %.1f%% fewer", corpus.fusedInstructions,
+                      corpus.instructions > 0 ? 100.0 * (corpus.instructions - corpus.fusedInstructions) /
+                                                    corpus.instructions : 0.0);
+        std::cout << line;
+    }
+    std::cout << "\n";
+    size_t mined = options.fused ? corpus.fusedInstructions : corpus.instructions;
+    for (size_t n = 2; n <= options.longest; ++n) {
+        std::vector<std::pair<std::string, size_t>> ranked(corpus.grams[n].begin(), corpus.grams[n].end());
+        std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+        // Fusing one occurrence saves n - 1 dispatches, occurrences can overlap
+        std::cout << "[GRAMS] length " << n << ", " << ranked.size() << " distinct\n";
+        for (size_t k = 0; k < ranked.size() && k < options.top; ++k) {
+            std::snprintf(line, sizeof(line), "[GRAMS] %8zu %6.2f%% saved  ", ranked[k].second,
+                          mined > 0 ? 100.0 * ranked[k].second * (n - 1) / mined : 0.0);
+            std::cout << line << ranked[k].first << "\n";
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,48 @@
+// Links object modules written by the compiler's --module mode into one
+// program listing, e.g. rat25sld program.out main.o25 math.o25
+#include "classes/Linker.h"
+#include "classes/OutputWriter.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <output_file> <object_file>...\n";
+        return 1;
+    }
+
+    Linker linker;
+    try {
+        for (int i = 2; i < argc; ++i) {
+            linker.add(argv[i], ObjectModule::readFile(argv[i]));
+        }
+        linker.link();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    int fd = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Could not open output file.\n";
+        return 1;
+    }
+    bool ok;
+    {
+        OutputWriter out(fd);
+        linker.print(out);
+        out.flush();
+        ok = out.good();
+    }
+    close(fd);
+    if (!ok) {
+        std::cerr << "Could not write output file.\n";
+        return 1;
+    }
+    std::cout << "[LINK] " << linker.moduleCount() << " modules, " << linker.functionCount() << " functions, "
+              << linker.getInstructions().size() << " instructions, " << linker.dataSize() << " words of memory\n";
+    return 0;
+}
@@ -1,42 +1,282 @@
-#include "classes/Lexer.h"
-#include "classes/parser.h"
-#include "classes/SymbolTable.h"
-#include "classes/CodeGen.h"
+#include "classes/Driver.h"
+#include "classes/ThreadPool.h"
+#include "classes/CompileServer.h"
+#include "classes/Coordinator.h"
+#include "classes/Protocol.h"
+#include "classes/CompileCache.h"
+#include "classes/Profiler.h"
 
-#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
 #include <fstream>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
 
-int main(int argc, char* argv[]) {
-    if (argc < 3) {
-        std::cerr << "Usage: " << argv[0] << " <input_file> <output_file>\n";
-        return 1;
+namespace fs = std::filesystem;
+
+// Sources named by a manifest (one path per line, relative to the manifest,
+// '#' starts a comment line) or every .txt file in a directory
+static std::vector<fs::path> collectSources(const fs::path& batch) {
+    std::vector<fs::path> sources;
+    if (fs::is_directory(batch)) {
+        for (const auto& entry : fs::directory_iterator(batch)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".txt") {
+                sources.push_back(entry.path());
+            }
+        }
+        std::sort(sources.begin(), sources.end());
+        return sources;
     }
 
-    std::string inputFile = argv[1];
-    std::string outputFile = argv[2];
+    std::ifstream manifest(batch);
+    if (!manifest) {
+        throw std::runtime_error("Could not open batch manifest " + batch.string());
+    }
+    std::string line;
+    while (std::getline(manifest, line)) {
+        line.erase(0, line.find_first_not_of(" \t\r"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (line.empty() || line[0] == '#') continue;
+        fs::path source(line);
+        sources.push_back(source.is_absolute() ? source : batch.parent_path() / source);
+    }
+    return sources;
+}
 
-    std::ofstream outFile(outputFile);
-    if (!outFile) {
-        std::cerr << "Could not open output file.\n";
-        return 1;
+// Where a batch runs: jobs threads in this process, or with workers > 0 that
+// many worker processes under a Coordinator
+struct BatchPlan {
+    size_t jobs;
+    size_t workers = 0;
+    Coordinator::Transport transport = Coordinator::Transport::Unix;
+};
+
+static int runBatch(const fs::path& batch, const fs::path& outputDir, const BatchPlan& plan,
+                    const CompileOptions& options) {
+    std::vector<fs::path> sources = collectSources(batch);
+    fs::create_directories(outputDir);
+
+    // One listing per input, named like the single-file runs: <name>.txt.out
+    std::vector<std::string> outputs;
+    std::set<std::string> names;
+    for (const auto& source : sources) {
+        std::string name = source.filename().string() + ".out";
+        if (!names.insert(name).second) {
+            std::cerr << "Two inputs would both write " << name << "\n";
+            return 1;
+        }
+        outputs.push_back((outputDir / name).string());
+    }
+
+    std::vector<CompileStats> results(sources.size());
+    auto start = std::chrono::steady_clock::now();
+    std::string ranOn;
+    if (plan.workers > 0) {
+        std::vector<Coordinator::Job> jobs;
+        for (size_t i = 0; i < sources.size(); ++i) jobs.push_back({sources[i].string(), outputs[i]});
+        Coordinator coordinator(fs::read_symlink("/proc/self/exe").string(), plan.workers, plan.transport);
+        results = coordinator.run(jobs, options);
+        ranOn = std::to_string(coordinator.size()) + " workers (" + std::to_string(coordinator.restarts()) +
+                " restarts)";
+    } else {
+        // Biggest first so a large file isn't the last thing left running
+        std::vector<size_t> order(sources.size());
+        std::vector<uintmax_t> sizes(sources.size());
+        for (size_t i = 0; i < sources.size(); ++i) {
+            std::error_code ec;
+            order[i] = i;
+            sizes[i] = fs::file_size(sources[i], ec);
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+        ThreadPool pool(plan.jobs);
+        for (size_t i : order) {
+            pool.submit([&, i] { results[i] = compileFile(sources[i].string(), outputs[i], options); });
+        }
+        pool.wait();
+        ranOn = std::to_string(pool.size()) + " threads (" + std::to_string(pool.steals()) + " steals)";
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t failed = 0, bytesIn = 0, bytesOut = 0, instructions = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const CompileStats& r = results[i];
+        bytesIn += r.sourceBytes;
+        bytesOut += r.outputBytes;
+        instructions += r.instructions;
+        if (!r.ok) {
+            failed++;
+            std::cout << "[BATCH] failed " << sources[i].string() << ": " << r.error << "\n";
+        }
+    }
+    double rate = seconds > 0 ? 1.0 / seconds : 0;
+    std::cout << "[BATCH] " << results.size() << " files, " << failed << " failed, " << ranOn << ", " << seconds
+              << " s\n";
+    std::cout << "[BATCH] " << results.size() * rate << " files/s, " << bytesIn * rate / 1e6 << " MB/s of source, "
+              << instructions * rate << " instructions/s, " << bytesOut << " bytes written\n";
+    if (options.cache != nullptr) options.cache->printStats(std::cout);
+    return failed == 0 ? 0 : 1;
+}
+
+// What was asked to be profiled, and where the files go
+struct ProfileOptions {
+    bool timePasses = false;
+    bool counters = false;
+    std::string traceFile;
+    std::string reportFile;
+
+    bool any() const { return timePasses || counters || !traceFile.empty() || !reportFile.empty(); }
+};
+
+// --time-passes, --perf-counters, --trace-events and --perf-report output, once
+// every compilation has reported
+static void reportProfile(const Profiler* profiler, const ProfileOptions& profile) {
+    if (profiler == nullptr) return;
+    if (profile.timePasses) profiler->print(std::cout);
+    if (profile.counters) profiler->printCounters(std::cout);
+    if (!profile.traceFile.empty() && !profiler->writeTrace(profile.traceFile)) {
+        std::cerr << "Could not write trace file " << profile.traceFile << "\n";
+    }
+    if (!profile.reportFile.empty() && !profiler->writeReport(profile.reportFile)) {
+        std::cerr << "Could not write report file " << profile.reportFile << "\n";
     }
+}
 
-    try {
-        Lexer lexer(inputFile);
-        SymbolTable symbolTable;
-        CodeGen codeGen;
+int main(int argc, char* argv[]) {
+    std::vector<std::string> args;
+    CompileOptions options;
+    bool batch = false;
+    std::string serve;
+    std::string cacheDir;
+    uint64_t cacheBytes = CompileCache::defaultMaxBytes;
+    ProfileOptions profile;
+    BatchPlan plan{std::thread::hardware_concurrency()};
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--stream") {
+            options.stream = true;
+        } else if (arg.rfind("--stream=", 0) == 0) {
+            options.stream = true;
+            options.window = std::stoul(arg.substr(9));
+        } else if (arg == "--syntax-only") {
+            options.mode = CompileMode::SyntaxOnly;
+        } else if (arg == "--symbols-only") {
+            options.mode = CompileMode::SymbolsOnly;
+        } else if (arg == "--lazy") {
+            options.lazy = true;
+        } else if (arg == "--lazy=strict") {
+            options.lazy = options.strict = true;
+        } else if (arg == "--fuse") {
+            options.fuse = true;
+        } else if (arg == "--module") {
+            options.module = true;
+        } else if (arg == "--batch") {
+            batch = true;
+        } else if (arg == "--serve") {
+            serve = defaultSocketPath();
+        } else if (arg.rfind("--serve=", 0) == 0) {
+            serve = arg.substr(8);
+        } else if (arg == "--cache") {
+            const char* dir = std::getenv("RAT25S_CACHE");
+            cacheDir = dir != nullptr && *dir ? dir : ".rat25s-cache";
+        } else if (arg.rfind("--cache=", 0) == 0) {
+            cacheDir = arg.substr(8);
+        } else if (arg.rfind("--cache-size=", 0) == 0) {
+            cacheBytes = std::stoull(arg.substr(13)) << 20;
+        } else if (arg == "--time-passes") {
+            profile.timePasses = true;
+        } else if (arg == "--perf-counters") {
+            profile.counters = true;
+        } else if (arg.rfind("--trace-events=", 0) == 0) {
+            profile.traceFile = arg.substr(15);
+        } else if (arg.rfind("--perf-report=", 0) == 0) {
+            profile.reportFile = arg.substr(14);
+        } else if (arg.rfind("--jobs=", 0) == 0) {
+            plan.jobs = std::stoul(arg.substr(7));
+        } else if (arg.rfind("--workers=", 0) == 0) {
+            plan.workers = std::stoul(arg.substr(10));
+        } else if (arg == "--worker-transport=tcp") {
+            plan.transport = Coordinator::Transport::Tcp;
+        } else if (arg == "--worker-transport=unix") {
+            plan.transport = Coordinator::Transport::Unix;
+        } else {
+            args.push_back(arg);
+        }
+    }
+    // Only made when asked for, so an unprofiled compile doesn't even read a clock
+    std::unique_ptr<Profiler> profiler;
+    if (profile.any()) {
+        // Counters only for the outputs that show them, reading them is a syscall per scope
+        profiler = std::make_unique<Profiler>(!profile.traceFile.empty(),
+                                              profile.counters || !profile.reportFile.empty());
+        options.profiler = profiler.get();
+    }
 
-        Parser parser(lexer, symbolTable, codeGen);
-        Parser::setOutputFile(outFile); 
-        parser.parse();
-        parser.outputParseTree(outFile);
+    if (!serve.empty() && args.empty()) {
+        try {
+            CompileServer server(serve, plan.jobs, profiler.get());
+            std::cout << "[SERVE] listening on " << serve << std::endl;
+            server.run();
+            std::cout << "[SERVE] stopped after " << server.requestsServed() << " requests\n";
+            reportProfile(profiler.get(), profile);
+            return 0;
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+    }
+    if (args.size() != 2 || !serve.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--stream[=window]] [--lazy[=strict]] [--fuse] [--cache[=dir]]"
+                  << " [--cache-size=MB] <input_file> <output_file>\n"
+                  << "       " << argv[0] << " --module [--cache[=dir]] <input_file> <object_file>\n"
+                  << "Checking only, in file and batch mode: --syntax-only --symbols-only\n"
+                  << "       " << argv[0] << " --batch [--jobs=N] [--stream[=window]] [--cache[=dir]]"
+                  << " <manifest|dir> <output_dir>\n"
+                  << "       " << argv[0] << " --batch --workers=N [--worker-transport=unix|tcp] [--stream[=window]]"
+                  << " <manifest|dir> <output_dir>\n"
+                  << "       " << argv[0] << " --serve[=socket|tcp:[host:]port] [--jobs=N]\n"
+                  << "Profiling, in any mode: --time-passes --trace-events=<file.json>\n"
+                  << "                        --perf-counters --perf-report=<file.json>\n"
+                  << "Streamed listings (--stream) have the Assembly Code first, written while parsing,\n"
+                  << "then the parse summary and the Symbol Table\n";
+        return 1;
+    }
 
-        symbolTable.print(outFile);
-        codeGen.print(outFile);
-    } catch (const std::exception& e) {
-        outFile << "Exception: " << e.what() << "\n";
+    if (plan.workers > 0 && !cacheDir.empty()) {
+        std::cerr << "--workers compiles in other processes, it can't use --cache\n";
         return 1;
     }
 
-    return 0;
+    // Checked before any Lexer or Parser is made, a hit skips both
+    std::unique_ptr<CompileCache> cache;
+    if (!cacheDir.empty()) {
+        cache = std::make_unique<CompileCache>(cacheDir, cacheBytes);
+        options.cache = cache.get();
+    }
+
+    if (batch) {
+        try {
+            int status = runBatch(args[0], args[1], plan, options);
+            reportProfile(profiler.get(), profile);
+            return status;
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    options.trace = &std::cout;
+    options.diagnostics = &std::cerr;
+    CompileStats stats = compileFile(args[0], args[1], options);
+    if (!stats.opened) {
+        std::cerr << stats.error << "\n";
+    }
+    if (cache) cache->printStats(std::cout);
+    reportProfile(profiler.get(), profile);
+    return stats.ok ? 0 : 1;
 }
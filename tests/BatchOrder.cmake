@@ -0,0 +1,19 @@
+# A batch on one thread starts on its biggest file, largerat25s.txt of the
+# samples. The first compile event in the trace names the file that ran first.
+#   cmake -DCOMPILER=<compilersAssigment2> -DSAMPLES=<test-input-files> -DWORK=<dir> -P BatchOrder.cmake
+file(REMOVE_RECURSE "${WORK}")
+file(MAKE_DIRECTORY "${WORK}")
+execute_process(
+        COMMAND "${COMPILER}" --batch --jobs=1 "--trace-events=${WORK}/trace.json"
+                "${SAMPLES}/rat25s.manifest" "${WORK}"
+        RESULT_VARIABLE result
+        OUTPUT_QUIET)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "batch compile failed: ${result}")
+endif()
+
+file(READ "${WORK}/trace.json" trace)
+string(REGEX MATCH "\"file\":\"[^\"]*\"" first "${trace}")
+if(NOT first MATCHES "largerat25s\\.txt\"$")
+    message(FATAL_ERROR "expected largerat25s.txt to start first, got ${first}")
+endif()